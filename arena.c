@@ -0,0 +1,97 @@
+#include "arena.h"
+
+#include <string.h>
+#include <sys/mman.h>
+
+#define ARENA_BLOCK_SIZE   (1024 * 1024)
+#define ARENA_ALIGN        16
+
+struct ArenaBlock {
+	ArenaBlock*  next;
+	size_t       size;
+	size_t       used;
+};
+
+static inline size_t align(size_t size) {
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static inline ArenaBlock* new_block(size_t size, ArenaBlock* next) {
+	ArenaBlock* block;
+	void* mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (mem == MAP_FAILED)
+		return NULL;
+	block = (ArenaBlock*) mem;
+	block->next = next;
+	block->size = size;
+	block->used = align(sizeof(ArenaBlock));
+	return block;
+}
+
+void init_arena(Arena* arena) {
+	arena->block = NULL;
+	arena->block_size = ARENA_BLOCK_SIZE;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+	ArenaBlock* block = arena->block;
+	void* mem;
+
+	size = align(size);
+	if (!block || (block->used + size > block->size)) {
+		size_t block_size = arena->block_size;
+		while (block_size < size + align(sizeof(ArenaBlock)))
+			block_size *= 2;
+		block = new_block(block_size, arena->block);
+		if (!block)
+			return NULL;
+		arena->block = block;
+	}
+
+	mem = (char*) block + block->used;
+	block->used += size;
+	return mem;
+}
+
+void reset_arena(Arena* arena) {
+	ArenaBlock* block = arena->block;
+	ArenaBlock* next;
+	size_t start = align(sizeof(ArenaBlock));
+
+	if (!block)
+		return;
+	next = block->next;
+	while (next) {
+		ArenaBlock* temp = next->next;
+		munmap(next, next->size);
+		next = temp;
+	}
+	memset((char*) block + start, 0, block->used - start);
+	block->next = NULL;
+	block->used = start;
+}
+
+void merge_arena(Arena* arena, Arena* from) {
+	ArenaBlock* last = from->block;
+
+	if (!last)
+		return;
+	while (last->next)
+		last = last->next;
+	if (arena->block) {
+		last->next = arena->block->next;
+		arena->block->next = from->block;
+	} else
+		arena->block = from->block;
+	from->block = NULL;
+}
+
+void destroy_arena(Arena* arena) {
+	ArenaBlock* block = arena->block;
+	while (block) {
+		ArenaBlock* next = block->next;
+		munmap(block, block->size);
+		block = next;
+	}
+	arena->block = NULL;
+}
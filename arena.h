@@ -0,0 +1,30 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator. Memory comes zeroed in large mmap'ed blocks and is only
+ * released all at once by destroy_arena.
+ */
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+	ArenaBlock*  block;
+	size_t       block_size;
+} Arena;
+
+void init_arena(Arena* arena);
+
+void* arena_alloc(Arena* arena, size_t size);
+
+/* releases all but the newest block, which is cleared for reuse */
+void reset_arena(Arena* arena);
+
+/* moves the blocks of from into arena, leaving from empty */
+void merge_arena(Arena* arena, Arena* from);
+
+void destroy_arena(Arena* arena);
+
+#endif
@@ -0,0 +1,1475 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "parser.h"
+#include "jit.h"
+#include "regvm.h"
+
+/* Benchmark driver: ./bench [name [args...]] */
+
+/*
+ * the bench is linked with --wrap for these, so every call is counted;
+ * parallel parsing and compiling allocate from several threads
+ */
+static long malloc_calls;
+static long mmap_calls;
+static size_t mapped_bytes;
+static size_t peak_mapped_bytes;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void* __real_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset);
+int __real_munmap(void* addr, size_t length);
+
+static inline void count_call(long* calls) {
+	__atomic_fetch_add(calls, 1, __ATOMIC_RELAXED);
+}
+
+void* __wrap_malloc(size_t size) {
+	count_call(&malloc_calls);
+	return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+	count_call(&malloc_calls);
+	return __real_calloc(count, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+	count_call(&malloc_calls);
+	return __real_realloc(ptr, size);
+}
+
+void* __wrap_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	void* p = __real_mmap(addr, length, prot, flags, fd, offset);
+	count_call(&mmap_calls);
+	if (p != MAP_FAILED) {
+		size_t mapped = __atomic_add_fetch(&mapped_bytes, length, __ATOMIC_RELAXED);
+		size_t peak = __atomic_load_n(&peak_mapped_bytes, __ATOMIC_RELAXED);
+		while ((mapped > peak) && !__atomic_compare_exchange_n(&peak_mapped_bytes, &peak, mapped,
+			1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			;
+	}
+	return p;
+}
+
+int __wrap_munmap(void* addr, size_t length) {
+	int result = __real_munmap(addr, length);
+	if (result == 0)
+		__atomic_sub_fetch(&mapped_bytes, length, __ATOMIC_RELAXED);
+	return result;
+}
+
+typedef struct Buffer {
+	char*   data;
+	size_t  size;
+	size_t  capacity;
+} Buffer;
+
+static void append(Buffer* b, const char* fmt, ...) {
+	va_list ap;
+	int n;
+
+	while (1) {
+		va_start(ap, fmt);
+		n = vsnprintf(b->data + b->size, b->capacity - b->size, fmt, ap);
+		va_end(ap);
+		if (b->size + n < b->capacity)
+			break;
+		b->capacity = 2 * (b->capacity + n) + 4096;
+		b->data = (char*) realloc(b->data, b->capacity);
+		if (!b->data) {
+			perror("bench");
+			exit(EXIT_FAILURE);
+		}
+	}
+	b->size += n;
+}
+
+static void free_buffer(Buffer* b) {
+	free(b->data);
+	b->data = NULL;
+	b->size = b->capacity = 0;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* identifiers cannot contain digits, so numbers are spelled in letters */
+static const char* name(const char* prefix, int n) {
+	static char buf[4][64];
+	static int slot;
+	char* s = buf[slot++ & 3];
+	int i = sprintf(s, "%s", prefix);
+	do {
+		s[i++] = 'a' + (n % 26);
+		n /= 26;
+	} while (n);
+	s[i] = '\0';
+	return s;
+}
+
+/* machine generated style: long names, deep indentation */
+static void gen_keyword_heavy(Buffer* b, int procs) {
+	int i;
+	for (i=0; i<procs; i++) {
+		const char* id = name("generated_procedure_", i);
+		append(b, "procedure %s(lower_bound, upper_bound : integer) : integer;\n", id);
+		append(b, "        var index_outer, index_inner, accumulator : integer;\n");
+		append(b, "begin\n");
+		append(b, "        accumulator := 0;\n");
+		append(b, "        for index_outer := lower_bound to upper_bound do\n");
+		append(b, "                for index_inner := index_outer to upper_bound do\n");
+		append(b, "                        accumulator := accumulator + index_outer * index_inner + 1024;\n");
+		append(b, "                done;\n");
+		append(b, "        done;\n");
+		append(b, "        return accumulator;\n");
+		append(b, "end %s;\n\n", id);
+	}
+}
+
+/* a callable program: gen_keyword_heavy plus a main */
+static void gen_program(Buffer* b, int procs) {
+	gen_keyword_heavy(b, procs);
+	append(b, "procedure main() : integer;\nbegin\n");
+	append(b, "        return %s(1, 10);\n", name("generated_procedure_", 0));
+	append(b, "end main;\n");
+}
+
+/* few procedures with long bodies of nested expressions and calls */
+static void gen_expr_heavy(Buffer* b, int procs, int groups) {
+	int i, k;
+	for (i=0; i<procs; i++) {
+		const char* callee = name("expr_", i - 1);
+		append(b, "procedure %s(a, b, c : integer) : integer;\n", name("expr_", i));
+		append(b, "  var x, y, z : integer;\nbegin\n");
+		for (k=0; k<groups; k++) {
+			append(b, "  x := a + b * c + %d;\n", k);
+			if (i) {
+				append(b, "  y := (x + a) * (b + c) + x * 3 + %s(x, a, b);\n", callee);
+				append(b, "  z := %s(y, x + 1, (a + b) * 2) + y * y;\n", callee);
+			} else {
+				append(b, "  y := (x + a) * (b + c) + x * 3;\n");
+				append(b, "  z := y * y;\n");
+			}
+			append(b, "  for x := a to b do\n");
+			append(b, "    z := z + x * (y + 1) + (a + b) * c;\n");
+			append(b, "    y := y + z * 2;\n");
+			append(b, "  done;\n");
+		}
+		append(b, "  return z + y;\nend %s;\n\n", name("expr_", i));
+	}
+	append(b, "procedure main() : integer;\nbegin\n");
+	append(b, "  return %s(1, 2, 3);\nend main;\n", name("expr_", procs - 1));
+}
+
+/* one flat expression of terms operands, mixing the binary operators */
+static void gen_long_sum(Buffer* b, int terms) {
+	static const char* TERMS[] = { "x", "2 * x", "3", "(x + 1) * 2", "x * x * 5" };
+	int i;
+
+	append(b, "procedure main() : integer;\n  var x : integer;\nbegin\n  x := 1;\n  return x");
+	for (i=1; i<terms; i++)
+		append(b, " + %s", TERMS[i % 5]);
+	append(b, ";\nend main;\n");
+}
+
+/* procedures whose arity cycles through 0..arities-1, each calling the previous one */
+static void gen_signatures(Buffer* b, int procs, int arities) {
+	int i, k;
+	for (i=0; i<procs; i++) {
+		int arity = i % arities;
+		append(b, "procedure %s(", name("sig_", i));
+		for (k=0; k<arity; k++)
+			append(b, "%s%s", k ? ", " : "", name("p", k));
+		append(b, "%s) : integer;\nbegin\n  return ", arity ? " : integer" : "");
+		if (i) {
+			append(b, "%s(", name("sig_", i - 1));
+			for (k=0; k<(i - 1) % arities; k++)
+				append(b, "%s%d", k ? ", " : "", k);
+			append(b, ")");
+		} else
+			append(b, "1");
+		append(b, ";\nend %s;\n\n", name("sig_", i));
+	}
+	append(b, "procedure main() : integer;\nbegin\n  return 1;\nend main;\n");
+}
+
+/* a hot loop over expressions whose operands are literals or vars holding constants */
+static void gen_constant_loop(Buffer* b, int iterations) {
+	append(b, "procedure main() : integer;\n  var i, k, scale, x : integer;\nbegin\n");
+	append(b, "  scale := 4 * 1024;\n  k := scale + 3;\n");
+	append(b, "  for i := 1 to %d do\n", iterations);
+	append(b, "    x := i + (scale + 16) * 2 + k * k * 7 + 60 * 60 * 24 + x * 1 + 0;\n");
+	append(b, "    x := x + scale * 2 + 1 + 2 + 3;\n");
+	append(b, "  done;\n  return x + k;\nend main;\n");
+}
+
+/* one counting loop in a procedure called from main, the shape of fat() */
+static void gen_counting_loop(Buffer* b, int iterations) {
+	append(b, "procedure sum(n : integer) : integer;\n  var i, total : integer;\nbegin\n");
+	append(b, "  total := 0;\n  for i := 1 to n do\n    total := total + i * 3 + 1;\n  done;\n");
+	append(b, "  return total;\nend sum;\n\n");
+	append(b, "procedure main() : integer;\nbegin\n  return sum(%d);\nend main;\n", iterations);
+}
+
+/* fat() of the README sample */
+static void gen_factorial_loop(Buffer* b, int iterations) {
+	append(b, "procedure fat(n : integer) : integer;\n  var i, res : integer;\nbegin\n");
+	append(b, "  res := 1;\n  for i := 1 to n do\n    res := res * i;\n  done;\n");
+	append(b, "  return res;\nend fat;\n\n");
+	append(b, "procedure main() : integer;\nbegin\n  return fat(%d);\nend main;\n", iterations);
+}
+
+/* gen_counting_loop with the loop body in a procedure called every iteration */
+static void gen_call_loop(Buffer* b, int iterations) {
+	append(b, "procedure step(total, i : integer) : integer;\nbegin\n");
+	append(b, "  return total + i * 3 + 1;\nend step;\n\n");
+	append(b, "procedure sum(n : integer) : integer;\n  var i, total : integer;\nbegin\n");
+	append(b, "  for i := 1 to n do\n    total := step(total, i);\n  done;\n");
+	append(b, "  return total;\nend sum;\n\n");
+	append(b, "procedure main() : integer;\nbegin\n  return sum(%d);\nend main;\n", iterations);
+}
+
+/* a loop body mostly made of what does not change between iterations, a pure call included */
+static void gen_invariant_loop(Buffer* b, int iterations) {
+	append(b, "procedure scale(x : integer) : integer;\nbegin\n  return x * x + 3;\nend scale;\n\n");
+	append(b, "procedure sum(n, k : integer) : integer;\n  var i, total : integer;\nbegin\n");
+	append(b, "  for i := 1 to n do\n    total := total + i * (k * 3 + 7) + scale(k + 1) * n;\n  done;\n");
+	append(b, "  return total;\nend sum;\n\n");
+	append(b, "procedure main() : integer;\nbegin\n  return sum(%d, 5);\nend main;\n", iterations);
+}
+
+/* arithmetic on the loop var: products by constants, a power of two among them, and by an invariant */
+static void gen_arith_loop(Buffer* b, int iterations) {
+	append(b, "procedure mix(n, k : integer) : integer;\n  var i, m, total : integer;\nbegin\n");
+	append(b, "  m := k + 2;\n  for i := 1 to n do\n");
+	append(b, "    total := total + i * 12 + i * 8 + m * i + 7;\n");
+	append(b, "    total := total + i * 5 + 3;\n  done;\n");
+	append(b, "  return total;\nend mix;\n\n");
+	append(b, "procedure main() : integer;\nbegin\n  return mix(%d, 5);\nend main;\n", iterations);
+}
+
+/* a loop calling small procedures, one of which calls the others */
+static void gen_nested_calls(Buffer* b, int iterations) {
+	append(b, "procedure sq(x : integer) : integer;\nbegin\n  return x * x + 1;\nend sq;\n\n");
+	append(b, "procedure scale(a, b : integer) : integer;\nbegin\n  return a + b * 2;\nend scale;\n\n");
+	append(b, "procedure step(total, i : integer) : integer;\nbegin\n");
+	append(b, "  return total + sq(i) + scale(i, 3);\nend step;\n\n");
+	append(b, "procedure run(n : integer) : integer;\n  var i, total : integer;\nbegin\n");
+	append(b, "  for i := 1 to n do\n    total := step(total, i);\n  done;\n");
+	append(b, "  return total;\nend run;\n\n");
+	append(b, "procedure main() : integer;\nbegin\n  return run(%d);\nend main;\n", iterations);
+}
+
+/*
+ * Recursion depth levels deep, each level a call from the loop of walk
+ * and tail calls through a, b and c back to it. The extra calls in main
+ * keep the inliner from folding the ring into one procedure.
+ */
+static void gen_tail_calls(Buffer* b, int iterations, int depth) {
+	static const char* HOPS[][3] = {
+		{ "a", "s * 3 + d", "b" },
+		{ "b", "s + i * d", "c" },
+		{ "c", "s * 5 + i", "walk" }
+	};
+	int k;
+
+	for (k=0; k<3; k++) {
+		append(b, "procedure %s(n, d, acc : integer) : integer;\n  var i, s : integer;\nbegin\n", HOPS[k][0]);
+		append(b, "  s := acc;\n  for i := 1 to 2 do\n    s := %s;\n  done;\n", HOPS[k][1]);
+		append(b, "  return %s(n, d, s);\nend %s;\n\n", HOPS[k][2], HOPS[k][0]);
+	}
+	append(b, "procedure walk(n, d, acc : integer) : integer;\n  var i, r : integer;\nbegin\n");
+	append(b, "  r := acc;\n  for i := d to n do\n    r := a(n, i + 1, r) + 1;\n    i := n;\n  done;\n");
+	append(b, "  return r;\nend walk;\n\n");
+	append(b, "procedure main() : integer;\n  var j, total : integer;\nbegin\n");
+	append(b, "  for j := 1 to %d do\n    total := total + a(%d, 0, j);\n  done;\n",
+		iterations / depth, depth);
+	append(b, "  return total + b(0, 1, 2) + c(0, 1, 2) + walk(0, 1, 2);\nend main;\n");
+}
+
+/* the nested loops of gen_keyword_heavy, run from 1 to upper */
+static void gen_nested_loops(Buffer* b, int upper) {
+	gen_keyword_heavy(b, 1);
+	append(b, "procedure main() : integer;\nbegin\n");
+	append(b, "        return %s(1, %d);\n", name("generated_procedure_", 0), upper);
+	append(b, "end main;\n");
+}
+
+static void bench_lex(int argc, char* argv[]) {
+	static const ScanLevel levels[] = { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 20000;
+	int rounds = 20;
+	size_t k;
+
+	gen_keyword_heavy(&b, procs);
+
+	for (k=0; k<sizeof(levels)/sizeof(levels[0]); k++) {
+		const Scanner* scanner = get_scanner(levels[k]);
+		long tokens = 0;
+		long checksum = 0;
+		double elapsed;
+		int i;
+
+		if (!scanner)
+			continue;
+		elapsed = now();
+		for (i=0; i<rounds; i++) {
+			Interner names;
+			Lexer l;
+			if (!init_interner(&names))
+				return;
+			init_lexer_buffer(&l, b.data, b.size, &names);
+			l.scanner = scanner;
+			do {
+				lex(&l);
+				tokens++;
+				checksum += l.token + l.lexeme_size + l.symbol
+					+ l.location.from.line + l.location.from.column;
+			} while (l.token != TK_EOF);
+			destroy_interner(&names);
+		}
+		elapsed = now() - elapsed;
+
+		printf("lex/%s: %zu bytes, %ld tokens/round, %.1f Mtokens/s, %.1f MB/s (checksum %ld)\n",
+			scanner->name, b.size, tokens / rounds, tokens / elapsed * 1e-6,
+			(double) b.size * rounds / elapsed / (1024 * 1024), checksum / rounds);
+	}
+	free_buffer(&b);
+}
+
+static int same_tokens(TokenStream* a, TokenStream* b) {
+	return (a->count == b->count)
+		&& (memcmp(a->kind, b->kind, a->count * sizeof(unsigned char)) == 0)
+		&& (memcmp(a->offset, b->offset, a->count * sizeof(unsigned)) == 0)
+		&& (memcmp(a->size, b->size, a->count * sizeof(unsigned)) == 0)
+		&& (memcmp(a->symbol, b->symbol, a->count * sizeof(Symbol)) == 0)
+		&& (memcmp(a->line, b->line, a->count * sizeof(int)) == 0)
+		&& (memcmp(a->column, b->column, a->count * sizeof(int)) == 0);
+}
+
+static void bench_tokens(int argc, char* argv[]) {
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 20000;
+	Interner names;
+	TokenStream serial;
+	double elapsed;
+	int threads;
+
+	gen_keyword_heavy(&b, procs);
+	if (!init_interner(&names))
+		return;
+
+	elapsed = now();
+	if (!tokenize(&serial, b.data, b.size, 1, &names))
+		return;
+	elapsed = now() - elapsed;
+	printf("tokens/1: %zu bytes, %d tokens, %.1f ms, %.1f MB/s\n", b.size, serial.count,
+		elapsed * 1e3, b.size / elapsed / (1024 * 1024));
+
+	for (threads=2; threads<=16; threads*=2) {
+		TokenStream tokens;
+		elapsed = now();
+		if (!tokenize(&tokens, b.data, b.size, threads, &names))
+			break;
+		elapsed = now() - elapsed;
+		printf("tokens/%d: %.1f ms, %.1f MB/s, %s\n", threads, elapsed * 1e3,
+			b.size / elapsed / (1024 * 1024),
+			same_tokens(&serial, &tokens) ? "same as serial" : "DIFFERENT FROM SERIAL");
+		destroy_tokens(&tokens);
+	}
+
+	{
+		Prog* prog;
+		elapsed = now();
+		if (parse_buffer(b.data, b.size, &names, &prog) == PARSE_OK)
+			free_prog(prog);
+		elapsed = now() - elapsed;
+		printf("parse/lexer: %.1f ms\n", elapsed * 1e3);
+
+		elapsed = now();
+		if (parse_tokens(&serial, &names, 1, &prog) == PARSE_OK)
+			free_prog(prog);
+		elapsed = now() - elapsed;
+		printf("parse/tokens: %.1f ms (excluding tokenize)\n", elapsed * 1e3);
+	}
+
+	destroy_tokens(&serial);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+/* compiled and dumped, so the whole Prog takes part in the comparison */
+static char* compile_dump(Prog* prog, size_t* size) {
+	char* text = NULL;
+	FILE* fp;
+
+	if (!resolve_binds(prog) || !type_check(prog) || !compile(prog))
+		return NULL;
+	fp = open_memstream(&text, size);
+	if (!fp)
+		return NULL;
+	dump_interp_prog(&prog->interp, fp);
+	fclose(fp);
+	return text;
+}
+
+static int same_procs(Prog* a, Prog* b) {
+	int i;
+	if (a->proc_count != b->proc_count)
+		return 0;
+	for (i=0; i<a->proc_count; i++) {
+		Proc* p = &a->procs[i];
+		Proc* q = &b->procs[i];
+		if ((p->nid != q->nid) || (p->id != q->id) || (p->mismatch != q->mismatch)
+			|| (p->fparam_count != q->fparam_count) || (p->var_count != q->var_count)
+			|| (p->expr_count != q->expr_count) || (p->stmt_count != q->stmt_count)
+			|| (p->arg_count != q->arg_count) || (p->body.first != q->body.first)
+			|| (p->body.count != q->body.count))
+			return 0;
+	}
+	return 1;
+}
+
+static void bench_parse(int argc, char* argv[]) {
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 20000;
+	Interner names;
+	TokenStream tokens;
+	Prog* serial;
+	char* serial_dump;
+	size_t serial_size;
+	double elapsed;
+	int threads;
+
+	gen_program(&b, procs);
+	if (!init_interner(&names) || !tokenize(&tokens, b.data, b.size, 1, &names))
+		return;
+
+	elapsed = now();
+	if (parse_tokens(&tokens, &names, 1, &serial) != PARSE_OK)
+		return;
+	elapsed = now() - elapsed;
+	printf("parse/1: %d procedures, %.1f ms\n", serial->proc_count, elapsed * 1e3);
+	serial_dump = compile_dump(serial, &serial_size);
+
+	for (threads=2; threads<=16; threads*=2) {
+		Prog* prog;
+		char* dump;
+		size_t size;
+		int same;
+
+		elapsed = now();
+		if (parse_tokens(&tokens, &names, threads, &prog) != PARSE_OK)
+			break;
+		elapsed = now() - elapsed;
+		same = same_procs(serial, prog);
+		dump = compile_dump(prog, &size);
+		same = same && dump && serial_dump && (size == serial_size)
+			&& (memcmp(dump, serial_dump, size) == 0);
+		printf("parse/%d: %.1f ms, %s\n", threads, elapsed * 1e3,
+			same ? "same as serial" : "DIFFERENT FROM SERIAL");
+		free(dump);
+		free_prog(prog);
+	}
+
+	free(serial_dump);
+	free_prog(serial);
+	destroy_tokens(&tokens);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+static void count_phase(const char* phase, long* mallocs, long* mmaps, double* elapsed) {
+	*elapsed = now() - *elapsed;
+	printf("alloc/%s: %ld malloc/calloc/realloc, %ld mmap, %.1f ms\n", phase,
+		malloc_calls - *mallocs, mmap_calls - *mmaps, *elapsed * 1e3);
+	*mallocs = malloc_calls;
+	*mmaps = mmap_calls;
+	*elapsed = now();
+}
+
+/* allocator calls made by each compiler pass, tokenizing excluded */
+static void bench_alloc(int argc, char* argv[]) {
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 10000;
+	Interner names;
+	TokenStream tokens;
+	Prog* prog;
+	long mallocs, mmaps;
+	double elapsed;
+
+	gen_program(&b, procs);
+	if (!init_interner(&names) || !tokenize(&tokens, b.data, b.size, 1, &names))
+		return;
+
+	printf("alloc: %d procedures\n", procs + 1);
+	mallocs = malloc_calls;
+	mmaps = mmap_calls;
+	elapsed = now();
+	if (parse_tokens(&tokens, &names, 1, &prog) != PARSE_OK)
+		return;
+	count_phase("parse", &mallocs, &mmaps, &elapsed);
+	if (!resolve_binds(prog))
+		return;
+	count_phase("binds", &mallocs, &mmaps, &elapsed);
+	if (!type_check(prog))
+		return;
+	count_phase("types", &mallocs, &mmaps, &elapsed);
+	if (!compile(prog))
+		return;
+	count_phase("compile", &mallocs, &mmaps, &elapsed);
+	free_prog(prog);
+	count_phase("free", &mallocs, &mmaps, &elapsed);
+
+	destroy_tokens(&tokens);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+/* best of rounds for each pass over one generated program */
+static void time_passes(const char* input, Buffer* b, int rounds) {
+	static const char* PASSES[] = { "parse", "binds", "types", "compile", "free" };
+	double best[5] = { 1e9, 1e9, 1e9, 1e9, 1e9 };
+	Interner names;
+	TokenStream tokens;
+	int i, k;
+
+	if (!init_interner(&names) || !tokenize(&tokens, b->data, b->size, 1, &names))
+		return;
+	for (i=0; i<rounds; i++) {
+		double t[6];
+		Prog* prog;
+
+		t[0] = now();
+		if (parse_tokens(&tokens, &names, 1, &prog) != PARSE_OK)
+			break;
+		t[1] = now();
+		if (!resolve_binds(prog))
+			break;
+		t[2] = now();
+		if (!type_check(prog))
+			break;
+		t[3] = now();
+		if (!compile(prog))
+			break;
+		t[4] = now();
+		free_prog(prog);
+		t[5] = now();
+		for (k=0; k<5; k++)
+			if (t[k + 1] - t[k] < best[k])
+				best[k] = t[k + 1] - t[k];
+	}
+
+	printf("passes/%s:", input);
+	for (k=0; k<5; k++)
+		printf(" %s %.2f ms%s", PASSES[k], best[k] * 1e3, (k < 4) ? "," : "\n");
+	destroy_tokens(&tokens);
+	destroy_interner(&names);
+}
+
+static void bench_passes(int argc, char* argv[]) {
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 2000;
+	int rounds = 5;
+
+	gen_program(&b, procs);
+	time_passes("keyword", &b, rounds);
+	free_buffer(&b);
+
+	gen_expr_heavy(&b, procs / 10, 40);
+	time_passes("expr", &b, rounds);
+	free_buffer(&b);
+}
+
+static char* stream_dump(const char* data, size_t size, Interner* names, size_t* dump_size) {
+	Prog* prog;
+	char* text = NULL;
+	FILE* fp;
+
+	if (compile_stream_buffer(data, size, names, &prog) != STREAM_OK)
+		return NULL;
+	fp = open_memstream(&text, dump_size);
+	if (fp) {
+		dump_interp_prog(&prog->interp, fp);
+		fclose(fp);
+	}
+	free_prog(prog);
+	return text;
+}
+
+/* whole-program passes against the per-procedure pipeline: time and peak mmap */
+static void bench_stream(int argc, char* argv[]) {
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 2000;
+	Interner names;
+	Prog* prog;
+	char* batch;
+	char* stream;
+	size_t batch_size, stream_size;
+	size_t base;
+	double elapsed;
+
+	gen_program(&b, procs);
+	if (!init_interner(&names))
+		return;
+
+	base = peak_mapped_bytes = mapped_bytes;
+	elapsed = now();
+	if (parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+		return;
+	batch = compile_dump(prog, &batch_size);
+	free_prog(prog);
+	elapsed = now() - elapsed;
+	printf("stream/batch: %d procedures, %.1f ms, peak %zu KB mapped\n", procs + 1,
+		elapsed * 1e3, (peak_mapped_bytes - base) / 1024);
+
+	base = peak_mapped_bytes = mapped_bytes;
+	elapsed = now();
+	stream = stream_dump(b.data, b.size, &names, &stream_size);
+	elapsed = now() - elapsed;
+	printf("stream/stream: %.1f ms, peak %zu KB mapped, %s\n", elapsed * 1e3,
+		(peak_mapped_bytes - base) / 1024,
+		(batch && stream && (batch_size == stream_size) && (memcmp(batch, stream, batch_size) == 0))
+			? "same code" : "DIFFERENT CODE");
+
+	free(batch);
+	free(stream);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+/* long flat expressions: best of 5 parses, then the remaining passes and both engines */
+static void bench_expr(int argc, char* argv[]) {
+	int terms = (argc > 0) ? atoi(argv[0]) : 100000;
+	int n;
+
+	for (n=terms/100; n<=terms; n*=10) {
+		Buffer b = { NULL, 0, 0 };
+		Interner names;
+		Prog* prog = NULL;
+		double parsed = 1e9;
+		double compiled;
+		int result, jit_result;
+		int i;
+
+		gen_long_sum(&b, n);
+		if (!init_interner(&names))
+			return;
+		for (i=0; i<5; i++) {
+			double t = now();
+			if (prog)
+				free_prog(prog);
+			if (parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+				return;
+			t = now() - t;
+			if (t < parsed)
+				parsed = t;
+		}
+		compiled = now();
+		if (!resolve_binds(prog) || !type_check(prog) || !compile(prog))
+			return;
+		compiled = now() - compiled;
+		if (!eval_interp_prog(&prog->interp, &result) || !eval_jit(&prog->interp, &jit_result))
+			return;
+		printf("expr/%d terms: %u nodes, parse %.2f ms, binds+types+compile %.2f ms, eval %d, jit %d\n",
+			n, prog->procs[0].expr_count, parsed * 1e3, compiled * 1e3, result, jit_result);
+		fflush(stdout);
+		free_prog(prog);
+		destroy_interner(&names);
+		free_buffer(&b);
+	}
+}
+
+/* a large library behind a main that reaches one procedure: eager against lazy parsing */
+static void bench_lazy(int argc, char* argv[]) {
+	static const char* MODES[] = { "eager", "lazy" };
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 2000;
+	Interner names;
+	TokenStream tokens;
+	int lazy;
+
+	gen_program(&b, procs);
+	if (!init_interner(&names) || !tokenize(&tokens, b.data, b.size, 1, &names))
+		return;
+
+	for (lazy=0; lazy<2; lazy++) {
+		double parsed = 1e9;
+		double startup = 1e9;
+		int result = 0;
+		int i;
+
+		for (i=0; i<5; i++) {
+			double t[3];
+			Prog* prog;
+			ParseStatus status;
+
+			t[0] = now();
+			status = lazy ? parse_tokens_lazy(&tokens, &names, &prog)
+				: parse_tokens(&tokens, &names, 1, &prog);
+			if (status != PARSE_OK)
+				return;
+			t[1] = now();
+			if (!resolve_binds(prog) || !type_check(prog) || !compile(prog))
+				return;
+			t[2] = now();
+			if (!eval_interp_prog(&prog->interp, &result))
+				return;
+			if (t[1] - t[0] < parsed)
+				parsed = t[1] - t[0];
+			if (t[2] - t[0] < startup)
+				startup = t[2] - t[0];
+			free_prog(prog);
+		}
+		printf("lazy/%s: %d procedures, parse %.2f ms, parse to compiled %.2f ms, eval %d\n",
+			MODES[lazy], procs + 1, parsed * 1e3, startup * 1e3, result);
+	}
+
+	destroy_tokens(&tokens);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+/* resolve_binds at doubling program sizes, to show how it scales */
+static void bench_scopes(int argc, char* argv[]) {
+	int procs = (argc > 0) ? atoi(argv[0]) : 50000;
+	int n;
+
+	for (n=procs/4; n<=procs; n*=2) {
+		Buffer b = { NULL, 0, 0 };
+		Interner names;
+		TokenStream tokens;
+		Prog* prog;
+		double elapsed;
+
+		gen_program(&b, n);
+		if (!init_interner(&names) || !tokenize(&tokens, b.data, b.size, 1, &names))
+			return;
+		if (parse_tokens(&tokens, &names, 1, &prog) != PARSE_OK)
+			return;
+		elapsed = now();
+		if (!resolve_binds(prog))
+			return;
+		elapsed = now() - elapsed;
+		printf("scopes/%d procedures: binds %.1f ms, %.0f ns per procedure\n",
+			n + 1, elapsed * 1e3, elapsed * 1e9 / (n + 1));
+		fflush(stdout);
+		free_prog(prog);
+		destroy_tokens(&tokens);
+		destroy_interner(&names);
+		free_buffer(&b);
+	}
+}
+
+static char* dump_prog(Prog* prog, size_t* size) {
+	char* text = NULL;
+	FILE* fp = open_memstream(&text, size);
+	if (!fp)
+		return NULL;
+	dump_interp_prog(&prog->interp, fp);
+	fclose(fp);
+	return text;
+}
+
+/* best of rounds for the three passes and for the fused one, whose code must match */
+static void time_fused(const char* input, Buffer* b, int rounds) {
+	Interner names;
+	TokenStream tokens;
+	double passes = 1e9;
+	double fused = 1e9;
+	int same = 1;
+	int i;
+
+	if (!init_interner(&names) || !tokenize(&tokens, b->data, b->size, 1, &names))
+		return;
+	for (i=0; same && (i<rounds); i++) {
+		Prog* a;
+		Prog* c;
+		char* dump_a;
+		char* dump_c;
+		size_t size_a, size_c;
+		double t[3];
+
+		if ((parse_tokens(&tokens, &names, 1, &a) != PARSE_OK)
+			|| (parse_tokens(&tokens, &names, 1, &c) != PARSE_OK))
+			return;
+		t[0] = now();
+		same = resolve_binds(a) && type_check(a) && compile(a);
+		t[1] = now();
+		same = same && compile_fused(c);
+		t[2] = now();
+		if (t[1] - t[0] < passes)
+			passes = t[1] - t[0];
+		if (t[2] - t[1] < fused)
+			fused = t[2] - t[1];
+
+		dump_a = dump_prog(a, &size_a);
+		dump_c = dump_prog(c, &size_c);
+		same = same && dump_a && dump_c && (size_a == size_c)
+			&& (memcmp(dump_a, dump_c, size_a) == 0);
+		free(dump_a);
+		free(dump_c);
+		free_prog(a);
+		free_prog(c);
+	}
+	printf("fused/%s: binds+types+compile %.2f ms, fused %.2f ms, %s\n", input,
+		passes * 1e3, fused * 1e3, same ? "same code" : "DIFFERENT CODE");
+	destroy_tokens(&tokens);
+	destroy_interner(&names);
+}
+
+static void bench_fused(int argc, char* argv[]) {
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 20000;
+
+	gen_program(&b, procs);
+	time_fused("keyword", &b, 5);
+	free_buffer(&b);
+
+	gen_expr_heavy(&b, procs / 20, 40);
+	time_fused("expr", &b, 5);
+	free_buffer(&b);
+
+	gen_long_sum(&b, procs * 10);
+	time_fused("sum", &b, 5);
+	free_buffer(&b);
+}
+
+/* compile_parallel at 1..16 threads, checked against the serial code */
+static void bench_threads(int argc, char* argv[]) {
+	Buffer b = { NULL, 0, 0 };
+	int procs = (argc > 0) ? atoi(argv[0]) : 20000;
+	Interner names;
+	TokenStream tokens;
+	char* serial = NULL;
+	size_t serial_size = 0;
+	int threads;
+
+	gen_expr_heavy(&b, procs, 4);
+	if (!init_interner(&names) || !tokenize(&tokens, b.data, b.size, 1, &names))
+		return;
+
+	for (threads=1; threads<=16; threads*=2) {
+		double best = 1e9;
+		int same = 1;
+		int i;
+
+		for (i=0; i<3; i++) {
+			Prog* prog;
+			char* dump;
+			size_t size;
+			double t;
+
+			if (parse_tokens(&tokens, &names, 1, &prog) != PARSE_OK)
+				return;
+			t = now();
+			if (!compile_parallel(prog, threads))
+				return;
+			t = now() - t;
+			if (t < best)
+				best = t;
+			dump = dump_prog(prog, &size);
+			if (!serial) {
+				serial = dump;
+				serial_size = size;
+			} else {
+				same = same && dump && (size == serial_size) && (memcmp(dump, serial, size) == 0);
+				free(dump);
+			}
+			free_prog(prog);
+		}
+		printf("threads/%d: %d procedures, %.2f ms, %s\n", threads, procs + 1, best * 1e3,
+			same ? "same as serial" : "DIFFERENT FROM SERIAL");
+	}
+
+	free(serial);
+	destroy_tokens(&tokens);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+/* distinct signatures built by type_check and its time, best of 5 */
+static void bench_types(int argc, char* argv[]) {
+	int procs = (argc > 0) ? atoi(argv[0]) : 20000;
+	int arities;
+
+	for (arities=1; arities<=16; arities*=4) {
+		Buffer b = { NULL, 0, 0 };
+		Interner names;
+		TokenStream tokens;
+		double best = 1e9;
+		unsigned count = 0;
+		int i;
+
+		gen_signatures(&b, procs, arities);
+		if (!init_interner(&names) || !tokenize(&tokens, b.data, b.size, 1, &names))
+			return;
+		for (i=0; i<5; i++) {
+			Prog* prog;
+			double t;
+
+			if ((parse_tokens(&tokens, &names, 1, &prog) != PARSE_OK) || !resolve_binds(prog))
+				return;
+			t = now();
+			if (!type_check(prog))
+				return;
+			t = now() - t;
+			if (t < best)
+				best = t;
+			count = prog->types.count;
+			free_prog(prog);
+		}
+		printf("types/%d arities: %d procedures, %u procedure types, type_check %.2f ms\n",
+			arities, procs + 1, count, best * 1e3);
+		destroy_tokens(&tokens);
+		destroy_interner(&names);
+		free_buffer(&b);
+	}
+}
+
+/* a param folded out of x * 1 is no assignment target, checked after folding in fused mode */
+static const char FOLDED_TARGET[] =
+	"procedure f(x : integer) : integer;\n"
+	"begin\n"
+	"  (x * 1) := 5;\n"
+	"  return x;\n"
+	"end f;\n"
+	"procedure main() : integer;\n"
+	"begin\n"
+	"  return f(1);\n"
+	"end main;\n";
+
+/* whether the pipeline of main's -s, -l, -f or none of them compiles source */
+static int compiles(const char* source, int mode, Interner* names) {
+	size_t size = strlen(source);
+	TokenStream tokens;
+	Prog* prog;
+	int ok;
+
+	if (mode == 's') {
+		ok = compile_stream_buffer(source, size, names, &prog) == STREAM_OK;
+		if (ok)
+			free_prog(prog);
+		return ok;
+	}
+	if (!tokenize(&tokens, source, size, 1, names))
+		return 0;
+	ok = ((mode == 'l') ? parse_tokens_lazy(&tokens, names, &prog)
+		: parse_tokens(&tokens, names, 1, &prog)) == PARSE_OK;
+	if (ok) {
+		if (mode == 'f')
+			ok = compile_parallel(prog, 2);
+		else
+			ok = resolve_binds(prog) && type_check(prog) && compile(prog);
+		free_prog(prog);
+	}
+	destroy_tokens(&tokens);
+	return ok;
+}
+
+/*
+ * Static instruction count of the loop and evaluation time of both
+ * engines, then a folded assignment target through every pipeline.
+ */
+static void bench_fold(int argc, char* argv[]) {
+	int iterations = (argc > 0) ? atoi(argv[0]) : 1000000;
+	Buffer b = { NULL, 0, 0 };
+	Interner names;
+	Prog* prog;
+	double interp = 1e9, jit = 1e9;
+	int result, jit_result;
+	int i;
+
+	gen_constant_loop(&b, iterations);
+	if (!init_interner(&names))
+		return;
+	if ((parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+		|| !resolve_binds(prog) || !type_check(prog) || !compile(prog))
+		return;
+	for (i=0; i<5; i++) {
+		double t = now();
+		if (!eval_interp_prog(&prog->interp, &result))
+			return;
+		t = now() - t;
+		if (t < interp)
+			interp = t;
+		t = now();
+		if (!eval_jit(&prog->interp, &jit_result))
+			return;
+		t = now() - t;
+		if (t < jit)
+			jit = t;
+	}
+	printf("fold/%d iterations: %d instructions, interp %.2f ms (%d), jit %.2f ms (%d)\n",
+		iterations, prog->interp.procs[prog->interp.main].size, interp * 1e3, result,
+		jit * 1e3, jit_result);
+	printf("fold/x * 1 := 5: passes %s, -s %s, -l %s, -f %s\n",
+		compiles(FOLDED_TARGET, 0, &names) ? "ACCEPTED" : "rejected",
+		compiles(FOLDED_TARGET, 's', &names) ? "ACCEPTED" : "rejected",
+		compiles(FOLDED_TARGET, 'l', &names) ? "ACCEPTED" : "rejected",
+		compiles(FOLDED_TARGET, 'f', &names) ? "ACCEPTED" : "rejected");
+	free_prog(prog);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+/* instructions of the loop procedure and dispatches per iteration, from its JMP back to the head */
+static void bench_peephole(int argc, char* argv[]) {
+	int iterations = (argc > 0) ? atoi(argv[0]) : 1000000;
+	Buffer b = { NULL, 0, 0 };
+	Interner names;
+	Prog* prog;
+	InterpCode* code;
+	double interp = 1e9, jit = 1e9;
+	int result, jit_result, dispatches = 0;
+	int i;
+
+	gen_counting_loop(&b, iterations);
+	if (!init_interner(&names))
+		return;
+	if ((parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+		|| !resolve_binds(prog) || !type_check(prog) || !compile(prog))
+		return;
+	code = &prog->interp.procs[0];
+	for (i=0; i<code->size; i++)
+		if (code->data[i].op == INTERP_JMP)
+			dispatches = i - code->data[i].value + 1;
+	for (i=0; i<5; i++) {
+		double t = now();
+		if (!eval_interp_prog(&prog->interp, &result))
+			return;
+		t = now() - t;
+		if (t < interp)
+			interp = t;
+		t = now();
+		if (!eval_jit(&prog->interp, &jit_result))
+			return;
+		t = now() - t;
+		if (t < jit)
+			jit = t;
+	}
+	printf("peephole/%d iterations: %d instructions, %d dispatches per iteration, "
+		"interp %.2f ms (%d), jit %.2f ms (%d)\n", iterations, code->size, dispatches,
+		interp * 1e3, result, jit * 1e3, jit_result);
+	free_prog(prog);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+/* best of rounds of the interpreter, with the dispatches of one profiled run */
+static double time_interp(Prog* prog, long* dispatches, int* result) {
+	InterpProfile* profile = (InterpProfile*) calloc(1, sizeof(InterpProfile));
+	double best = 1e9;
+	int i;
+
+	if (!profile || !eval_interp_profile(&prog->interp, result, profile))
+		return -1;
+	*dispatches = profile->dispatches;
+	free(profile);
+	for (i=0; i<5; i++) {
+		double t = now();
+		if (!eval_interp_prog(&prog->interp, result))
+			return -1;
+		t = now() - t;
+		if (t < best)
+			best = t;
+	}
+	return best;
+}
+
+/*
+ * Superinstructions keep the slots of their sequences, so mapping every
+ * op back to its base op gives the code the peephole pass alone emits.
+ */
+static void bench_super(int argc, char* argv[]) {
+	static const char* PROGRAMS[] = { "counting", "constant", "nested" };
+	int iterations = (argc > 0) ? atoi(argv[0]) : 1000000;
+	int p;
+
+	for (p=0; p<3; p++) {
+		Buffer b = { NULL, 0, 0 };
+		Interner names;
+		Prog* prog;
+		long plain_dispatches, super_dispatches;
+		double plain, super;
+		int result, k, i;
+		long loop_iterations = iterations;
+
+		if (p == 0)
+			gen_counting_loop(&b, iterations);
+		else if (p == 1)
+			gen_constant_loop(&b, iterations);
+		else {
+			int upper = 1;
+			while ((long) upper * (upper + 1) / 2 < iterations)
+				upper++;
+			gen_nested_loops(&b, upper);
+			loop_iterations = (long) upper * (upper + 1) / 2;
+		}
+		if (!init_interner(&names))
+			return;
+		if ((parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+			|| !resolve_binds(prog) || !type_check(prog) || !compile(prog))
+			return;
+
+		super = time_interp(prog, &super_dispatches, &result);
+		for (k=0; k<prog->interp.proc_count; k++) {
+			InterpCode* code = &prog->interp.procs[k];
+			for (i=0; i<code->size; i++)
+				code->data[i].op = base_op(code->data[i].op);
+		}
+		plain = time_interp(prog, &plain_dispatches, &result);
+
+		printf("super/%s: %ld iterations, dispatches per iteration %.2f -> %.2f, "
+			"interp %.2f ms -> %.2f ms (%d)\n", PROGRAMS[p], loop_iterations,
+			(double) plain_dispatches / loop_iterations, (double) super_dispatches / loop_iterations,
+			plain * 1e3, super * 1e3, result);
+		free_prog(prog);
+		destroy_interner(&names);
+		free_buffer(&b);
+	}
+}
+
+/* static instructions of all procedures and best of 5 runs of both engines */
+static void bench_regvm(int argc, char* argv[]) {
+	static const char* PROGRAMS[] = { "counting", "constant", "nested", "calls" };
+	int iterations = (argc > 0) ? atoi(argv[0]) : 1000000;
+	int p;
+
+	for (p=0; p<4; p++) {
+		Buffer b = { NULL, 0, 0 };
+		Interner names;
+		Prog* prog;
+		RegProg reg;
+		double stack = 1e9, regs = 1e9;
+		int stack_size = 0, reg_size = 0;
+		int result, reg_result, k;
+
+		if (p == 0)
+			gen_counting_loop(&b, iterations);
+		else if (p == 1)
+			gen_constant_loop(&b, iterations);
+		else if (p == 2) {
+			int upper = 1;
+			while ((long) upper * (upper + 1) / 2 < iterations)
+				upper++;
+			gen_nested_loops(&b, upper);
+		} else
+			gen_call_loop(&b, iterations);
+		if (!init_interner(&names))
+			return;
+		if ((parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+			|| !resolve_binds(prog) || !type_check(prog) || !compile(prog)
+			|| !init_reg_prog(&reg, &prog->interp))
+			return;
+		for (k=0; k<prog->interp.proc_count; k++) {
+			stack_size += prog->interp.procs[k].size;
+			reg_size += reg.procs[k].size;
+		}
+		for (k=0; k<5; k++) {
+			double t = now();
+			if (!eval_interp_prog(&prog->interp, &result))
+				return;
+			t = now() - t;
+			if (t < stack)
+				stack = t;
+			t = now();
+			if (!eval_reg_prog(&reg, &reg_result))
+				return;
+			t = now() - t;
+			if (t < regs)
+				regs = t;
+		}
+		printf("regvm/%s: instructions %d -> %d, interp %.2f ms (%d) -> %.2f ms (%d)\n",
+			PROGRAMS[p], stack_size, reg_size, stack * 1e3, result, regs * 1e3, reg_result);
+		destroy_reg_prog(&reg);
+		free_prog(prog);
+		destroy_interner(&names);
+		free_buffer(&b);
+	}
+}
+
+/* the loops of the programs bench_ssa runs, as gcc -O1 compiles them */
+__attribute__((noinline, optimize("O1"))) static int c_counting(int n) {
+	unsigned total = 0;
+	int i;
+	for (i=1; i<=n; i++)
+		total = total + i * 3 + 1;
+	return total;
+}
+
+__attribute__((noinline, optimize("O1"))) static int c_factorial(int n) {
+	unsigned res = 1;
+	int i;
+	for (i=1; i<=n; i++)
+		res = res * i;
+	return res;
+}
+
+__attribute__((noinline, optimize("O1"))) static int c_nested(int lower, int upper) {
+	unsigned accumulator = 0;
+	int outer, inner;
+	for (outer=lower; outer<=upper; outer++)
+		for (inner=outer; inner<=upper; inner++)
+			accumulator = accumulator + outer * inner + 1024;
+	return accumulator;
+}
+
+/* the SSA tier on the lazy path, where procedures main does not reach stay uncompiled */
+static int eval_ssa_lazy(Buffer* b, int* result) {
+	Interner names;
+	TokenStream tokens;
+	Prog* prog;
+	SsaProg ssa;
+	int ok;
+
+	if (!init_interner(&names))
+		return 0;
+	ok = tokenize(&tokens, b->data, b->size, 1, &names);
+	if (ok) {
+		ok = parse_tokens_lazy(&tokens, &names, &prog) == PARSE_OK;
+		if (ok) {
+			ok = resolve_binds(prog) && type_check(prog) && compile(prog)
+				&& init_ssa_prog(&ssa, &prog->interp);
+			if (ok) {
+				ok = eval_jit_ssa(&ssa, result);
+				destroy_ssa_prog(&ssa);
+			}
+			free_prog(prog);
+		}
+		destroy_tokens(&tokens);
+	}
+	destroy_interner(&names);
+	return ok;
+}
+
+/*
+ * Best of 5 runs of the template JIT, the SSA tier and gcc -O1, with
+ * the result of the SSA tier on the lazy path to check against.
+ */
+static void bench_ssa(int argc, char* argv[]) {
+	static const char* PROGRAMS[] = { "counting", "factorial", "nested" };
+	volatile int iterations = (argc > 0) ? atoi(argv[0]) : 20000000;
+	int p;
+
+	for (p=0; p<3; p++) {
+		Buffer b = { NULL, 0, 0 };
+		Interner names;
+		Prog* prog;
+		SsaProg ssa;
+		double jit = 1e9, opt = 1e9, gcc = 1e9;
+		int jit_result, opt_result, gcc_result, lazy_result;
+		int upper = 1;
+		int k;
+
+		if (p == 0)
+			gen_counting_loop(&b, iterations);
+		else if (p == 1)
+			gen_factorial_loop(&b, iterations);
+		else {
+			while ((long) upper * (upper + 1) / 2 < iterations)
+				upper++;
+			gen_nested_loops(&b, upper);
+		}
+		append(&b, "\nprocedure unused(x : integer) : integer;\nbegin\n  return x;\nend unused;\n");
+		if (!init_interner(&names))
+			return;
+		if ((parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+			|| !resolve_binds(prog) || !type_check(prog) || !compile(prog)
+			|| !init_ssa_prog(&ssa, &prog->interp))
+			return;
+		for (k=0; k<5; k++) {
+			double t = now();
+			if (!eval_jit(&prog->interp, &jit_result))
+				return;
+			t = now() - t;
+			if (t < jit)
+				jit = t;
+			t = now();
+			if (!eval_jit_ssa(&ssa, &opt_result))
+				return;
+			t = now() - t;
+			if (t < opt)
+				opt = t;
+			t = now();
+			if (p == 0)
+				gcc_result = c_counting(iterations);
+			else if (p == 1)
+				gcc_result = c_factorial(iterations);
+			else
+				gcc_result = c_nested(1, upper);
+			t = now() - t;
+			if (t < gcc)
+				gcc = t;
+		}
+		if (!eval_ssa_lazy(&b, &lazy_result))
+			return;
+		printf("ssa/%s: jit %.2f ms (%d), ssa %.2f ms (%d), gcc -O1 %.2f ms (%d), lazy ssa (%d)\n",
+			PROGRAMS[p], jit * 1e3, jit_result, opt * 1e3, opt_result, gcc * 1e3, gcc_result,
+			lazy_result);
+		destroy_ssa_prog(&ssa);
+		free_prog(prog);
+		destroy_interner(&names);
+		free_buffer(&b);
+	}
+}
+
+/* dispatches per iteration and best of 5 for the engines, on the loop gen writes */
+static void bench_loop(const char* label, void (*gen)(Buffer*, int), int iterations) {
+	Buffer b = { NULL, 0, 0 };
+	Interner names;
+	Prog* prog;
+	SsaProg ssa;
+	long dispatches;
+	double interp, jit = 1e9, opt = 1e9;
+	int result, jit_result, opt_result;
+	int k;
+
+	gen(&b, iterations);
+	if (!init_interner(&names))
+		return;
+	if ((parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+		|| !resolve_binds(prog) || !type_check(prog) || !compile(prog)
+		|| !init_ssa_prog(&ssa, &prog->interp))
+		return;
+	interp = time_interp(prog, &dispatches, &result);
+	for (k=0; k<5; k++) {
+		double t = now();
+		if (!eval_jit(&prog->interp, &jit_result))
+			return;
+		t = now() - t;
+		if (t < jit)
+			jit = t;
+		t = now();
+		if (!eval_jit_ssa(&ssa, &opt_result))
+			return;
+		t = now() - t;
+		if (t < opt)
+			opt = t;
+	}
+	printf("%s/%d iterations: dispatches per iteration %.2f, interp %.2f ms (%d), "
+		"jit %.2f ms (%d), ssa %.2f ms (%d)\n", label, iterations, (double) dispatches / iterations,
+		interp * 1e3, result, jit * 1e3, jit_result, opt * 1e3, opt_result);
+	destroy_ssa_prog(&ssa);
+	free_prog(prog);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+static void bench_licm(int argc, char* argv[]) {
+	bench_loop("licm", gen_invariant_loop, (argc > 0) ? atoi(argv[0]) : 10000000);
+}
+
+static void bench_strength(int argc, char* argv[]) {
+	bench_loop("strength", gen_arith_loop, (argc > 0) ? atoi(argv[0]) : 10000000);
+}
+
+static void bench_inline(int argc, char* argv[]) {
+	bench_loop("inline", gen_nested_calls, (argc > 0) ? atoi(argv[0]) : 10000000);
+}
+
+/*
+ * The tail calls of gen_tail_calls as they are, then mapped back to a
+ * call and a return like bench_super does, for the interpreter and the
+ * template JIT; the SSA tier always jumps.
+ */
+static void bench_tail(int argc, char* argv[]) {
+	int iterations = (argc > 0) ? atoi(argv[0]) : 2000000;
+	Buffer b = { NULL, 0, 0 };
+	Interner names;
+	Prog* prog;
+	SsaProg ssa;
+	long dispatches;
+	double interp[2], jit[2] = { 1e9, 1e9 }, opt = 1e9;
+	int result, jit_result, opt_result;
+	int p, i, k;
+
+	gen_tail_calls(&b, iterations, 300);
+	if (!init_interner(&names))
+		return;
+	if ((parse_buffer(b.data, b.size, &names, &prog) != PARSE_OK)
+		|| !resolve_binds(prog) || !type_check(prog) || !compile(prog)
+		|| !init_ssa_prog(&ssa, &prog->interp))
+		return;
+	for (k=0; k<5; k++) {
+		double t = now();
+		if (!eval_jit_ssa(&ssa, &opt_result))
+			return;
+		t = now() - t;
+		if (t < opt)
+			opt = t;
+	}
+	for (i=0; i<2; i++) {
+		interp[i] = time_interp(prog, &dispatches, &result);
+		for (k=0; k<5; k++) {
+			double t = now();
+			if (!eval_jit(&prog->interp, &jit_result))
+				return;
+			t = now() - t;
+			if (t < jit[i])
+				jit[i] = t;
+		}
+		for (p=0; p<prog->interp.proc_count; p++) {
+			InterpCode* code = &prog->interp.procs[p];
+			for (k=0; k<code->size; k++)
+				if ((code->data[k].op == INTERP_TAILCALL) || (code->data[k].op == INTERP_TAILCALLV))
+					code->data[k].op = base_op(code->data[k].op);
+		}
+	}
+	printf("tail/%d levels: interp %.2f ms -> %.2f ms (%d), jit %.2f ms -> %.2f ms (%d), "
+		"ssa %.2f ms (%d)\n", iterations, interp[1] * 1e3, interp[0] * 1e3, result,
+		jit[1] * 1e3, jit[0] * 1e3, jit_result, opt * 1e3, opt_result);
+	destroy_ssa_prog(&ssa);
+	free_prog(prog);
+	destroy_interner(&names);
+	free_buffer(&b);
+}
+
+typedef struct Bench {
+	const char*  name;
+	void         (*run)(int argc, char* argv[]);
+} Bench;
+
+static const Bench BENCHES[] = {
+	{ "lex", bench_lex },
+	{ "tokens", bench_tokens },
+	{ "parse", bench_parse },
+	{ "alloc", bench_alloc },
+	{ "passes", bench_passes },
+	{ "stream", bench_stream },
+	{ "expr", bench_expr },
+	{ "lazy", bench_lazy },
+	{ "scopes", bench_scopes },
+	{ "fused", bench_fused },
+	{ "threads", bench_threads },
+	{ "types", bench_types },
+	{ "fold", bench_fold },
+	{ "peephole", bench_peephole },
+	{ "super", bench_super },
+	{ "regvm", bench_regvm },
+	{ "ssa", bench_ssa },
+	{ "licm", bench_licm },
+	{ "strength", bench_strength },
+	{ "inline", bench_inline },
+	{ "tail", bench_tail },
+};
+
+#define BENCH_COUNT   (sizeof(BENCHES) / sizeof(BENCHES[0]))
+
+int main(int argc, char* argv[]) {
+	size_t i;
+	for (i=0; i<BENCH_COUNT; i++)
+		if ((argc < 2) || (strcmp(argv[1], BENCHES[i].name) == 0))
+			BENCHES[i].run((argc > 2) ? argc - 2 : 0, &argv[2]);
+	return EXIT_SUCCESS;
+}
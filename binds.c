@@ -1,11 +1,10 @@
 #include "parser.h"
 
-#include <assert.h>
-
 static inline int do_fparam_binds(Proc* proc) {
-	FParam* fparam = proc->first_fparam;
 	Context* ctx = &proc->ctx;
-	while (fparam) {
+	int i;
+	for (i=0; i<proc->fparam_count; i++) {
+		FParam* fparam = &proc->fparams[i];
 		if (local_lookup(ctx, fparam->id))
 			return 0;
 		if (!bind_fparam(ctx, fparam->id, fparam))
@@ -14,16 +13,15 @@ static inline int do_fparam_binds(Proc* proc) {
 		fparam->type_bind = lookup(ctx, fparam->type);
 		if (!fparam->type_bind)
 			return 0;
-
-		fparam = fparam->next;
 	}
 	return 1;
 }
 
-static inline int do_var_binds(Proc* proc) {
-	Var* var = proc->first_var;
+int resolve_proc_vars(Proc* proc) {
 	Context* ctx = &proc->ctx;
-	while (var) {
+	int i;
+	for (i=0; i<proc->var_count; i++) {
+		Var* var = &proc->vars[i];
 		if (local_lookup(ctx, var->id))
 			return 0;
 		if (!bind_var(ctx, var->id, var))
@@ -32,103 +30,50 @@ static inline int do_var_binds(Proc* proc) {
 		var->type_bind = lookup(ctx, var->type);
 		if (!var->type_bind)
 			return 0;
-
-		var = var->next;
 	}
 	return 1;
 }
 
-static int resolve_expr(Context* ctx, Expr* expr);
-
-static inline int resolve_bin_expr(Context* ctx, BinaryExpr* bin) {
-	return resolve_expr(ctx, bin->left)
-		&& resolve_expr(ctx, bin->right);
-}
-
-static inline int resolve_id_expr(Context* ctx, IdExpr* id) {
-	id->bind = lookup(ctx, id->name);
-	if (!id->bind)
-		return 0;
-	return 1;
-}
-
-static inline int resolve_call_expr(Context* ctx, CallExpr* call) {
-	int ok = resolve_expr(ctx, call->lvalue);
-	if (ok) {
-		Param *param = call->first_param;
-		while (ok && param) {
-			ok = resolve_expr(ctx, param->value);
-			if (ok)
-				param = param->next;
-		}
+int resolve_expr(Proc* proc, Expr* expr) {
+	if (expr->type == EXPR_ID) {
+		IdExpr* id = &expr->content.as_id;
+		id->bind = lookup(&proc->ctx, id->name);
+		return id->bind ? 1 : 0;
 	}
-	return ok;
+	return 1;
 }
 
-int resolve_expr(Context* ctx, Expr* expr) {
-	switch (expr->type) {
-	case EXPR_BINARY:
-		return resolve_bin_expr(ctx, expr->content.as_binary);
-	case EXPR_ID:
-		return resolve_id_expr(ctx, expr->content.as_id);
-	case EXPR_NUM:
-		return 1;
-	case EXPR_CALL:
-		return resolve_call_expr(ctx, expr->content.as_call);
+int resolve_stmt(Proc* proc, Stmt* stmt) {
+	if (stmt->type == STMT_FOR) {
+		ForStmt* forstmt = &stmt->content.as_for;
+		forstmt->bind = lookup(&proc->ctx, forstmt->id);
+		return forstmt->bind ? 1 : 0;
 	}
-	assert(0);
-}
-
-static int resolve_stmts(Context* ctx, Stmt* stmt);
-
-static inline int resolve_assign(Context* ctx, AssignStmt* assign) {
-	return resolve_expr(ctx, assign->lvalue)
-		&& resolve_expr(ctx, assign->rvalue);
-}
-
-static inline int resolve_for(Context* ctx, ForStmt* forstmt) {
-	forstmt->bind = lookup(ctx, forstmt->id);
-	if (!forstmt->bind)
-		return 0;
-	return resolve_expr(ctx, forstmt->from)
-		&& resolve_expr(ctx, forstmt->to)
-		&& resolve_stmts(ctx, forstmt->first_stmt);
-}
-
-static inline int resolve_return(Context* ctx, ReturnStmt* ret) {
-	if (ret->expr)
-		return resolve_expr(ctx, ret->expr);
 	return 1;
 }
 
-static inline int resolve_call(Context* ctx, CallStmt* call) {
-	return resolve_expr(ctx, call->expr);
-}
-
-int resolve_stmts(Context* ctx, Stmt* stmt) {
-	int ok = 1;
-	while (ok && stmt) {
-		switch (stmt->type) {
-		case STMT_ASSIGN:
-			ok = resolve_assign(ctx, stmt->content.as_assign);
-			break;
-		case STMT_FOR:
-			ok = resolve_for(ctx, stmt->content.as_for);
-			break;
-		case STMT_RETURN:
-			ok = resolve_return(ctx, stmt->content.as_return);
-			break;
-		case STMT_CALL:
-			ok = resolve_call(ctx, stmt->content.as_call);
-			break;
-		default:
-			ok = 0;
-			assert(0);
+/*
+ * Only identifiers and loop variables carry names, so a scan of the
+ * expression array and then of the statement array does. Positions past
+ * expr_count are statements.
+ */
+int resolve_proc_body(Proc* proc, unsigned* position, Symbol* missing) {
+	unsigned i;
+
+	for (i=*position; i<proc->expr_count; i++)
+		if (!resolve_expr(proc, &proc->exprs[i])) {
+			*position = i;
+			*missing = proc->exprs[i].content.as_id.name;
+			return 0;
 		}
-		if (ok)
-			stmt = stmt->next;
-	}
-	return ok;
+	for (i=i-proc->expr_count; i<proc->stmt_count; i++)
+		if (!resolve_stmt(proc, &proc->stmts[i])) {
+			*position = proc->expr_count + i;
+			*missing = proc->stmts[i].content.as_for.id;
+			return 0;
+		}
+	*position = proc->expr_count + proc->stmt_count;
+	return 1;
 }
 
 static inline int do_return_bind(Proc* proc) {
@@ -139,35 +84,29 @@ static inline int do_return_bind(Proc* proc) {
 	return proc->return_type_bind ? 1 : 0;
 }
 
-static inline int resolve_proc_binds(Proc* proc) {
+int resolve_proc_header(Proc* proc) {
 	return do_return_bind(proc)
-		&& do_fparam_binds(proc) 
-		&& do_var_binds(proc)
-		&& resolve_stmts(&proc->ctx, proc->first_stmt);
+		&& do_fparam_binds(proc)
+		&& resolve_proc_vars(proc);
 }
 
-static inline int do_global_binds(Prog* prog) {
-	Proc* proc = prog->first_proc;
+int declare_proc(Prog* prog, Proc* proc) {
 	Context* ctx = &prog->ctx;
-	while (proc) {
-		char* id = proc->id;
-		if (local_lookup(ctx, id))
-			return 0;
-		if (!bind_proc(ctx, id, proc))
-			return 0;
-		proc = proc->next;
-	}
-	return 1;
+	if (local_lookup(ctx, proc->id))
+		return 0;
+	return bind_proc(ctx, proc->id, proc) ? 1 : 0;
 }
 
 int resolve_binds(Prog* prog) {
-	int ok = do_global_binds(prog);
-	if (ok) {
-		Proc* proc = prog->first_proc;
-		while (ok && proc) {
-			ok = resolve_proc_binds(proc);
-			proc = proc->next;
-		}
+	int ok = 1;
+	int i;
+	for (i=0; ok && (i<prog->proc_count); i++)
+		ok = declare_proc(prog, &prog->procs[i]);
+	for (i=0; ok && (i<prog->proc_count); i++) {
+		Proc* proc = &prog->procs[i];
+		unsigned position = 0;
+		Symbol missing;
+		ok = resolve_proc_header(proc) && resolve_proc_body(proc, &position, &missing);
 	}
 	return ok;
-}
\ No newline at end of file
+}
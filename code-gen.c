@@ -1,386 +1,497 @@
 #include "parser.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
-#include <string.h>
 
-typedef struct InstrNode InstrNode;
-
-struct InstrNode {
-	InterpInstr   instr;
-	InstrNode*    prev;
-};
+#define PROCS_PER_CLAIM   16
+#define INITIAL_CODE      64
 
+/* code grows in place and becomes the InterpCode of the procedure */
 typedef struct CompileCtx {
-	InstrNode*  last;
-	int         pc;
+	Proc*         proc;
+	Arena*        arena;
+	InterpInstr*  code;
+	int           pc;
+	int           capacity;
+	int           fused;
+	Constants     constants;
 } CompileCtx;
 
-static inline InstrNode* append_instr(CompileCtx* ctx) {
-	InstrNode* n = (InstrNode*) calloc(1, sizeof(InstrNode));
-	if (n) {
-		n->prev = ctx->last;
-		ctx->pc++;
-		ctx->last = n;
-	}
-	return n;
+static int grow_code(CompileCtx* ctx) {
+	int capacity = ctx->capacity ? 2 * ctx->capacity : INITIAL_CODE;
+	InterpInstr* code = (InterpInstr*) realloc(ctx->code, capacity * sizeof(InterpInstr));
+	if (!code)
+		return 0;
+	ctx->code = code;
+	ctx->capacity = capacity;
+	return 1;
 }
 
-static int compile_expr(CompileCtx* ctx, Expr* expr, int rvalue);
-
-static inline int compile_bin_expr(CompileCtx* ctx, BinaryExpr *bin) {
-	InstrNode* n;
-	if (!compile_expr(ctx, bin->left, 1) || !compile_expr(ctx, bin->right, 1))
+static inline int emit(CompileCtx* ctx, InterpOp op, int value) {
+	if ((ctx->pc == ctx->capacity) && !grow_code(ctx))
 		return 0;
-	n = append_instr(ctx);
-	if (!n)
-		return 0;
-	switch (bin->op) {
+	ctx->code[ctx->pc].op = op;
+	ctx->code[ctx->pc].value = value;
+	ctx->pc++;
+	return 1;
+}
+
+/* a label is the pc of a jump emitted before its target was known */
+static inline void patch_label(CompileCtx* ctx, int label, int target) {
+	ctx->code[label].value = target;
+}
+
+/* drops the last instructions, the code of operands a fold absorbed */
+static inline void drop_instrs(CompileCtx* ctx, int count) {
+	ctx->pc -= count;
+}
+
+static int compile_expr(CompileCtx* ctx, NodeIndex expr, int rvalue);
+
+/* in fused mode each node is type checked once its operands are emitted */
+static inline int check_expr(CompileCtx* ctx, Expr* expr) {
+	return !ctx->fused || type_check_expr(ctx->proc, expr);
+}
+
+static inline int compile_bin_op(CompileCtx* ctx, BinaryOp op) {
+	switch (op) {
 	case OP_ADD:
-		n->instr.op = INTERP_ADD;
-		break;
+		return emit(ctx, INTERP_ADD, 0);
 	case OP_MULT:
-		n->instr.op = INTERP_MUL;
-		break;
+		return emit(ctx, INTERP_MUL, 0);
 	default:
 		assert(0);
 	}
-	return 1;
+	return 0;
+}
+
+static inline int compile_num_expr(CompileCtx* ctx, NumExpr *num);
+
+/*
+ * Left associative chains such as long sums nest to the left, so the left
+ * spine is walked with a loop and only right operands recurse. A folded
+ * constant operand is always a single PUSH, so a fold replaces the tail
+ * of the code emitted so far.
+ */
+static inline int compile_bin_expr(CompileCtx* ctx, NodeIndex index) {
+	Expr* exprs = ctx->proc->exprs;
+	NodeIndex* spine;
+	NodeIndex n;
+	unsigned depth = 0;
+	int ok;
+
+	for (n=index; exprs[n].type == EXPR_BINARY; n=exprs[n].content.as_binary.left)
+		depth++;
+	spine = (NodeIndex*) arena_alloc(ctx->arena, depth * sizeof(NodeIndex));
+	if (!spine)
+		return 0;
+	depth = 0;
+	for (n=index; exprs[n].type == EXPR_BINARY; n=exprs[n].content.as_binary.left)
+		spine[depth++] = n;
+
+	ok = compile_expr(ctx, n, 1);
+	while (ok && (depth > 0)) {
+		Expr* expr = &exprs[spine[--depth]];
+		BinaryExpr* bin = &expr->content.as_binary;
+		ok = compile_expr(ctx, bin->right, 1) && check_expr(ctx, expr);
+		if (!ok)
+			break;
+		switch (fold_bin_expr(ctx->proc, expr)) {
+		case FOLD_NONE:
+			ok = compile_bin_op(ctx, bin->op);
+			break;
+		case FOLD_CONSTANT:
+			drop_instrs(ctx, 2);
+			ok = compile_num_expr(ctx, &expr->content.as_num);
+			break;
+		case FOLD_REASSOCIATED:
+			drop_instrs(ctx, 3);
+			ok = compile_num_expr(ctx, &exprs[bin->right].content.as_num)
+				&& compile_bin_op(ctx, bin->op);
+			break;
+		case FOLD_IDENTITY:
+			drop_instrs(ctx, 1);
+			break;
+		}
+	}
+	return ok;
 }
 
 static inline int compile_id_expr(CompileCtx* ctx, IdExpr *id, int rvalue) {
 	int ok = 0;
 	switch (id->bind->type) {
-	case BIND_FPARAM: {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = INTERP_PARAM;
-			n->instr.value = id->bind->content.as_fparam->nid;
-			ok = 1;
-		}
+	case BIND_FPARAM:
+		ok = emit(ctx, INTERP_PARAM, id->bind->content.as_fparam->nid);
 		break;
-	}
-	case BIND_VAR: {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = INTERP_VAR;
-			n->instr.value = id->bind->content.as_var->nid;
-			ok = 1;
-		}
+	case BIND_VAR:
+		ok = emit(ctx, INTERP_VAR, id->bind->content.as_var->nid);
 		break;
-	}
-	case BIND_PROC: {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = INTERP_PROC;
-			n->instr.value = id->bind->content.as_proc->nid;
-			ok = 1;
-		}
+	case BIND_PROC:
+		ok = emit(ctx, INTERP_PROC, id->bind->content.as_proc->nid);
 		break;
-	}
 	default:
 		assert(0);
 	}
-	if (ok && rvalue) {
-		InstrNode* n = append_instr(ctx);
-		if (n)
-			n->instr.op = INTERP_LOAD;
-	}
-	return ok;
+	return ok && (!rvalue || emit(ctx, INTERP_LOAD, 0));
 }
 
 static inline int compile_num_expr(CompileCtx* ctx, NumExpr *num) {
-	InstrNode* instr = append_instr(ctx);
-	if (!instr)
-		return 0;
-	instr->instr.op = INTERP_PUSH;
-	instr->instr.value = num->value;
-	return 1;
+	return emit(ctx, INTERP_PUSH, num->value);
 }
 
-static int compile_params(CompileCtx* ctx, Param* param) {
-	int ok;
-	if (!param)
-		return 1;
-	ok = param->next ? compile_params(ctx, param->next) : 1;
-	if (ok)
-		ok = compile_expr(ctx, param->value, 1);
+/* arguments are pushed last to first */
+static int compile_params(CompileCtx* ctx, NodeRange args) {
+	int ok = 1;
+	unsigned i = args.count;
+	while (ok && (i > 0)) {
+		i--;
+		ok = compile_expr(ctx, ctx->proc->args[args.first + i], 1);
+	}
 	return ok;
 }
 
-static inline int compile_call_expr(CompileCtx* ctx, CallExpr* call) {
-	Type* type = call->lvalue->actual_type.type;
+static inline int compile_call_expr(CompileCtx* ctx, Expr* expr) {
+	CallExpr* call = &expr->content.as_call;
+	Type* type;
 
-	assert(type->kind == TYPE_PROC);
+	if (!compile_params(ctx, call->args) || !compile_expr(ctx, call->lvalue, 0)
+		|| !check_expr(ctx, expr))
+		return 0;
 
-	int ok = compile_params(ctx, call->first_param);
-	if (ok) {
-		ok = compile_expr(ctx, call->lvalue, 0);
-		if (ok) {
-			InstrNode* n = append_instr(ctx);
-			if (n)
-				n->instr.op = type->content.as_proc->return_type 
-					? INTERP_CALL : INTERP_CALLV;
-			else
-				ok = 0;
-		}
-	}
-	return ok;
+	type = ctx->proc->exprs[call->lvalue].actual_type.type;
+	assert(type->kind == TYPE_PROC);
+	return emit(ctx, type->content.as_proc->return_type ? INTERP_CALL : INTERP_CALLV, 0);
 }
 
-int compile_expr(CompileCtx* ctx, Expr* expr, int rvalue) {
+int compile_expr(CompileCtx* ctx, NodeIndex index, int rvalue) {
+	Expr* expr = &ctx->proc->exprs[index];
 	switch (expr->type) {
 	case EXPR_BINARY:
-		return compile_bin_expr(ctx, expr->content.as_binary);
+		return compile_bin_expr(ctx, index);
 	case EXPR_ID:
-		return compile_id_expr(ctx, expr->content.as_id, rvalue);
+		if ((ctx->fused && !resolve_expr(ctx->proc, expr)) || !check_expr(ctx, expr))
+			return 0;
+		if (rvalue && fold_id_expr(&ctx->constants, expr))
+			return compile_num_expr(ctx, &expr->content.as_num);
+		return compile_id_expr(ctx, &expr->content.as_id, rvalue);
 	case EXPR_NUM:
-		return compile_num_expr(ctx, expr->content.as_num);
+		return check_expr(ctx, expr) && compile_num_expr(ctx, &expr->content.as_num);
 	case EXPR_CALL:
-		return compile_call_expr(ctx, expr->content.as_call);
+		return compile_call_expr(ctx, expr);
 	default:
 		assert(0);
 	}
 	return 0;
 }
 
-static int compile_stmt(CompileCtx* ctx, Stmt* stmt);
+static int compile_stmts(CompileCtx* ctx, NodeRange stmts);
 
 static inline 
 int compile_assign_stmt(CompileCtx* ctx, AssignStmt* assign) {
-	InstrNode *n;
-	if (!compile_expr(ctx, assign->rvalue, 1) || !compile_expr(ctx, assign->lvalue, 0))
-		return 0;
-	n = append_instr(ctx);
-	if (!n)
+	Expr* lvalue = &ctx->proc->exprs[assign->lvalue];
+	if (!compile_expr(ctx, assign->rvalue, 1) || !compile_expr(ctx, assign->lvalue, 0)
+		|| !emit(ctx, INTERP_STORE, 0))
 		return 0;
-	n->instr.op = INTERP_STORE;
+	if (lvalue->type == EXPR_ID)
+		assign_constant(&ctx->constants, lvalue->content.as_id.bind, &ctx->proc->exprs[assign->rvalue]);
 	return 1;
 }
 
-static inline  int compile_for_stmt(CompileCtx* ctx, ForStmt* forstmt) {
-	int pc_head;
-	InstrNode* njlt;
-	int ok = compile_expr(ctx, forstmt->from, 1);
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			assert(forstmt->bind->type == BIND_VAR);
-			n->instr.op = INTERP_VAR;
-			n->instr.value = forstmt->bind->content.as_var->nid;
-		} else
-			ok = 0;
-	}
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n)
-			n->instr.op = INTERP_STORE;
-		else
-			ok = 0;
-	}
-	if (ok)
-		ok = compile_expr(ctx, forstmt->to, 1);
-	if (ok) {
-		InstrNode* n;
-		pc_head = ctx->pc;
-		n = append_instr(ctx);
-		if (n)
-			n->instr.op = INTERP_DUP;
-		else
-			ok = 0;
-	}
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = INTERP_VAR;
-			n->instr.value = forstmt->bind->content.as_var->nid;
-		} else
-			ok = 0;
-	}
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n)
-			n->instr.op = INTERP_LOAD;
-		else
-			ok = 0;
-	}
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n)
-			n->instr.op = INTERP_CMP;
-		else
-			ok = 0;
-	}
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = INTERP_JLT;
-			njlt = n;
-		} else
-			ok = 0;
-	}
-	if (ok)
-		ok = compile_stmt(ctx, forstmt->first_stmt);
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = INTERP_VAR;
-			n->instr.value = forstmt->bind->content.as_var->nid;
-		} else
-			ok = 0;
-	}
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n)
-			n->instr.op = INTERP_INC;
-	}
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = INTERP_JMP;
-			n->instr.value = pc_head;
-		} else
-			ok = 0;
-	}
-	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			njlt->instr.value = ctx->pc - 1;
-			n->instr.op = INTERP_POP;
-			n->instr.value = ctx->pc;
-		} else
-			ok = 0;
-	}
+static inline int compile_for_stmt(CompileCtx* ctx, ForStmt* forstmt) {
+	int var, head, jlt;
+	int ok = (forstmt->bind->type == BIND_VAR) && compile_expr(ctx, forstmt->from, 1);
+	if (!ok)
+		return 0;
 
-	return ok;
-}
+	var = forstmt->bind->content.as_var->nid;
+	ok = emit(ctx, INTERP_VAR, var) && emit(ctx, INTERP_STORE, 0);
+	/* the body may run any number of times, what it assigns is unknown in and after it */
+	forget_constant(&ctx->constants, forstmt->bind);
+	ok = ok && compile_expr(ctx, forstmt->to, 1);
+	forget_assigned(&ctx->constants, ctx->proc, forstmt->body);
 
-static inline int compile_return_stmt(CompileCtx* ctx, ReturnStmt* ret) {
-	Proc* proc = ret->proc;
-	int ok = compile_expr(ctx, ret->expr, 1);
+	head = ctx->pc;
+	ok = ok && emit(ctx, INTERP_DUP, 0)
+		&& emit(ctx, INTERP_VAR, var)
+		&& emit(ctx, INTERP_LOAD, 0)
+		&& emit(ctx, INTERP_CMP, 0);
+	jlt = ctx->pc;
+	ok = ok && emit(ctx, INTERP_JLT, 0) && compile_stmts(ctx, forstmt->body);
+	forget_assigned(&ctx->constants, ctx->proc, forstmt->body);
+
+	ok = ok && emit(ctx, INTERP_VAR, var)
+		&& emit(ctx, INTERP_INC, 0)
+		&& emit(ctx, INTERP_JMP, head);
 	if (ok) {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = proc->is_function ? INTERP_RET : INTERP_RETV;
-			n->instr.value = proc->fparam_count; 
-		}
-		else
-			ok = 0;		
+		patch_label(ctx, jlt, ctx->pc);
+		ok = emit(ctx, INTERP_POP, ctx->pc + 1);
 	}
-
 	return ok;
+}
 
+static inline int compile_return_stmt(CompileCtx* ctx, ReturnStmt* ret) {
+	Proc* proc = ctx->proc;
+	int ok = (ret->expr != NO_NODE) ? compile_expr(ctx, ret->expr, 1) : 1;
+	return ok && emit(ctx, proc->is_function ? INTERP_RET : INTERP_RETV, proc->fparam_count);
 }
 
 static inline int compile_call_stmt(CompileCtx* ctx, CallStmt* call) {
-	Type* t = call->expr->actual_type.type;
-	assert(t->kind == TYPE_PROC);
-	int ok = compile_expr(ctx, call->expr, 1);
-	if (ok && t->content.as_proc->return_type) {
-		InstrNode* n = append_instr(ctx);
-		if (n)
-			n->instr.op = INTERP_POP;
-	}
-	return ok;
+	Expr* expr = &ctx->proc->exprs[call->expr];
+	int ok = (expr->type == EXPR_CALL) && compile_expr(ctx, call->expr, 1);
+	Type* t = ok ? ctx->proc->exprs[expr->content.as_call.lvalue].actual_type.type : NULL;
+	return ok && (!t->content.as_proc->return_type || emit(ctx, INTERP_POP, 0));
 }
 
-int compile_stmt(CompileCtx* ctx, Stmt* stmt) {
+int compile_stmts(CompileCtx* ctx, NodeRange stmts) {
 	int ok = 1;
-	while (ok && stmt) {
+	unsigned i;
+	for (i=0; ok && (i<stmts.count); i++) {
+		Stmt* stmt = &ctx->proc->stmts[stmts.first + i];
+		if (ctx->fused && !resolve_stmt(ctx->proc, stmt))
+			return 0;
 		switch (stmt->type) {
 		case STMT_ASSIGN:
-			ok = compile_assign_stmt(ctx, stmt->content.as_assign);
+			ok = compile_assign_stmt(ctx, &stmt->content.as_assign);
 			break;
 		case STMT_FOR:
-			ok = compile_for_stmt(ctx, stmt->content.as_for);
+			ok = compile_for_stmt(ctx, &stmt->content.as_for);
 			break;
 		case STMT_RETURN:
-			ok = compile_return_stmt(ctx, stmt->content.as_return);
+			ok = compile_return_stmt(ctx, &stmt->content.as_return);
 			break;
 		case STMT_CALL:
-			ok = compile_call_stmt(ctx, stmt->content.as_call);
+			ok = compile_call_stmt(ctx, &stmt->content.as_call);
 			break;
 		default:
 			assert(0);
 			ok = 0;
 		}
-		if (ok)
-			stmt = stmt->next;	
+		if (ok && ctx->fused)
+			ok = type_check_stmt(ctx->proc, stmt);
 	}
 	return ok;
 }
 
 static inline
-int compile_vars(CompileCtx* ctx, Var* var) {
+int compile_vars(CompileCtx* ctx, Proc* proc) {
 	int ok = 1;
-	while (ok && var) {
-		InstrNode* n = append_instr(ctx);
-		if (n) {
-			n->instr.op = INTERP_PUSH;
-			n->instr.value = 0;
-			var = var->next;
-		} else
-			ok = 0;
-	}
+	int i;
+	for (i=0; ok && (i<proc->var_count); i++)
+		ok = emit(ctx, INTERP_PUSH, 0);
 	return ok;
 }
 
 static inline
 int compile_proc(CompileCtx* ctx, Proc* proc) {
-	int ok = compile_vars(ctx, proc->first_var);
+	int ok = compile_vars(ctx, proc);
 	if (ok)
-		ok = compile_stmt(ctx, proc->first_stmt);
+		ok = compile_stmts(ctx, proc->body);
 	return ok;
 }
 
-static inline free_instrs(InstrNode* n) {
-	while (n) {
-		InstrNode *temp = n;
-		n = n->prev;
-		free(temp);
-	}
+/*
+ * scratch holds what only lives while compiling, the code buffer is
+ * handed over once the peephole passes have rewritten it.
+ */
+static int emit_proc_code(Proc* proc, Arena* scratch, int fused, InterpCode* code) {
+	CompileCtx ctx = {
+		.proc = proc,
+		.arena = scratch,
+		.code = NULL,
+		.pc = 0,
+		.capacity = 0,
+		.fused = fused
+	};
+	int ok = grow_code(&ctx) && init_constants(&ctx.constants, proc, scratch)
+		&& compile_proc(&ctx, proc);
+	if (ok) {
+		code->size = ctx.pc;
+		code->params = proc->fparam_count;
+		code->data = ctx.code;
+		ok = peephole_code(code) && super_instr_code(code);
+	} else
+		free(ctx.code);
+	reset_arena(scratch);
+	return ok;
 }
 
-int compile(Prog* prog) {
-	Proc* proc;
-	int ok = 0;
+int compile_proc_code(Proc* proc, Arena* scratch, InterpCode* code) {
+	return emit_proc_code(proc, scratch, 0, code);
+}
+
+/* a lazy procedure has its body parsed, bound and checked on first use */
+static inline int load_proc(Prog* prog, Proc* proc) {
+	unsigned position = 0;
+	Symbol missing;
+
+	return (parse_proc_body(prog, proc) == PARSE_OK)
+		&& resolve_proc_vars(proc)
+		&& resolve_proc_body(proc, &position, &missing)
+		&& type_check_vars(proc)
+		&& type_check_proc(proc);
+}
+
+/* compiles what main reaches, following the PROC references of compiled code */
+static int compile_reachable(Prog* prog, Arena* scratch) {
+	int* queue = (int*) malloc(prog->proc_count * sizeof(int));
+	char* queued = (char*) calloc(prog->proc_count, 1);
+	int head = 0;
+	int tail = 0;
+	int ok = queue && queued;
 
-	proc = prog->first_proc;
-	while (proc) {
-		if (strcmp(proc->id, "main") == 0) {
-			prog->interp.main = proc->nid;
-			ok = 1;
+	if (ok) {
+		queue[tail++] = prog->interp.main;
+		queued[prog->interp.main] = 1;
+	}
+	while (ok && (head < tail)) {
+		Proc* proc = &prog->procs[queue[head++]];
+		InterpCode* code = &prog->interp.procs[proc->nid];
+		int i;
+
+		ok = (!proc->lazy || load_proc(prog, proc)) && compile_proc_code(proc, scratch, code);
+		for (i=0; ok && (i<code->size); i++) {
+			InterpOp op = base_op(code->data[i].op);
+			int callee = code->data[i].value;
+			if (((op == INTERP_PROC) || (op == INTERP_CALLPROC) || (op == INTERP_CALLVPROC))
+				&& !queued[callee]) {
+				queued[callee] = 1;
+				queue[tail++] = callee;
+			}
 		}
-		proc = proc->next;
 	}
-	if (!ok)
+	free(queue);
+	free(queued);
+	return ok;
+}
+
+static int find_main(Prog* prog) {
+	int found = 0;
+	int i;
+
+	for (i=0; i<prog->proc_count; i++)
+		if (prog->procs[i].id == SYMBOL_MAIN) {
+			prog->interp.main = prog->procs[i].nid;
+			found = 1;
+		}
+	return found;
+}
+
+static int compile_procs(Prog* prog, int fused) {
+	Arena scratch;
+	int ok = 1;
+	int i;
+
+	if (!find_main(prog) || !init_interp(&prog->interp, prog->proc_count))
 		return 0;
+	init_arena(&scratch);
+	if (prog->tokens)
+		ok = compile_reachable(prog, &scratch);
+	else
+		for (i=0; ok && (i<prog->proc_count); i++) {
+			Proc* proc = &prog->procs[i];
+			ok = emit_proc_code(proc, &scratch, fused, &prog->interp.procs[proc->nid]);
+		}
+	destroy_arena(&scratch);
 
-	init_interp(&prog->interp, prog->proc_count);
-	proc = prog->first_proc;
-	while (ok && proc) {
-		CompileCtx ctx = {
-			.last = NULL,
-			.pc = 0
-		};
-
-		ok = compile_proc(&ctx, proc);
-		if (ok) {
-			InterpCode* code = &prog->interp.procs[proc->nid];
-			ok = init_interp_code(code, ctx.pc);
-			if (ok) {
-				int i;
-				InstrNode* n = ctx.last;
-				for (i=ctx.pc-1; i>=0; i--) {
-					memcpy(&code->data[i], &n->instr, sizeof(InterpInstr));
-					n = n->prev;
-				}
-				assert(!n);
+	return ok && inline_procs(&prog->interp) && optimize_loops(&prog->interp);
+}
+
+int compile(Prog* prog) {
+	return compile_procs(prog, 0);
+}
+
+/*
+ * Once headers are done, a body only reads the global scope and writes
+ * its own nodes, binds and InterpCode, so workers can compile any of
+ * them. Runs of PROCS_PER_CLAIM procedures are claimed from next.
+ */
+typedef struct CompileWorker {
+	Prog*       prog;
+	int*        next;
+	int*        failed;
+	int         started;
+	pthread_t   thread;
+} CompileWorker;
+
+static void* compile_worker(void* arg) {
+	CompileWorker* worker = (CompileWorker*) arg;
+	Prog* prog = worker->prog;
+	Arena scratch;
+	int first;
+
+	init_arena(&scratch);
+	while (!__atomic_load_n(worker->failed, __ATOMIC_RELAXED)) {
+		int i, last;
+
+		first = __atomic_fetch_add(worker->next, PROCS_PER_CLAIM, __ATOMIC_RELAXED);
+		if (first >= prog->proc_count)
+			break;
+		last = (first + PROCS_PER_CLAIM < prog->proc_count) ? first + PROCS_PER_CLAIM : prog->proc_count;
+		for (i=first; i<last; i++) {
+			Proc* proc = &prog->procs[i];
+			if (!emit_proc_code(proc, &scratch, 1, &prog->interp.procs[proc->nid])) {
+				__atomic_store_n(worker->failed, 1, __ATOMIC_RELAXED);
+				break;
 			}
 		}
-		free_instrs(ctx.last);
-		proc = proc->next;
 	}
+	destroy_arena(&scratch);
+	return NULL;
+}
 
-	return ok;
-}
\ No newline at end of file
+static int compile_workers(Prog* prog, int threads) {
+	CompileWorker* workers;
+	int next = 0;
+	int failed = 0;
+	int i;
+
+	workers = (CompileWorker*) calloc(threads, sizeof(CompileWorker));
+	if (!workers)
+		return 0;
+	for (i=0; i<threads; i++) {
+		workers[i].prog = prog;
+		workers[i].next = &next;
+		workers[i].failed = &failed;
+	}
+
+	/* a worker that does not start leaves its share to the others */
+	for (i=1; i<threads; i++)
+		workers[i].started = pthread_create(&workers[i].thread, NULL, compile_worker, &workers[i]) == 0;
+	compile_worker(&workers[0]);
+	for (i=1; i<threads; i++)
+		if (workers[i].started)
+			pthread_join(workers[i].thread, NULL);
+
+	free(workers);
+	return !failed;
+}
+
+/* headers first: a call is checked against the ProcType of its callee */
+int compile_parallel(Prog* prog, int threads) {
+	int ok = 1;
+	int i;
+
+	for (i=0; ok && (i<prog->proc_count); i++)
+		ok = declare_proc(prog, &prog->procs[i]);
+	for (i=0; ok && (i<prog->proc_count); i++) {
+		Proc* proc = &prog->procs[i];
+		ok = resolve_proc_header(proc) && type_check_header(&prog->types, proc);
+	}
+	if (!ok)
+		return 0;
+
+	if (threads > prog->proc_count / PROCS_PER_CLAIM)
+		threads = prog->proc_count / PROCS_PER_CLAIM;
+	if ((threads <= 1) || prog->tokens)
+		return compile_procs(prog, 1);
+
+	if (!find_main(prog) || !init_interp(&prog->interp, prog->proc_count))
+		return 0;
+	return compile_workers(prog, threads) && inline_procs(&prog->interp)
+		&& optimize_loops(&prog->interp);
+}
+
+int compile_fused(Prog* prog) {
+	return compile_parallel(prog, 1);
+}
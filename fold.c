@@ -0,0 +1,137 @@
+#include "parser.h"
+
+#include <assert.h>
+
+/* the interpreter's 32 bit wrap around, without signed overflow */
+static inline int eval_op(BinaryOp op, int left, int right) {
+	switch (op) {
+	case OP_ADD:
+		return (int) ((unsigned) left + (unsigned) right);
+	case OP_MULT:
+		return (int) ((unsigned) left * (unsigned) right);
+	default:
+		assert(0);
+	}
+	return 0;
+}
+
+static inline int identity_of(BinaryOp op) {
+	return (op == OP_ADD) ? 0 : 1;
+}
+
+static inline void set_num(Expr* expr, int value) {
+	expr->type = EXPR_NUM;
+	expr->content.as_num.value = value;
+	expr->actual_type.type = &INTEGER;
+	expr->actual_type.lvalue = 0;
+	expr->actual_type.constant = 1;
+}
+
+/* vars take the first slots, params the ones after them */
+static inline int slot_of(Constants* constants, Bind* bind) {
+	if (!bind)
+		return -1;
+	switch (bind->type) {
+	case BIND_VAR:
+		return bind->content.as_var->nid;
+	case BIND_FPARAM:
+		return constants->var_count + bind->content.as_fparam->nid;
+	default:
+		return -1;
+	}
+}
+
+/* vars start as the zeros the prologue pushes, params are unknown */
+int init_constants(Constants* constants, Proc* proc, Arena* arena) {
+	int count = proc->var_count + proc->fparam_count;
+	int i;
+
+	constants->var_count = proc->var_count;
+	constants->values = (int*) arena_alloc(arena, count * sizeof(int));
+	constants->known = (char*) arena_alloc(arena, count);
+	if (!constants->values || !constants->known)
+		return 0;
+	for (i=0; i<proc->var_count; i++)
+		constants->known[i] = 1;
+	return 1;
+}
+
+FoldResult fold_bin_expr(Proc* proc, Expr* expr) {
+	BinaryExpr* bin = &expr->content.as_binary;
+	Expr* left = &proc->exprs[bin->left];
+	Expr* right = &proc->exprs[bin->right];
+	BinaryExpr* inner = &left->content.as_binary;
+
+	if (right->type != EXPR_NUM)
+		return FOLD_NONE;
+	if (left->type == EXPR_NUM) {
+		set_num(expr, eval_op(bin->op, left->content.as_num.value, right->content.as_num.value));
+		return FOLD_CONSTANT;
+	}
+	if ((left->type == EXPR_BINARY) && (inner->op == bin->op)
+		&& (proc->exprs[inner->right].type == EXPR_NUM)) {
+		right->content.as_num.value = eval_op(bin->op,
+			proc->exprs[inner->right].content.as_num.value, right->content.as_num.value);
+		bin->left = inner->left;
+		return FOLD_REASSOCIATED;
+	}
+	if (right->content.as_num.value == identity_of(bin->op)) {
+		/* x * 1 is still no lvalue, fused mode checks an assignment after folding it */
+		*expr = *left;
+		expr->actual_type.lvalue = 0;
+		return FOLD_IDENTITY;
+	}
+	return FOLD_NONE;
+}
+
+int fold_id_expr(Constants* constants, Expr* expr) {
+	int slot = slot_of(constants, expr->content.as_id.bind);
+
+	if ((slot < 0) || !constants->known[slot])
+		return 0;
+	set_num(expr, constants->values[slot]);
+	return 1;
+}
+
+void assign_constant(Constants* constants, Bind* bind, Expr* value) {
+	int slot = slot_of(constants, bind);
+
+	if (slot < 0)
+		return;
+	constants->known[slot] = (value->type == EXPR_NUM);
+	if (constants->known[slot])
+		constants->values[slot] = value->content.as_num.value;
+}
+
+void forget_constant(Constants* constants, Bind* bind) {
+	int slot = slot_of(constants, bind);
+	if (slot >= 0)
+		constants->known[slot] = 0;
+}
+
+/*
+ * Names in stmts may not be bound yet when binding is fused with code
+ * generation, and binding them early is harmless: the lookups are the
+ * same. Names that do not resolve fail later, when they are compiled.
+ */
+void forget_assigned(Constants* constants, Proc* proc, NodeRange stmts) {
+	unsigned i;
+	for (i=0; i<stmts.count; i++) {
+		Stmt* stmt = &proc->stmts[stmts.first + i];
+		switch (stmt->type) {
+		case STMT_ASSIGN: {
+			Expr* lvalue = &proc->exprs[stmt->content.as_assign.lvalue];
+			if ((lvalue->type == EXPR_ID) && (lvalue->content.as_id.bind || resolve_expr(proc, lvalue)))
+				forget_constant(constants, lvalue->content.as_id.bind);
+			break;
+		}
+		case STMT_FOR:
+			if (stmt->content.as_for.bind || resolve_stmt(proc, stmt))
+				forget_constant(constants, stmt->content.as_for.bind);
+			forget_assigned(constants, proc, stmt->content.as_for.body);
+			break;
+		default:
+			break;
+		}
+	}
+}
@@ -0,0 +1,414 @@
+#include "interp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* a callee adding up to this many instructions in place of its call is inlined at every site */
+#define INLINE_GROWTH     24
+/* callers stop taking callees in at this size */
+#define MAX_CALLER_SIZE   4096
+/* callees called deeper than this are left to the outer loop of inline_procs */
+#define MAX_INLINE_DEPTH  64
+
+typedef enum Visit {
+	VISIT_NONE = 0,
+	VISIT_ACTIVE,
+	VISIT_DONE
+} Visit;
+
+/*
+ * What inlining a procedure takes: its params, the vars its prologue
+ * pushes, and the body between the prologue and its return. frame is -1
+ * when it cannot be inlined; inits marks the vars the body may read
+ * before writing them, which are zeroed at each site, and loaded the
+ * params it only ever loads.
+ */
+typedef struct Callee {
+	int    params;
+	int    frame;
+	int    body;
+	int    calls;
+	char*  inits;
+	char*  loaded;
+} Callee;
+
+typedef struct InlineCtx {
+	InterpProg*  prog;
+	char*        visit;
+	Callee*      callees;
+	char*        target;
+	int          target_size;
+} InlineCtx;
+
+static inline int is_jump(InterpOp op) {
+	return (op == INTERP_JMP) || (op == INTERP_JLT);
+}
+
+static inline int is_call(InterpOp op) {
+	return (op == INTERP_CALLPROC) || (op == INTERP_CALLVPROC);
+}
+
+static inline int is_var_op(InterpOp op) {
+	return (op == INTERP_VAR) || (op == INTERP_LOADVAR) || (op == INTERP_STOREVAR)
+		|| (op == INTERP_INCVAR);
+}
+
+/* pushes minus pops of the instruction, 0 for those whose effect is not known */
+static int stack_effect(InlineCtx* ctx, InterpInstr* instr, int* effect) {
+	switch (base_op(instr->op)) {
+	case INTERP_PUSH:
+	case INTERP_VAR:
+	case INTERP_PARAM:
+	case INTERP_PROC:
+	case INTERP_DUP:
+	case INTERP_LOADVAR:
+	case INTERP_LOADPARAM:
+		*effect = 1;
+		return 1;
+	case INTERP_LOAD:
+	case INTERP_JMP:
+	case INTERP_INCVAR:
+	case INTERP_ADDI:
+	case INTERP_MULI:
+	case INTERP_SHLI:
+		*effect = 0;
+		return 1;
+	case INTERP_POP:
+	case INTERP_ADD:
+	case INTERP_MUL:
+	case INTERP_INC:
+	case INTERP_CMP:
+	case INTERP_JLT:
+	case INTERP_STOREVAR:
+	case INTERP_STOREPARAM:
+		*effect = -1;
+		return 1;
+	case INTERP_STORE:
+		*effect = -2;
+		return 1;
+	case INTERP_CALLPROC:
+	case INTERP_CALLVPROC:
+		*effect = -ctx->callees[instr->value].params + (base_op(instr->op) == INTERP_CALLPROC);
+		return ctx->callees[instr->value].params >= 0;
+	default:
+		return 0;
+	}
+}
+
+static int grow_target(InlineCtx* ctx, int size) {
+	if (size > ctx->target_size) {
+		char* target = (char*) realloc(ctx->target, size);
+		if (!target)
+			return 0;
+		ctx->target = target;
+		ctx->target_size = size;
+	}
+	memset(ctx->target, 0, size);
+	return 1;
+}
+
+/*
+ * Vars the straight code at the start of the body writes before any
+ * read need no zeroing; past the first jump or target any may be read.
+ */
+static void find_inits(InlineCtx* ctx, InterpCode* code, Callee* callee) {
+	char* seen = callee->inits + callee->frame;
+	int end = callee->frame + callee->body;
+	int pc;
+
+	memset(callee->inits, 0, callee->frame);
+	memset(seen, 0, callee->frame);
+	for (pc=callee->frame; pc<end; pc++) {
+		InterpInstr* instr = &code->data[pc];
+		InterpOp op = base_op(instr->op);
+		if (ctx->target[pc] || is_jump(op))
+			break;
+		if (is_var_op(op) && !seen[instr->value]) {
+			seen[instr->value] = 1;
+			callee->inits[instr->value] = op != INTERP_STOREVAR;
+		}
+	}
+	if (pc < end)
+		for (pc=0; pc<callee->frame; pc++)
+			callee->inits[pc] |= !seen[pc];
+}
+
+/*
+ * A procedure can be inlined when its one return is its last
+ * instruction, for then the stack holds its vars and nothing else but
+ * the result: that many PUSH 0s make the prologue, the rest is the
+ * body. Calls through PROC values are not followed.
+ */
+static int find_callee(InlineCtx* ctx, int proc) {
+	InterpCode* code = &ctx->prog->procs[proc];
+	Callee* callee = &ctx->callees[proc];
+	int last = code->size - 1;
+	int depth = 0;
+	InterpOp op;
+	int pc, effect;
+
+	callee->frame = -1;
+	if (last < 0)
+		return 1;
+	op = base_op(code->data[last].op);
+	if ((op != INTERP_RET) && (op != INTERP_RETV))
+		return 1;
+	if (!grow_target(ctx, code->size + 1))
+		return 0;
+	for (pc=0; pc<last; pc++) {
+		InterpInstr* instr = &code->data[pc];
+		if (!stack_effect(ctx, instr, &effect))
+			return 1;
+		depth += effect;
+		if (is_jump(base_op(instr->op)))
+			ctx->target[instr->value] = 1;
+	}
+	depth -= (op == INTERP_RET);
+	if ((depth < 0) || (depth > last))
+		return 1;
+	for (pc=0; pc<depth; pc++)
+		if ((code->data[pc].op != INTERP_PUSH) || code->data[pc].value || ctx->target[pc])
+			return 1;
+
+	callee->inits = (char*) malloc(2 * depth + callee->params + 1);
+	if (!callee->inits)
+		return 0;
+	callee->loaded = callee->inits + 2 * depth;
+	memset(callee->loaded, 1, callee->params);
+	for (pc=depth; pc<last; pc++) {
+		InterpOp param_op = base_op(code->data[pc].op);
+		if ((param_op == INTERP_PARAM) || (param_op == INTERP_STOREPARAM))
+			callee->loaded[code->data[pc].value] = 0;
+	}
+	callee->frame = depth;
+	callee->body = last - depth;
+	find_inits(ctx, code, callee);
+	return 1;
+}
+
+/* what the call site grows by: the args stored, the vars zeroed and the body, less the call */
+static int growth(Callee* callee) {
+	int inits = 0;
+	int i;
+	for (i=0; i<callee->frame; i++)
+		inits += callee->inits[i];
+	return callee->params + 2 * inits + callee->body - 1;
+}
+
+/*
+ * The cost model: a small callee goes everywhere, one called once goes
+ * whatever its size, as long as the caller stays under its limit.
+ * Callees still being visited are in a cycle with the caller.
+ */
+static int should_inline(InlineCtx* ctx, int callee, int size) {
+	Callee* info = &ctx->callees[callee];
+	int added;
+
+	if ((ctx->visit[callee] != VISIT_DONE) || (info->frame < 0))
+		return 0;
+	added = growth(info);
+	return ((added <= INLINE_GROWTH) || (info->calls == 1)) && (size + added <= MAX_CALLER_SIZE);
+}
+
+static inline void put_instr(InterpInstr* data, int* out, InterpOp op, int value) {
+	data[*out].op = op;
+	data[*out].value = value;
+	(*out)++;
+}
+
+/* an arg pushed by one instruction, which reads the same wherever it moves within the call */
+static inline int is_simple_arg(InterpInstr* instr) {
+	InterpOp op = base_op(instr->op);
+	return (op == INTERP_PUSH) || (op == INTERP_LOADVAR) || (op == INTERP_LOADPARAM);
+}
+
+/*
+ * Counts the args, from the one on top, that are simple and go to params
+ * only loaded: the callee loads them in place of the params, and the
+ * instructions pushing them are dropped. Callees only write their own
+ * slots, so what the args read stays the same throughout the body.
+ */
+static int find_moved_args(InlineCtx* ctx, InterpCode* code, int pc, Callee* callee) {
+	int moved = 0;
+	while ((moved < callee->params) && (pc - 1 - moved >= 0) && callee->loaded[moved]
+		&& is_simple_arg(&code->data[pc - 1 - moved]) && !ctx->target[pc - 1 - moved])
+		moved++;
+	return moved;
+}
+
+/*
+ * The args left on the stack go to the callee's param slots, param 0 on
+ * top, and its vars follow them. Its code refers to those slots as vars
+ * and jumps within itself; the result of its return is left on the
+ * stack. args are the caller's instructions pushing the moved params,
+ * whose vars move up by slots.
+ */
+static void put_callee(InlineCtx* ctx, int proc, InterpInstr* args, int moved, int slots,
+	InterpInstr* data, int* out) {
+	InterpCode* code = &ctx->prog->procs[proc];
+	Callee* callee = &ctx->callees[proc];
+	int start, pc, i;
+
+	for (i=moved; i<callee->params; i++)
+		put_instr(data, out, INTERP_STOREVAR, i);
+	for (i=0; i<callee->frame; i++)
+		if (callee->inits[i]) {
+			put_instr(data, out, INTERP_PUSH, 0);
+			put_instr(data, out, INTERP_STOREVAR, callee->params + i);
+		}
+	start = *out - callee->frame;
+	for (pc=callee->frame; pc<callee->frame+callee->body; pc++) {
+		InterpInstr* instr = &code->data[pc];
+		InterpOp op = base_op(instr->op);
+		int value = instr->value;
+
+		if (is_var_op(op))
+			value += callee->params;
+		else if (is_jump(op))
+			value += start;
+		else if ((op == INTERP_LOADPARAM) && (value < moved)) {
+			InterpInstr* arg = &args[-value];
+			op = base_op(arg->op);
+			value = arg->value + ((op == INTERP_LOADVAR) ? slots : 0);
+		} else if (op == INTERP_PARAM)
+			op = INTERP_VAR;
+		else if (op == INTERP_LOADPARAM)
+			op = INTERP_LOADVAR;
+		else if (op == INTERP_STOREPARAM)
+			op = INTERP_STOREVAR;
+		put_instr(data, out, op, value);
+	}
+}
+
+/*
+ * Inlined callees take the first frame slots, all sites sharing them:
+ * the prologue grows by a PUSH 0 each and the caller's vars move up.
+ * site holds 1 more than the args moved at a call inlined, -1 at an
+ * instruction pushing one of them.
+ */
+static int inline_calls(InlineCtx* ctx, int proc) {
+	InterpCode* code = &ctx->prog->procs[proc];
+	int size = code->size;
+	int slots = 0;
+	int* site;
+	int* map;
+	InterpInstr* data;
+	int out, pc, i;
+
+	site = (int*) calloc(code->size + 1, sizeof(int));
+	if (!site || !grow_target(ctx, code->size + 1)) {
+		free(site);
+		return 0;
+	}
+	for (pc=0; pc<code->size; pc++)
+		if (is_jump(base_op(code->data[pc].op)))
+			ctx->target[code->data[pc].value] = 1;
+	for (pc=0; pc<code->size; pc++) {
+		InterpInstr* instr = &code->data[pc];
+		Callee* callee;
+		int moved;
+		if (!is_call(base_op(instr->op)) || !should_inline(ctx, instr->value, size))
+			continue;
+		callee = &ctx->callees[instr->value];
+		moved = find_moved_args(ctx, code, pc, callee);
+		site[pc] = moved + 1;
+		for (i=1; i<=moved; i++)
+			site[pc - i] = -1;
+		size += growth(callee);
+		if (callee->params + callee->frame > slots)
+			slots = callee->params + callee->frame;
+	}
+	if (size == code->size) {
+		free(site);
+		return 1;
+	}
+
+	size += slots;
+	map = (int*) malloc((code->size + 1) * sizeof(int));
+	data = (InterpInstr*) malloc(size * sizeof(InterpInstr));
+	if (!map || !data) {
+		free(site);
+		free(map);
+		free(data);
+		return 0;
+	}
+	out = 0;
+	for (i=0; i<slots; i++)
+		put_instr(data, &out, INTERP_PUSH, 0);
+	for (pc=0; pc<code->size; pc++) {
+		InterpOp op = base_op(code->data[pc].op);
+		map[pc] = out;
+		if (site[pc] > 0)
+			put_callee(ctx, code->data[pc].value, &code->data[pc - 1], site[pc] - 1, slots, data, &out);
+		else if (site[pc] == 0)
+			put_instr(data, &out, op, code->data[pc].value + (is_var_op(op) ? slots : 0));
+	}
+	map[code->size] = out;
+	for (pc=0; pc<code->size; pc++)
+		if (!site[pc] && is_jump(base_op(code->data[pc].op)))
+			data[map[pc]].value = map[code->data[pc].value];
+
+	free(code->data);
+	free(site);
+	free(map);
+	code->data = data;
+	code->size = out;
+	return super_instr_code(code);
+}
+
+/*
+ * Callees are inlined into their callers once they have taken in their
+ * own, so bodies are inlined whole. A call back to a procedure being
+ * visited closes a cycle and stays a call.
+ */
+static int visit_proc(InlineCtx* ctx, int proc, int depth) {
+	InterpCode* code = &ctx->prog->procs[proc];
+	int ok = 1;
+	int pc;
+
+	ctx->visit[proc] = VISIT_ACTIVE;
+	for (pc=0; ok && (pc<code->size); pc++) {
+		int callee = code->data[pc].value;
+		if (is_call(base_op(code->data[pc].op)) && (ctx->visit[callee] == VISIT_NONE)
+			&& (depth < MAX_INLINE_DEPTH))
+			ok = visit_proc(ctx, callee, depth + 1);
+	}
+	ok = ok && inline_calls(ctx, proc) && find_callee(ctx, proc);
+	ctx->visit[proc] = VISIT_DONE;
+	return ok;
+}
+
+int inline_procs(InterpProg* prog) {
+	InlineCtx ctx;
+	int ok;
+	int i, pc;
+
+	memset(&ctx, 0, sizeof(InlineCtx));
+	ctx.prog = prog;
+	ctx.visit = (char*) calloc(prog->proc_count + 1, 1);
+	ctx.callees = (Callee*) calloc(prog->proc_count + 1, sizeof(Callee));
+	ok = ctx.visit && ctx.callees;
+
+	/* every RET pops the params, -1 for a procedure that never returns */
+	for (i=0; ok && (i<prog->proc_count); i++) {
+		InterpCode* code = &prog->procs[i];
+		ctx.callees[i].params = -1;
+		for (pc=0; pc<code->size; pc++) {
+			InterpOp op = base_op(code->data[pc].op);
+			if ((op == INTERP_RET) || (op == INTERP_RETV))
+				ctx.callees[i].params = code->data[pc].value;
+			else if (is_call(op))
+				ctx.callees[code->data[pc].value].calls++;
+		}
+	}
+	for (i=0; ok && (i<prog->proc_count); i++)
+		if (ctx.visit[i] == VISIT_NONE)
+			ok = visit_proc(&ctx, i, 0);
+
+	for (i=0; ctx.callees && (i<prog->proc_count); i++)
+		free(ctx.callees[i].inits);
+	free(ctx.visit);
+	free(ctx.callees);
+	free(ctx.target);
+	return ok;
+}
@@ -0,0 +1,116 @@
+#include "intern.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SYMBOLS   256
+
+static const char* BUILTIN_NAMES[] = { "integer", "main" };
+
+static inline unsigned hash_text(const char* text, int size) {
+	unsigned hash = 2166136261u;
+	int i;
+	for (i=0; i<size; i++)
+		hash = (hash ^ (unsigned char) text[i]) * 16777619u;
+	return hash;
+}
+
+static int grow_table(Interner* interner) {
+	unsigned size = 2 * (interner->mask + 1);
+	Symbol* table = (Symbol*) calloc(size, sizeof(Symbol));
+	int i;
+
+	if (!table)
+		return 0;
+	for (i=1; i<interner->count; i++) {
+		unsigned slot = interner->entries[i].hash & (size - 1);
+		while (table[slot])
+			slot = (slot + 1) & (size - 1);
+		table[slot] = i;
+	}
+	free(interner->table);
+	interner->table = table;
+	interner->mask = size - 1;
+	return 1;
+}
+
+static int grow_entries(Interner* interner) {
+	int capacity = 2 * interner->capacity;
+	SymbolEntry* entries = (SymbolEntry*) realloc(interner->entries, capacity * sizeof(SymbolEntry));
+	if (!entries)
+		return 0;
+	interner->entries = entries;
+	interner->capacity = capacity;
+	return 1;
+}
+
+int init_interner(Interner* interner) {
+	size_t i;
+
+	init_arena(&interner->text);
+	interner->count = 1;
+	interner->capacity = INITIAL_SYMBOLS;
+	interner->entries = (SymbolEntry*) calloc(interner->capacity, sizeof(SymbolEntry));
+	interner->mask = 2 * INITIAL_SYMBOLS - 1;
+	interner->table = (Symbol*) calloc(interner->mask + 1, sizeof(Symbol));
+	if (!interner->entries || !interner->table) {
+		destroy_interner(interner);
+		return 0;
+	}
+
+	for (i=0; i<sizeof(BUILTIN_NAMES)/sizeof(BUILTIN_NAMES[0]); i++)
+		if (!intern(interner, BUILTIN_NAMES[i], strlen(BUILTIN_NAMES[i]))) {
+			destroy_interner(interner);
+			return 0;
+		}
+	return 1;
+}
+
+void destroy_interner(Interner* interner) {
+	destroy_arena(&interner->text);
+	free(interner->entries);
+	free(interner->table);
+	interner->entries = NULL;
+	interner->table = NULL;
+	interner->count = 0;
+}
+
+Symbol intern(Interner* interner, const char* text, int size) {
+	unsigned hash = hash_text(text, size);
+	unsigned slot;
+	SymbolEntry* entry;
+	Symbol symbol;
+	char* copy;
+
+	if (((unsigned) 2 * (interner->count + 1) > interner->mask + 1) && !grow_table(interner))
+		return NO_SYMBOL;
+
+	slot = hash & interner->mask;
+	while ((symbol = interner->table[slot])) {
+		entry = &interner->entries[symbol];
+		if ((entry->hash == hash) && (entry->size == (unsigned) size)
+			&& (memcmp(entry->text, text, size) == 0))
+			return symbol;
+		slot = (slot + 1) & interner->mask;
+	}
+
+	if ((interner->count == interner->capacity) && !grow_entries(interner))
+		return NO_SYMBOL;
+	copy = (char*) arena_alloc(&interner->text, size + 1);
+	if (!copy)
+		return NO_SYMBOL;
+	memcpy(copy, text, size);
+	copy[size] = '\0';
+
+	symbol = interner->count++;
+	entry = &interner->entries[symbol];
+	entry->text = copy;
+	entry->size = size;
+	entry->hash = hash;
+	interner->table[slot] = symbol;
+	return symbol;
+}
+
+const char* symbol_name(Interner* interner, Symbol symbol) {
+	return interner->entries[symbol].text;
+}
@@ -0,0 +1,44 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "arena.h"
+
+/*
+ * Identifiers are interned once and then handled as 32-bit symbols, so
+ * comparing two names is comparing two integers. Symbol 0 is never a
+ * name; the builtin names below are interned first, in this order.
+ */
+
+typedef unsigned Symbol;
+
+enum {
+	NO_SYMBOL = 0,
+	SYMBOL_INTEGER,
+	SYMBOL_MAIN
+};
+
+typedef struct SymbolEntry {
+	const char*  text;
+	unsigned     size;
+	unsigned     hash;
+} SymbolEntry;
+
+typedef struct Interner {
+	Arena         text;
+	SymbolEntry*  entries;
+	int           count;
+	int           capacity;
+	Symbol*       table;
+	unsigned      mask;
+} Interner;
+
+int init_interner(Interner* interner);
+
+void destroy_interner(Interner* interner);
+
+/* NO_SYMBOL when out of memory */
+Symbol intern(Interner* interner, const char* text, int size);
+
+const char* symbol_name(Interner* interner, Symbol symbol);
+
+#endif
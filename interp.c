@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
 
 int init_interp_code(InterpCode* code, int size) {
 	code->size = size;
@@ -13,10 +14,31 @@ int init_interp_code(InterpCode* code, int size) {
 int init_interp(InterpProg* interp_prog, int proc_count) {
 	int i;
 	interp_prog->proc_count = proc_count;
+	interp_prog->capacity = proc_count;
 	interp_prog->procs = (InterpCode*) calloc(proc_count, sizeof(InterpCode));
 	return interp_prog->procs ? 1 : 0;
 }
 
+int grow_interp(InterpProg* interp_prog, int proc_count) {
+	if (proc_count > interp_prog->capacity) {
+		int capacity = interp_prog->capacity ? 2 * interp_prog->capacity : 64;
+		InterpCode* procs;
+
+		while (capacity < proc_count)
+			capacity *= 2;
+		procs = (InterpCode*) realloc(interp_prog->procs, capacity * sizeof(InterpCode));
+		if (!procs)
+			return 0;
+		memset(&procs[interp_prog->capacity], 0,
+			(capacity - interp_prog->capacity) * sizeof(InterpCode));
+		interp_prog->procs = procs;
+		interp_prog->capacity = capacity;
+	}
+	if (proc_count > interp_prog->proc_count)
+		interp_prog->proc_count = proc_count;
+	return 1;
+}
+
 static inline int dump_write(FILE* fp, const char* fmt, ...) {
 	int ok;
 	va_list ap;
@@ -26,50 +48,58 @@ static inline int dump_write(FILE* fp, const char* fmt, ...) {
 	return ok;
 }
 
+typedef struct OpInfo {
+	const char*  name;
+	int          operand;
+} OpInfo;
+
+static const OpInfo OP_INFO[INTERP_OP_COUNT] = {
+	[INTERP_INVALID] = { "INVALID", 0 },
+	[INTERP_PUSH] = { "PUSH", 1 },
+	[INTERP_POP] = { "POP", 0 },
+	[INTERP_LOAD] = { "LOAD", 0 },
+	[INTERP_STORE] = { "STORE", 0 },
+	[INTERP_VAR] = { "VAR", 1 },
+	[INTERP_PARAM] = { "PARAM", 1 },
+	[INTERP_PROC] = { "PROC", 1 },
+	[INTERP_DUP] = { "DUP", 0 },
+	[INTERP_ADD] = { "ADD", 0 },
+	[INTERP_MUL] = { "MUL", 0 },
+	[INTERP_INC] = { "INC", 0 },
+	[INTERP_CMP] = { "CMP", 0 },
+	[INTERP_JMP] = { "JMP", 1 },
+	[INTERP_JLT] = { "JLT", 1 },
+	[INTERP_CALL] = { "CALL", 0 },
+	[INTERP_CALLV] = { "CALLV", 0 },
+	[INTERP_RETV] = { "RETV", 1 },
+	[INTERP_RET] = { "RET", 1 },
+	[INTERP_LOADVAR] = { "LOADVAR", 1 },
+	[INTERP_STOREVAR] = { "STOREVAR", 1 },
+	[INTERP_INCVAR] = { "INCVAR", 1 },
+	[INTERP_LOADPARAM] = { "LOADPARAM", 1 },
+	[INTERP_STOREPARAM] = { "STOREPARAM", 1 },
+	[INTERP_ADDI] = { "ADDI", 1 },
+	[INTERP_MULI] = { "MULI", 1 },
+	[INTERP_SHLI] = { "SHLI", 1 },
+	[INTERP_CALLPROC] = { "CALLPROC", 1 },
+	[INTERP_CALLVPROC] = { "CALLVPROC", 1 },
+	[INTERP_LOOPTEST] = { "LOOPTEST", 0 },
+	[INTERP_INCJMP] = { "INCJMP", 1 },
+	[INTERP_MULVARS] = { "MULVARS", 1 },
+	[INTERP_ADDVARS] = { "ADDVARS", 1 },
+	[INTERP_ADDISTORE] = { "ADDISTORE", 1 },
+	[INTERP_TAILCALL] = { "TAILCALL", 1 },
+	[INTERP_TAILCALLV] = { "TAILCALLV", 1 },
+};
+
 static inline int dump_instr(FILE* fp, InterpInstr* instr) {
-	switch (instr->op) {
-	case INTERP_INVALID:
-		return dump_write(fp, "INVALID");
-	case INTERP_PUSH:
-		return dump_write(fp, "PUSH %d", instr->value);
-	case INTERP_POP:
-		return dump_write(fp, "POP");
-	case INTERP_LOAD:
-		return dump_write(fp, "LOAD");
-	case INTERP_STORE:
-		return dump_write(fp, "STORE");
-	case INTERP_VAR:
-		return dump_write(fp, "VAR %d", instr->value);
-	case INTERP_PARAM:
-		return dump_write(fp, "PARAM %d", instr->value);
-	case INTERP_PROC:
-		return dump_write(fp, "PROC %d", instr->value);
-	case INTERP_DUP:
-		return dump_write(fp, "DUP");
-	case INTERP_ADD:
-		return dump_write(fp, "ADD");
-	case INTERP_MUL:
-		return dump_write(fp, "MUL");
-	case INTERP_INC:
-		return dump_write(fp, "INC");
-	case INTERP_CMP:
-		return dump_write(fp, "CMP");
-	case INTERP_JMP:
-		return dump_write(fp, "JMP %d", instr->value);
-	case INTERP_JLT:
-		return dump_write(fp, "JLT %d", instr->value);
-	case INTERP_CALL:
-		return dump_write(fp, "CALL");
-	case INTERP_CALLV:
-		return dump_write(fp, "CALLV");
-	case INTERP_RETV:
-		return dump_write(fp, "RETV %d", instr->value);
-	case INTERP_RET:
-		return dump_write(fp, "RET %d", instr->value);
-	default:
-		assert(0);
-	}
-	return 0;
+	const OpInfo* info;
+
+	assert((instr->op >= 0) && (instr->op < INTERP_OP_COUNT));
+	info = &OP_INFO[instr->op];
+	if (info->operand)
+		return dump_write(fp, "%s %d", info->name, instr->value);
+	return dump_write(fp, "%s", info->name);
 }
 
 int dump_interp_code(InterpCode* code, FILE* fp) {
@@ -110,7 +140,29 @@ static inline long peek(InterpStack* stack) {
 	return stack->data[stack->sp - 1];
 }
 
-static int eval_interp_code(InterpProg* prog, InterpCode* code, InterpStack* stack, int* result) {
+static inline void profile_op(InterpProfile* profile, InterpOp* last, InterpOp op) {
+	profile->dispatches++;
+	profile->ops[op]++;
+	if (last[1] != INTERP_INVALID) {
+		profile->pairs[last[1]][op]++;
+		if (last[0] != INTERP_INVALID)
+			profile->triples[last[0]][last[1]][op]++;
+	}
+	last[0] = last[1];
+	last[1] = op;
+}
+
+static int eval_interp_code(InterpProg* prog, InterpCode* code, InterpStack* stack, int* result,
+	InterpProfile* profile);
+
+/*
+ * Inlined into two copies of the dispatch loop, so that the one without
+ * a profile does not test for it on every dispatch.
+ */
+static inline __attribute__((always_inline))
+int run_code(InterpProg* prog, InterpCode* code, InterpStack* stack, int* result,
+	InterpProfile* profile) {
+	InterpOp last[2] = { INTERP_INVALID, INTERP_INVALID };
 	int bp = stack->sp;
 	int pc = 0;
 
@@ -118,6 +170,8 @@ static int eval_interp_code(InterpProg* prog, InterpCode* code, InterpStack* sta
 		assert((pc >= 0) && (pc < code->size));
 
 		InterpInstr *instr = &code->data[pc];
+		if (profile)
+			profile_op(profile, last, instr->op);
 		switch (instr->op) {
 		case INTERP_INVALID:
 			return 0;
@@ -188,14 +242,14 @@ static int eval_interp_code(InterpProg* prog, InterpCode* code, InterpStack* sta
 		case INTERP_CALL: {
 			int id = pop(stack);
 			int value;
-			if (!eval_interp_code(prog, &prog->procs[id], stack, &value))
+			if (!eval_interp_code(prog, &prog->procs[id], stack, &value, profile))
 				return 0;
 			push(stack, value);
 			break;
 		}
 		case INTERP_CALLV: {
 			int id = pop(stack);
-			if (!eval_interp_code(prog, &prog->procs[id], stack, NULL))
+			if (!eval_interp_code(prog, &prog->procs[id], stack, NULL, profile))
 				return 0;
 			break;
 		}
@@ -219,6 +273,94 @@ static int eval_interp_code(InterpProg* prog, InterpCode* code, InterpStack* sta
 				pop(stack);
 			return 1;
 		}
+		case INTERP_LOADVAR:
+			push(stack, stack->data[bp + instr->value]);
+			break;
+		case INTERP_STOREVAR:
+			stack->data[bp + instr->value] = pop(stack);
+			break;
+		case INTERP_INCVAR:
+			stack->data[bp + instr->value]++;
+			break;
+		case INTERP_LOADPARAM:
+			push(stack, stack->data[bp - instr->value - 1]);
+			break;
+		case INTERP_STOREPARAM:
+			stack->data[bp - instr->value - 1] = pop(stack);
+			break;
+		case INTERP_ADDI: {
+			int op1 = pop(stack);
+			push(stack, op1 + instr->value);
+			break;
+		}
+		case INTERP_MULI: {
+			int op1 = pop(stack);
+			push(stack, op1 * instr->value);
+			break;
+		}
+		case INTERP_SHLI: {
+			int op1 = pop(stack);
+			push(stack, (int) ((unsigned) op1 << instr->value));
+			break;
+		}
+		case INTERP_CALLPROC: {
+			int value;
+			if (!eval_interp_code(prog, &prog->procs[instr->value], stack, &value, profile))
+				return 0;
+			push(stack, value);
+			break;
+		}
+		case INTERP_CALLVPROC:
+			if (!eval_interp_code(prog, &prog->procs[instr->value], stack, NULL, profile))
+				return 0;
+			break;
+		case INTERP_LOOPTEST: {
+			int op1 = peek(stack);
+			int op2 = stack->data[bp + instr[1].value];
+			if (op1 - op2 < 0) {
+				pc = instr[3].value;
+				continue;
+			}
+			pc += 4;
+			continue;
+		}
+		case INTERP_INCJMP:
+			stack->data[bp + instr->value]++;
+			pc = instr[1].value;
+			continue;
+		case INTERP_MULVARS: {
+			int op1 = stack->data[bp + instr->value];
+			int op2 = stack->data[bp + instr[1].value];
+			stack->data[bp + instr[3].value] = op1 * op2;
+			pc += 4;
+			continue;
+		}
+		case INTERP_ADDVARS: {
+			int op1 = stack->data[bp + instr->value];
+			int op2 = stack->data[bp + instr[1].value];
+			stack->data[bp + instr[3].value] = op1 + op2;
+			pc += 4;
+			continue;
+		}
+		case INTERP_ADDISTORE: {
+			int op1 = stack->data[bp + instr->value];
+			stack->data[bp + instr[2].value] = op1 + instr[1].value;
+			pc += 3;
+			continue;
+		}
+		case INTERP_TAILCALL:
+		case INTERP_TAILCALLV: {
+			/* the args take the place of the params, and the callee runs in this frame */
+			InterpCode* callee = &prog->procs[instr->value];
+			int base = bp - instr[1].value;
+
+			memmove(&stack->data[base], &stack->data[stack->sp - callee->params],
+				callee->params * sizeof(long));
+			bp = stack->sp = base + callee->params;
+			code = callee;
+			pc = 0;
+			continue;
+		}
 		default:
 			assert(0);
 		}
@@ -227,13 +369,96 @@ static int eval_interp_code(InterpProg* prog, InterpCode* code, InterpStack* sta
 	return 0;
 }
 
+static int run_plain(InterpProg* prog, InterpCode* code, InterpStack* stack, int* result) {
+	return run_code(prog, code, stack, result, NULL);
+}
+
+static int run_profiled(InterpProg* prog, InterpCode* code, InterpStack* stack, int* result,
+	InterpProfile* profile) {
+	return run_code(prog, code, stack, result, profile);
+}
+
+static int eval_interp_code(InterpProg* prog, InterpCode* code, InterpStack* stack, int* result,
+	InterpProfile* profile) {
+	if (profile)
+		return run_profiled(prog, code, stack, result, profile);
+	return run_plain(prog, code, stack, result);
+}
+
 int eval_interp_prog(InterpProg* prog, int* result) {
+	return eval_interp_profile(prog, result, NULL);
+}
+
+int eval_interp_profile(InterpProg* prog, int* result, InterpProfile* profile) {
 	InterpStack stack = {.sp = 0};
-	if (!eval_interp_code(prog, &prog->procs[prog->main], &stack, result))
+	if (!eval_interp_code(prog, &prog->procs[prog->main], &stack, result, profile))
 		return 0;
 	return 1;
 }
 
+typedef struct ProfileEntry {
+	long  count;
+	int   ops[3];
+} ProfileEntry;
+
+/* most frequent first, ties in op order */
+static int by_count(const void* a, const void* b) {
+	const ProfileEntry* ea = (const ProfileEntry*) a;
+	const ProfileEntry* eb = (const ProfileEntry*) b;
+	int k;
+
+	if (ea->count != eb->count)
+		return (ea->count < eb->count) ? 1 : -1;
+	for (k=0; k<3; k++)
+		if (ea->ops[k] != eb->ops[k])
+			return ea->ops[k] - eb->ops[k];
+	return 0;
+}
+
+/* counts holds every sequence of length ops, in row major order */
+static int dump_sequences(const char* title, long* counts, int length, int top, FILE* fp) {
+	int total = 1;
+	int count = 0;
+	int ok;
+	ProfileEntry* entries;
+	int i, k;
+
+	for (k=0; k<length; k++)
+		total *= INTERP_OP_COUNT;
+	entries = (ProfileEntry*) malloc(total * sizeof(ProfileEntry));
+	if (!entries)
+		return 0;
+	for (i=0; i<total; i++)
+		if (counts[i]) {
+			int index = i;
+			memset(&entries[count], 0, sizeof(ProfileEntry));
+			entries[count].count = counts[i];
+			for (k=length-1; k>=0; k--) {
+				entries[count].ops[k] = index % INTERP_OP_COUNT;
+				index /= INTERP_OP_COUNT;
+			}
+			count++;
+		}
+	qsort(entries, count, sizeof(ProfileEntry), by_count);
+
+	ok = dump_write(fp, "%s\n", title);
+	for (i=0; ok && (i<count) && (i<top); i++) {
+		ok = dump_write(fp, "%12ld ", entries[i].count);
+		for (k=0; ok && (k<length); k++)
+			ok = dump_write(fp, " %s", OP_INFO[entries[i].ops[k]].name);
+		ok = ok && dump_write(fp, "\n");
+	}
+	free(entries);
+	return ok;
+}
+
+int dump_interp_profile(InterpProfile* profile, int top, FILE* fp) {
+	return dump_write(fp, "Dispatches %ld\n", profile->dispatches)
+		&& dump_sequences("Ops", profile->ops, 1, top, fp)
+		&& dump_sequences("Pairs", &profile->pairs[0][0], 2, top, fp)
+		&& dump_sequences("Triples", &profile->triples[0][0][0], 3, top, fp);
+}
+
 void destroy_interp(InterpProg* prog) {
 	int i;
 	for (i=0; i<prog->proc_count; i++)
@@ -23,6 +23,30 @@ typedef enum InterpOp {
 	INTERP_CALLV,
 	INTERP_RETV,
 	INTERP_RET,
+	/* pairs fused by peephole_code */
+	INTERP_LOADVAR,     /* VAR n; LOAD */
+	INTERP_STOREVAR,    /* VAR n; STORE */
+	INTERP_INCVAR,      /* VAR n; INC */
+	INTERP_LOADPARAM,   /* PARAM n; LOAD */
+	INTERP_STOREPARAM,  /* PARAM n; STORE */
+	INTERP_ADDI,        /* PUSH k; ADD */
+	INTERP_MULI,        /* PUSH k; MUL */
+	INTERP_SHLI,        /* MULI by 1 << n, with n as operand */
+	INTERP_CALLPROC,    /* PROC n; CALL */
+	INTERP_CALLVPROC,   /* PROC n; CALLV */
+	/*
+	 * Superinstructions, see super_instr_code: the sequence keeps its
+	 * slots, only the op of the first one changes, and the others are
+	 * read as operands and skipped.
+	 */
+	INTERP_LOOPTEST,    /* DUP; LOADVAR i; CMP; JLT t */
+	INTERP_INCJMP,      /* INCVAR i; JMP t */
+	INTERP_MULVARS,     /* LOADVAR a; LOADVAR b; MUL; STOREVAR c */
+	INTERP_ADDVARS,     /* LOADVAR a; LOADVAR b; ADD; STOREVAR c */
+	INTERP_ADDISTORE,   /* LOADVAR a; ADDI k; STOREVAR c */
+	INTERP_TAILCALL,    /* CALLPROC n; RET k */
+	INTERP_TAILCALLV,   /* CALLVPROC n; RETV k */
+	INTERP_OP_COUNT
 } InterpOp;
 
 typedef struct InterpInstr {
@@ -32,11 +56,21 @@ typedef struct InterpInstr {
 
 typedef struct InterpCode {
 	int           size;
+	int           params;   /* what RET and RETV pop, so what a tail call to it moves */
 	InterpInstr*  data;
 } InterpCode;
 
+/* dynamic counts of ops, and of pairs and triples of consecutive ops within a call */
+typedef struct InterpProfile {
+	long  dispatches;
+	long  ops[INTERP_OP_COUNT];
+	long  pairs[INTERP_OP_COUNT][INTERP_OP_COUNT];
+	long  triples[INTERP_OP_COUNT][INTERP_OP_COUNT][INTERP_OP_COUNT];
+} InterpProfile;
+
 typedef struct InterpProg {
 	int          proc_count;
+	int          capacity;
 	int          main;
 	InterpCode*  procs;
 } InterpProg;
@@ -45,10 +79,49 @@ int init_interp_code(InterpCode* code, int size);
 
 int init_interp(InterpProg* interp_prog, int proc_count);
 
+/* makes room for proc_count procedures, new ones are empty */
+int grow_interp(InterpProg* interp_prog, int proc_count);
+
+/*
+ * Fuses instruction pairs into the single instructions above, remapping
+ * jumps; constants multiplying or added to a load are moved after it.
+ */
+int peephole_code(InterpCode* code);
+
+/* rewrites the first slot of each sequence a superinstruction stands for */
+int super_instr_code(InterpCode* code);
+
+/*
+ * Replaces calls to small procedures, and to those called once, with
+ * their bodies, their params and vars becoming slots of the caller.
+ * Recursive calls stay calls. Runs over the whole program, once all of
+ * it is compiled.
+ */
+int inline_procs(InterpProg* prog);
+
+/*
+ * Moves what every iteration of a loop computes alike to a preheader,
+ * calls included when the callee is pure, and turns products of a for
+ * loop's var into temps stepped by addition. Runs over the whole
+ * program, once all of it is compiled.
+ */
+int optimize_loops(InterpProg* prog);
+
+/* the op of the first slot of a superinstruction's sequence, op itself otherwise */
+InterpOp base_op(InterpOp op);
+
 int dump_interp_code(InterpCode* code, FILE* fp);
 
 int dump_interp_prog(InterpProg* prog, FILE* fp);
 
+int eval_interp_prog(InterpProg* prog, int* result);
+
+/* eval_interp_prog adding to the counts of profile, which starts zeroed */
+int eval_interp_profile(InterpProg* prog, int* result, InterpProfile* profile);
+
+/* the top most frequent ops, pairs and triples */
+int dump_interp_profile(InterpProfile* profile, int top, FILE* fp);
+
 void destroy_interp(InterpProg* interp_prog);
 
 void destroy_interp_code(InterpCode* code);
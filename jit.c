@@ -9,14 +9,13 @@ typedef unsigned char uchar;
 
 /*
 INTERP_PUSH:
-  movq ..., %rax
-  pushq %rax
+  pushq ...
+the imm32 is sign extended, as a byte is in the short form
 */
-typedef uchar PushCode[11];
+typedef uchar PushCode[5];
 
 static const PushCode PUSH = {
-	0x48, 0xB8, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // movq ..., %rax
-	0x50 // pushq %rax
+	0x68, 0x00, 0x00, 0x00, 0x00 // pushq ...
 };
 
 /*
@@ -63,10 +62,11 @@ static const StoreCode STORE[5] = {
 /*
 INTERP_VAR:
   movq %rbp, %rax
-  addq ..., %rax
+  subq ..., %rax
+  pushq %rax
 */
 
-typedef uchar VarCode[8];
+typedef uchar VarCode[11];
 
 static const VarCode VAR = {
 	0x48, 0x89, 0xe8, // movq %rbp, %rax
@@ -74,7 +74,7 @@ static const VarCode VAR = {
 	0x50 // pushq %rax
 };
 
-typedef uchar ParamCode[8];
+typedef uchar ParamCode[11];
 
 static const ParamCode PARAM = {
 	0x48, 0x89, 0xe8, // movq %rbp, %rax
@@ -258,6 +258,174 @@ static const RetCode RETV = {
 	0xc2, 0x00, 0x00 // retq ...
 };
 
+/*
+INTERP_LOADVAR and INTERP_LOADPARAM:
+  pushq ...(%rbp)
+*/
+
+typedef uchar LoadVarCode[6];
+
+static const LoadVarCode LOADVAR = {
+	0xff, 0x75, 0x00 // pushq ...(%rbp)
+};
+
+/*
+INTERP_STOREVAR and INTERP_STOREPARAM:
+  popq ...(%rbp)
+*/
+
+typedef uchar StoreVarCode[6];
+
+static const StoreVarCode STOREVAR = {
+	0x8f, 0x45, 0x00 // popq ...(%rbp)
+};
+
+/*
+INTERP_INCVAR:
+  incq ...(%rbp)
+*/
+
+typedef uchar IncVarCode[7];
+
+static const IncVarCode INCVAR = {
+	0x48, 0xff, 0x45, 0x00 // incq ...(%rbp)
+};
+
+/*
+INTERP_ADDISTORE of a var to itself:
+  addq ..., ...(%rbp)
+*/
+
+typedef uchar AddVarCode[11];
+
+static const AddVarCode ADDVAR = {
+	0x48, 0x81, 0x45, 0x00 // addq ..., ...(%rbp)
+};
+
+/*
+INTERP_ADDVARS of a var and another to the first:
+  movq ...(%rbp), %rax
+  addq %rax, ...(%rbp)
+*/
+
+typedef uchar AddVarsCode[14];
+
+static const uchar LOADRAX[] = {
+	0x48, 0x8b, 0x45, 0x00 // movq ...(%rbp), %rax
+};
+
+static const uchar ADDRAX[] = {
+	0x48, 0x01, 0x45, 0x00 // addq %rax, ...(%rbp)
+};
+
+/*
+INTERP_ADDI:
+  addq ..., (%rsp)
+*/
+
+typedef uchar AddiCode[8];
+
+static const AddiCode ADDI = {
+	0x48, 0x81, 0x04, 0x24, 0x00, 0x00, 0x00, 0x00 // addq ..., (%rsp)
+};
+
+/*
+INTERP_MULI:
+  imulq ..., (%rsp), %rax
+  movq %rax, (%rsp)
+or, by 3, 5 and 9:
+  popq %rax
+  leaq (%rax, %rax, scale), %rax
+  pushq %rax
+*/
+
+typedef uchar MuliCode[12];
+
+static const MuliCode MULI = {
+	0x48, 0x69, 0x04, 0x24, 0x00, 0x00, 0x00, 0x00, // imulq ..., (%rsp), %rax
+	0x48, 0x89, 0x04, 0x24 // movq %rax, (%rsp)
+};
+
+static const MuliCode MULI_LEA = {
+	0x58, // popq %rax
+	0x48, 0x8D, 0x04, 0x00, // leaq (%rax, %rax, ...), %rax
+	0x50 // pushq %rax
+};
+
+/*
+INTERP_SHLI:
+  shlq ..., (%rsp)
+*/
+
+typedef uchar ShliCode[5];
+
+static const ShliCode SHLI = {
+	0x48, 0xC1, 0x24, 0x24, 0x00 // shlq ..., (%rsp)
+};
+
+/*
+INTERP_CALLPROC:
+  callq ...
+  pushq %rax
+*/
+
+typedef uchar CallProcCode[6];
+
+static const CallProcCode CALLPROC = {
+	0xe8, 0x00, 0x00, 0x00, 0x00, // callq ...
+	0x50 // pushq %rax
+};
+
+/*
+INTERP_CALLVPROC:
+  callq ...
+*/
+
+typedef uchar CallvProcCode[5];
+
+static const CallvProcCode CALLVPROC = {
+	0xe8, 0x00, 0x00, 0x00, 0x00 // callq ...
+};
+
+/*
+INTERP_TAILCALL and INTERP_TAILCALLV, the callee taking over the frame:
+  movq 8(%rbp), %r11
+  pushq (%rbp)
+  movq ...(%rsp), %rax     for each arg, the last first
+  movq %rax, ...(%rbp)
+  popq %rax
+  leaq ...(%rbp), %rsp
+  movq %r11, (%rsp)
+  movq %rax, %rbp
+  jmp ...
+the return address moves by the difference in params, and the args
+over the params, from the last as they only move up the stack; the
+code grows with the callee's params, so it has a buffer of its own
+*/
+
+static const uchar TAIL_ENTER[] = {
+	0x4c, 0x8b, 0x5d, 0x08, // movq 8(%rbp), %r11
+	0xff, 0x75, 0x00 // pushq (%rbp)
+};
+
+static const uchar TAIL_LOAD[] = {
+	0x48, 0x8b, 0x44, 0x24, 0x00 // movq ...(%rsp), %rax
+};
+
+static const uchar TAIL_STORE[] = {
+	0x48, 0x89, 0x45, 0x00 // movq %rax, ...(%rbp)
+};
+
+static const uchar TAIL_FRAME[] = {
+	0x58, // popq %rax
+	0x48, 0x8d, 0x65, 0x00 // leaq ...(%rbp), %rsp
+};
+
+static const uchar TAIL_JMP[] = {
+	0x4c, 0x89, 0x1c, 0x24, // movq %r11, (%rsp)
+	0x48, 0x89, 0xc5, // movq %rax, %rbp
+	0xe9, 0x00, 0x00, 0x00, 0x00 // jmp ...
+};
 
 typedef uchar PrologueCode[4];
 
@@ -269,6 +437,50 @@ static const PrologueCode PROLOGUE = {
 	0x48, 0x89, 0xe5 // mov %rsp, %rbp
 };
 
+/*
+ * Slots out of the reach of a byte take the 32 bit forms: imm32 with
+ * opcode 81 instead of 83 in VAR and PARAM, disp32 with mod 10 instead
+ * of 01 in the rest. Both return the size of the code.
+ */
+static inline size_t set_slot_imm(uchar* code, int imm) {
+	if ((imm >= -128) && (imm <= 127)) {
+		code[6] = (uchar) imm;
+		code[7] = 0x50;
+		return 8;
+	}
+	code[4] = 0x81;
+	memcpy(&code[6], &imm, sizeof(int));
+	code[10] = 0x50;
+	return 11;
+}
+
+/*
+ * The short forms of instructions ending in an imm32 at offset: the
+ * opcode at opcode becomes its imm8 sibling when imm fits a byte, and
+ * the rest of the code moves back over the three bytes saved.
+ */
+static inline size_t set_imm(uchar* code, size_t size, size_t opcode, uchar short_opcode,
+	size_t offset, int imm) {
+	if ((imm < -128) || (imm > 127)) {
+		memcpy(&code[offset], &imm, sizeof(int));
+		return size;
+	}
+	code[opcode] = short_opcode;
+	code[offset] = (uchar) imm;
+	memmove(&code[offset + 1], &code[offset + 4], size - (offset + 4));
+	return size - 3;
+}
+
+static inline size_t set_slot_disp(uchar* code, size_t modrm, int disp) {
+	if ((disp >= -128) && (disp <= 127)) {
+		code[modrm + 1] = (uchar) disp;
+		return modrm + 2;
+	}
+	code[modrm] += 0x40;
+	memcpy(&code[modrm + 1], &disp, sizeof(int));
+	return modrm + 5;
+}
+
 typedef struct JITInstr {
 	InterpOp        op;
 	size_t          code_size;
@@ -293,6 +505,17 @@ typedef struct JITInstr {
 		CallvCode   as_callv;
 		RetCode     as_ret;
 		RetCode     as_retv;
+		LoadVarCode    as_loadvar;
+		StoreVarCode   as_storevar;
+		IncVarCode     as_incvar;
+		AddVarCode     as_addvar;
+		AddVarsCode    as_addvars;
+		AddiCode       as_addi;
+		MuliCode       as_muli;
+		ShliCode       as_shli;
+		CallProcCode   as_callproc;
+		CallvProcCode  as_callvproc;
+		uchar*         as_tailcall;
 	} content;
 } JITInstr;
 
@@ -317,7 +540,90 @@ static inline int relative_disp(JITInstr* from, JITInstr* to) {
 	return (pc > to->rel_offset) ? -(pc - to->rel_offset) : to->rel_offset - pc;
 }
 
-static int compile_code(JITProc* jit_proc, InterpCode* code) {
+/*
+ * A var stepped in place, by a constant or by another var, takes one
+ * instruction on its slot instead of a round trip through the stack.
+ * The sequence is compiled by its first slot, the number of the others
+ * is returned.
+ */
+static int compile_step(JITInstr* jit_instr, InterpInstr* interp_instr) {
+	int var = -(8 * interp_instr->value + 8);
+	uchar* code;
+	size_t size;
+
+	if ((interp_instr->op == INTERP_ADDISTORE) && (interp_instr[2].value == interp_instr->value)) {
+		int value = interp_instr[1].value;
+		code = jit_instr->content.as_addvar;
+		memcpy(code, ADDVAR, sizeof(AddVarCode));
+		size = set_slot_disp(code, 2, var);
+		memcpy(&code[size], &value, sizeof(int));
+		jit_instr->code_size = set_imm(code, size + 4, 1, 0x83, size, value);
+		return 2;
+	}
+	if ((interp_instr->op == INTERP_ADDVARS) && (interp_instr[3].value == interp_instr->value)) {
+		code = jit_instr->content.as_addvars;
+		memcpy(code, LOADRAX, sizeof(LOADRAX));
+		size = set_slot_disp(code, 2, -(8 * interp_instr[1].value + 8));
+		memcpy(&code[size], ADDRAX, sizeof(ADDRAX));
+		jit_instr->code_size = size + set_slot_disp(&code[size], 2, var);
+		return 3;
+	}
+	return 0;
+}
+
+/* disp32 with mod 10 instead of 01 for an (%rsp) operand, whose SIB byte comes before the disp */
+static inline size_t set_stack_disp(uchar* code, size_t modrm, int disp) {
+	if ((disp >= -128) && (disp <= 127)) {
+		code[modrm + 2] = (uchar) disp;
+		return modrm + 3;
+	}
+	code[modrm] += 0x40;
+	memcpy(&code[modrm + 2], &disp, sizeof(int));
+	return modrm + 6;
+}
+
+/*
+ * A call in tail position jumps to the callee, which returns to the
+ * caller's caller. The number of the other slots of the sequence is
+ * returned, -1 when there is no memory for the code.
+ */
+static int compile_tail_call(JITInstr* jit_instr, InterpInstr* interp_instr, InterpProg* prog) {
+	int args = prog->procs[interp_instr->value].params;
+	uchar* code;
+	size_t size;
+	int ret, i;
+
+	if ((interp_instr->op != INTERP_TAILCALL) && (interp_instr->op != INTERP_TAILCALLV))
+		return 0;
+	code = (uchar*) malloc(sizeof(TAIL_ENTER) + 15 * args + sizeof(TAIL_FRAME) + 3 + sizeof(TAIL_JMP));
+	if (!code)
+		return -1;
+	ret = 8 + 8 * (interp_instr[1].value - args);
+	memcpy(code, TAIL_ENTER, sizeof(TAIL_ENTER));
+	size = sizeof(TAIL_ENTER);
+	for (i=args-1; i>=0; i--) {
+		memcpy(&code[size], TAIL_LOAD, sizeof(TAIL_LOAD));
+		size += set_stack_disp(&code[size], 2, 8 * i + 8);
+		memcpy(&code[size], TAIL_STORE, sizeof(TAIL_STORE));
+		size += set_slot_disp(&code[size], 2, ret + 8 + 8 * i);
+	}
+	memcpy(&code[size], TAIL_FRAME, sizeof(TAIL_FRAME));
+	size += 1 + set_slot_disp(&code[size + 1], 2, ret);
+	memcpy(&code[size], TAIL_JMP, sizeof(TAIL_JMP));
+	size += sizeof(TAIL_JMP);
+	memcpy(&code[size - 4], &interp_instr->value, sizeof(int));
+	jit_instr->op = interp_instr->op;
+	jit_instr->content.as_tailcall = code;
+	jit_instr->code_size = size;
+	return 1;
+}
+
+static inline int is_tail_call(JITInstr* jit_instr) {
+	return (jit_instr->op == INTERP_TAILCALL) || (jit_instr->op == INTERP_TAILCALLV);
+}
+
+static int compile_code(JITProc* jit_proc, InterpProg* prog, InterpCode* code) {
+	int fused = 0;
 	int i, ok;
 	size_t rel_offset;
 	JITInstr* instrs = jit_proc->instrs;
@@ -330,19 +636,25 @@ static int compile_code(JITProc* jit_proc, InterpCode* code) {
 		InterpInstr* interp_instr = &code->data[i];
 		JITInstr* jit_instr = &instrs[i];
 
-		jit_instr->op = interp_instr->op;
+		/* the slots of a superinstruction's sequence are compiled one by one */
+		jit_instr->op = base_op(interp_instr->op);
 		jit_instr->rel_offset = rel_offset;
+		if (fused) {
+			/* compiled with the first slot of the sequence */
+			jit_instr->code_size = 0;
+			fused--;
+			continue;
+		}
 
-		switch (interp_instr->op) {
+		switch (jit_instr->op) {
 		case INTERP_INVALID:
 			ok = 0;
 			break;
-		case INTERP_PUSH: {
+		case INTERP_PUSH:
 			memcpy(&jit_instr->content.as_push, PUSH, sizeof(PushCode));
-			*((long*)&jit_instr->content.as_push[2]) = interp_instr->value;
-			jit_instr->code_size = sizeof(PushCode);
+			jit_instr->code_size = set_imm(jit_instr->content.as_push, sizeof(PushCode), 0, 0x6A,
+				1, interp_instr->value);
 			break;
-		}
 		case INTERP_POP:
 			memcpy(&jit_instr->content.as_pop, POP, sizeof(PopCode));
 			jit_instr->code_size = sizeof(PopCode);
@@ -357,13 +669,11 @@ static int compile_code(JITProc* jit_proc, InterpCode* code) {
 			break;
 		case INTERP_VAR:
 			memcpy(&jit_instr->content.as_var, VAR, sizeof(VarCode));
-			jit_instr->content.as_var[6] = (uchar) + (8 * interp_instr->value + 8);
-			jit_instr->code_size = sizeof(VarCode);
+			jit_instr->code_size = set_slot_imm(jit_instr->content.as_var, 8 * interp_instr->value + 8);
 			break;
 		case INTERP_PARAM:
 			memcpy(&jit_instr->content.as_param, PARAM, sizeof(ParamCode));
-			jit_instr->content.as_param[6] = (uchar) + (8 * interp_instr->value + 16);
-			jit_instr->code_size = sizeof(ParamCode);
+			jit_instr->code_size = set_slot_imm(jit_instr->content.as_param, 8 * interp_instr->value + 16);
 			break;
 		case INTERP_PROC:
 			memcpy(&jit_instr->content.as_proc, PROC, sizeof(ProcCode));
@@ -416,6 +726,72 @@ static int compile_code(JITProc* jit_proc, InterpCode* code) {
 			*((short*)&jit_instr->content.as_ret[5]) = (short) 8 * interp_instr->value;
 			jit_instr->code_size = sizeof(RetvCode);
 			break;
+		case INTERP_LOADVAR:
+			fused = compile_step(jit_instr, interp_instr);
+			if (fused)
+				break;
+			memcpy(&jit_instr->content.as_loadvar, LOADVAR, sizeof(LoadVarCode));
+			jit_instr->code_size = set_slot_disp(jit_instr->content.as_loadvar, 1, -(8 * interp_instr->value + 8));
+			break;
+		case INTERP_LOADPARAM:
+			memcpy(&jit_instr->content.as_loadvar, LOADVAR, sizeof(LoadVarCode));
+			jit_instr->code_size = set_slot_disp(jit_instr->content.as_loadvar, 1, 8 * interp_instr->value + 16);
+			break;
+		case INTERP_STOREVAR:
+			memcpy(&jit_instr->content.as_storevar, STOREVAR, sizeof(StoreVarCode));
+			jit_instr->code_size = set_slot_disp(jit_instr->content.as_storevar, 1, -(8 * interp_instr->value + 8));
+			break;
+		case INTERP_STOREPARAM:
+			memcpy(&jit_instr->content.as_storevar, STOREVAR, sizeof(StoreVarCode));
+			jit_instr->code_size = set_slot_disp(jit_instr->content.as_storevar, 1, 8 * interp_instr->value + 16);
+			break;
+		case INTERP_INCVAR:
+			memcpy(&jit_instr->content.as_incvar, INCVAR, sizeof(IncVarCode));
+			jit_instr->code_size = set_slot_disp(jit_instr->content.as_incvar, 2, -(8 * interp_instr->value + 8));
+			break;
+		case INTERP_ADDI:
+			memcpy(&jit_instr->content.as_addi, ADDI, sizeof(AddiCode));
+			jit_instr->code_size = set_imm(jit_instr->content.as_addi, sizeof(AddiCode), 1, 0x83,
+				4, interp_instr->value);
+			break;
+		case INTERP_MULI: {
+			int value = interp_instr->value;
+			if ((value == 3) || (value == 5) || (value == 9)) {
+				memcpy(&jit_instr->content.as_muli, MULI_LEA, sizeof(MuliCode));
+				jit_instr->content.as_muli[4] = (value == 3) ? 0x40 : (value == 5) ? 0x80 : 0xC0;
+				jit_instr->code_size = 6;
+			} else {
+				memcpy(&jit_instr->content.as_muli, MULI, sizeof(MuliCode));
+				jit_instr->code_size = set_imm(jit_instr->content.as_muli, sizeof(MuliCode), 1, 0x6B,
+					4, value);
+			}
+			break;
+		}
+		case INTERP_SHLI:
+			memcpy(&jit_instr->content.as_shli, SHLI, sizeof(ShliCode));
+			jit_instr->content.as_shli[4] = (uchar) interp_instr->value;
+			jit_instr->code_size = sizeof(ShliCode);
+			break;
+		case INTERP_CALLPROC:
+			fused = compile_tail_call(jit_instr, interp_instr, prog);
+			if (fused < 0)
+				ok = 0;
+			if (fused)
+				break;
+			memcpy(&jit_instr->content.as_callproc, CALLPROC, sizeof(CallProcCode));
+			*((int*)&jit_instr->content.as_callproc[1]) = interp_instr->value;
+			jit_instr->code_size = sizeof(CallProcCode);
+			break;
+		case INTERP_CALLVPROC:
+			fused = compile_tail_call(jit_instr, interp_instr, prog);
+			if (fused < 0)
+				ok = 0;
+			if (fused)
+				break;
+			memcpy(&jit_instr->content.as_callvproc, CALLVPROC, sizeof(CallvProcCode));
+			*((int*)&jit_instr->content.as_callvproc[1]) = interp_instr->value;
+			jit_instr->code_size = sizeof(CallvProcCode);
+			break;
 		default:
 			assert(0);
 			ok = 0;
@@ -470,8 +846,14 @@ static inline int init_context(JITContext* ctx, InterpProg* interp_prog) {
 }
 
 static inline void destroy_proc(JITProc* proc) {
-	if (proc)
-		free(proc->instrs);
+	int i;
+
+	if (!proc || !proc->instrs)
+		return;
+	for (i=0; i<proc->instr_count; i++)
+		if (is_tail_call(&proc->instrs[i]))
+			free(proc->instrs[i].content.as_tailcall);
+	free(proc->instrs);
 }
 
 static inline void destroy_context(JITContext* ctx) {
@@ -487,7 +869,7 @@ static inline int compile(JITContext* ctx, InterpProg* interp_prog) {
 
 	for (i=0; ok && (i<ctx->proc_count); i++) {
 		JITProc* jit_proc = &ctx->procs[i];
-		if (compile_code(jit_proc, &interp_prog->procs[i]))
+		if (compile_code(jit_proc, interp_prog, &interp_prog->procs[i]))
 			ctx->code_size += jit_proc->code_size;
 		else 
 			ok = 0;
@@ -508,6 +890,19 @@ static inline void link_proc(JITContext* ctx, JITProc* proc) {
 			long id = *((long*)&jit_instr->content.as_proc[2]);
 			*((size_t*)&jit_instr->content.as_proc[2]) = ctx->procs[id].abs_offset;
 		}
+
+		/* callq takes a displacement from the end of its 5 bytes */
+		if ((jit_instr->op == INTERP_CALLPROC) || (jit_instr->op == INTERP_CALLVPROC)) {
+			int id = *((int*)&jit_instr->content.as_callproc[1]);
+			*((int*)&jit_instr->content.as_callproc[1]) =
+				(int) (ctx->procs[id].abs_offset - (jit_instr->abs_offset + 5));
+		}
+
+		/* and jmp, ending a tail call, from the end of its code */
+		if (is_tail_call(jit_instr)) {
+			int* rel = (int*) &jit_instr->content.as_tailcall[jit_instr->code_size - 4];
+			*rel = (int) (ctx->procs[*rel].abs_offset - (jit_instr->abs_offset + jit_instr->code_size));
+		}
 	}
 }
 
@@ -529,7 +924,10 @@ static inline void dump_proc(JITProc* jit_proc) {
 	for (i=0; i<jit_proc->instr_count; i++) {
 		JITInstr* jit_instr = &jit_proc->instrs[i];
 		void* addrs = (void*)jit_instr->abs_offset;
-		memcpy(addrs, &jit_instr->content, jit_instr->code_size);
+		if (is_tail_call(jit_instr))
+			memcpy(addrs, jit_instr->content.as_tailcall, jit_instr->code_size);
+		else
+			memcpy(addrs, &jit_instr->content, jit_instr->code_size);
 	}
 }
 
@@ -572,3 +970,712 @@ int eval_jit(InterpProg* interp_prog, int* result) {
 	return ok;
 
 }
+
+/*
+ * Optimizing tier: machine code for the register allocated SSA form. Each
+ * procedure saves the registers it allocates, so values live across
+ * calls stay in registers; args are still pushed last first and popped
+ * by the callee. Arithmetic is 32 bit, like the interpreter's.
+ */
+
+#define RAX   0
+#define RSP   4
+#define RBP   5
+#define R11   11
+
+/* rax and r11 are scratch */
+static const uchar MACHINE_REGS[SSA_REGS] = { 3, 1, 2, 6, 7, 8, 9, 10, 12, 13, 14, 15 };
+
+typedef enum OperandKind {
+	OPERAND_REG,
+	OPERAND_MEM,    /* disp(%rbp) */
+	OPERAND_IMM
+} OperandKind;
+
+typedef struct Operand {
+	OperandKind  kind;
+	int          value;
+} Operand;
+
+typedef struct Move {
+	Operand  dst;
+	Operand  src;
+} Move;
+
+/* a rel32 at offset, to a block of the procedure being emitted or to a procedure */
+typedef struct Fixup {
+	size_t  offset;
+	int     target;
+} Fixup;
+
+typedef struct SsaJit {
+	int      ok;
+	uchar*   code;
+	size_t   size;
+	size_t   capacity;
+	size_t*  proc_offsets;
+	size_t*  block_offsets;
+	Fixup*   jumps;
+	int      jump_count;
+	int      jump_capacity;
+	Fixup*   calls;
+	int      call_count;
+	int      call_capacity;
+	Move*    moves;
+	int      move_capacity;
+} SsaJit;
+
+static int grow_array(void** data, int* capacity, int count, size_t size) {
+	int new_capacity = *capacity ? *capacity : 16;
+	void* new_data;
+
+	if (count <= *capacity)
+		return 1;
+	while (new_capacity < count)
+		new_capacity *= 2;
+	new_data = realloc(*data, new_capacity * size);
+	if (!new_data)
+		return 0;
+	*data = new_data;
+	*capacity = new_capacity;
+	return 1;
+}
+
+static void put(SsaJit* jit, uchar byte) {
+	if (jit->size == jit->capacity) {
+		size_t capacity = jit->capacity ? 2 * jit->capacity : 4096;
+		uchar* code = (uchar*) realloc(jit->code, capacity);
+		if (!code) {
+			jit->ok = 0;
+			return;
+		}
+		jit->code = code;
+		jit->capacity = capacity;
+	}
+	jit->code[jit->size++] = byte;
+}
+
+static void put32(SsaJit* jit, int value) {
+	int i;
+	for (i=0; i<4; i++)
+		put(jit, (uchar) ((unsigned) value >> (8 * i)));
+}
+
+static inline void patch32(SsaJit* jit, size_t offset, int value) {
+	if (jit->ok)
+		memcpy(&jit->code[offset], &value, 4);
+}
+
+static inline int is_imm8(int value) {
+	return (value >= -128) && (value <= 127);
+}
+
+static inline Operand reg_operand(int reg) {
+	Operand operand = { OPERAND_REG, reg };
+	return operand;
+}
+
+static inline int same_operand(Operand a, Operand b) {
+	return (a.kind == b.kind) && (a.value == b.value);
+}
+
+/* REX, opcode and ModRM for reg and a register or disp(%rbp) rm */
+static void put_op(SsaJit* jit, int wide, const uchar* opcode, int length, int reg, Operand rm) {
+	int base = (rm.kind == OPERAND_REG) ? rm.value : RBP;
+	uchar rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+	int i;
+
+	if (rex != 0x40)
+		put(jit, rex);
+	for (i=0; i<length; i++)
+		put(jit, opcode[i]);
+	if (rm.kind == OPERAND_REG)
+		put(jit, 0xC0 | ((reg & 7) << 3) | (base & 7));
+	else if (is_imm8(rm.value)) {
+		put(jit, 0x45 | ((reg & 7) << 3));
+		put(jit, (uchar) rm.value);
+	} else {
+		put(jit, 0x85 | ((reg & 7) << 3));
+		put32(jit, rm.value);
+	}
+}
+
+static inline void put_op1(SsaJit* jit, uchar opcode, int reg, Operand rm) {
+	put_op(jit, 0, &opcode, 1, reg, rm);
+}
+
+/* push or pop %reg */
+static inline void put_stack_op(SsaJit* jit, uchar opcode, int reg) {
+	if (reg & 8)
+		put(jit, 0x41);
+	put(jit, opcode + (reg & 7));
+}
+
+/* dst := src, dst a register or a frame slot */
+static void emit_move(SsaJit* jit, Operand dst, Operand src) {
+	if (same_operand(dst, src))
+		return;
+	if (dst.kind == OPERAND_REG) {
+		if (src.kind != OPERAND_IMM)
+			put_op1(jit, 0x8B, dst.value, src);             // movl src, %dst
+		else if (src.value == 0)
+			put_op1(jit, 0x31, dst.value, dst);             // xorl %dst, %dst
+		else {
+			put_stack_op(jit, 0xB8, dst.value);             // movl $imm, %dst
+			put32(jit, src.value);
+		}
+	} else if (src.kind == OPERAND_REG)
+		put_op1(jit, 0x89, src.value, dst);                 // movl %src, disp(%rbp)
+	else if (src.kind == OPERAND_IMM) {
+		put_op1(jit, 0xC7, 0, dst);                         // movl $imm, disp(%rbp)
+		put32(jit, src.value);
+	} else {
+		put_op1(jit, 0x8B, R11, src);
+		put_op1(jit, 0x89, R11, dst);
+	}
+}
+
+/* reg op= src, for add (0x03, /0), sub (0x2B, /5) and cmp (0x3B, /7) */
+static void emit_alu(SsaJit* jit, uchar opcode, int digit, int reg, Operand src) {
+	if (src.kind != OPERAND_IMM)
+		put_op1(jit, opcode, reg, src);
+	else if (is_imm8(src.value)) {
+		put_op1(jit, 0x83, digit, reg_operand(reg));
+		put(jit, (uchar) src.value);
+	} else {
+		put_op1(jit, 0x81, digit, reg_operand(reg));
+		put32(jit, src.value);
+	}
+}
+
+static inline Operand operand_of(SsaProc* proc, int value) {
+	Operand operand;
+	if (proc->instrs[value].op == SSA_CONST) {
+		operand.kind = OPERAND_IMM;
+		operand.value = proc->instrs[value].imm;
+	} else if (proc->locs[value].reg != SSA_NO_REG) {
+		operand.kind = OPERAND_REG;
+		operand.value = MACHINE_REGS[proc->locs[value].reg];
+	} else {
+		operand.kind = OPERAND_MEM;
+		operand.value = proc->locs[value].disp;
+	}
+	return operand;
+}
+
+/* leal disp(%base, %index, scale), %reg, without an index when index < 0 */
+static void put_lea(SsaJit* jit, int reg, int base, int index, int scale, int disp) {
+	uchar rex = 0x40 | ((reg & 8) ? 4 : 0) | (((index >= 0) && (index & 8)) ? 2 : 0) | ((base & 8) ? 1 : 0);
+	int sib = (index >= 0) || ((base & 7) == RSP);
+	int mod = ((disp == 0) && ((base & 7) != RBP)) ? 0 : is_imm8(disp) ? 1 : 2;
+	int ss = 0;
+
+	while ((1 << ss) < scale)
+		ss++;
+	if (rex != 0x40)
+		put(jit, rex);
+	put(jit, 0x8D);
+	put(jit, (mod << 6) | ((reg & 7) << 3) | (sib ? 4 : (base & 7)));
+	if (sib)
+		put(jit, (ss << 6) | ((((index >= 0) ? index : RSP) & 7) << 3) | (base & 7));
+	if (mod == 1)
+		put(jit, (uchar) disp);
+	else if (mod == 2)
+		put32(jit, disp);
+}
+
+/*
+ * Three address forms where lea does it in one instruction: a sum into
+ * another register, and a register times 3, 5 or 9. 0 when it does not
+ * apply and emit_binary goes on with the two address ones.
+ */
+static int emit_lea(SsaJit* jit, SsaInstr* instr, Operand a, Operand b, int reg) {
+	if (a.kind != OPERAND_REG)
+		return 0;
+	if ((instr->op == SSA_ADD) && (b.kind == OPERAND_IMM) && (a.value != reg))
+		put_lea(jit, reg, a.value, -1, 1, b.value);
+	else if ((instr->op == SSA_ADD) && (b.kind == OPERAND_REG) && (a.value != reg) && (b.value != reg))
+		put_lea(jit, reg, a.value, b.value, 1, 0);
+	else if ((instr->op == SSA_MUL) && (b.kind == OPERAND_IMM)
+		&& ((b.value == 3) || (b.value == 5) || (b.value == 9)))
+		put_lea(jit, reg, a.value, a.value, b.value - 1, 0);
+	else
+		return 0;
+	return 1;
+}
+
+static inline int power_of_two(int value) {
+	int shift = 0;
+	if ((value <= 0) || (value & (value - 1)))
+		return -1;
+	while ((1 << shift) != value)
+		shift++;
+	return shift;
+}
+
+/* two address forms, in %rax when dst is a frame slot or would clobber b */
+static void emit_binary(SsaJit* jit, SsaProc* proc, SsaInstr* instr, Operand dst) {
+	static const uchar IMUL[2] = { 0x0F, 0xAF };
+	Operand a = operand_of(proc, ssa_arg(proc, instr, 0));
+	Operand b = operand_of(proc, ssa_arg(proc, instr, 1));
+	int reg = (dst.kind == OPERAND_REG) ? dst.value : RAX;
+	int shift;
+
+	if ((instr->op != SSA_SUB) && ((a.kind == OPERAND_IMM) || same_operand(b, reg_operand(reg)))) {
+		Operand swap = a;
+		a = b;
+		b = swap;
+	}
+	if (emit_lea(jit, instr, a, b, reg)) {
+		emit_move(jit, dst, reg_operand(reg));
+		return;
+	}
+	shift = ((instr->op == SSA_MUL) && (b.kind == OPERAND_IMM)) ? power_of_two(b.value) : -1;
+	if (shift > 0) {
+		emit_move(jit, reg_operand(reg), a);
+		put_op1(jit, 0xC1, 4, reg_operand(reg));                 // shll $shift, %reg
+		put(jit, (uchar) shift);
+	} else if ((instr->op == SSA_MUL) && (b.kind == OPERAND_IMM)) {
+		if (a.kind == OPERAND_IMM) {
+			emit_move(jit, reg_operand(reg), a);
+			a = reg_operand(reg);
+		}
+		put_op1(jit, is_imm8(b.value) ? 0x6B : 0x69, reg, a);    // imull $imm, a, %reg
+		if (is_imm8(b.value))
+			put(jit, (uchar) b.value);
+		else
+			put32(jit, b.value);
+	} else {
+		if (same_operand(b, reg_operand(reg)) && !same_operand(a, reg_operand(reg)))
+			reg = RAX;
+		emit_move(jit, reg_operand(reg), a);
+		if (instr->op == SSA_MUL)
+			put_op(jit, 0, IMUL, 2, reg, b);                     // imull b, %reg
+		else if (instr->op == SSA_ADD)
+			emit_alu(jit, 0x03, 0, reg, b);
+		else
+			emit_alu(jit, 0x2B, 5, reg, b);
+	}
+	emit_move(jit, dst, reg_operand(reg));
+}
+
+/* args last first, as the callee pops them */
+static void emit_args(SsaJit* jit, SsaProc* proc, SsaInstr* instr) {
+	int i;
+
+	for (i=instr->arg_count-1; i>=0; i--) {
+		Operand arg = operand_of(proc, ssa_arg(proc, instr, i));
+		if (arg.kind == OPERAND_REG)
+			put_stack_op(jit, 0x50, arg.value);                  // pushq %reg
+		else if (arg.kind == OPERAND_MEM)
+			put_op1(jit, 0xFF, 6, arg);                          // pushq disp(%rbp)
+		else if (is_imm8(arg.value)) {
+			put(jit, 0x6A);
+			put(jit, (uchar) arg.value);
+		} else {
+			put(jit, 0x68);
+			put32(jit, arg.value);
+		}
+	}
+}
+
+/* the rel32 of a call or jmp to proc, patched once all are emitted */
+static void put_proc_rel32(SsaJit* jit, int proc) {
+	if (grow_array((void**) &jit->calls, &jit->call_capacity, jit->call_count + 1, sizeof(Fixup))) {
+		jit->calls[jit->call_count].offset = jit->size;
+		jit->calls[jit->call_count++].target = proc;
+	} else
+		jit->ok = 0;
+	put32(jit, 0);
+}
+
+static void emit_call(SsaJit* jit, SsaProc* proc, SsaInstr* instr, Operand dst) {
+	emit_args(jit, proc, instr);
+	put(jit, 0xE8);                                              // callq proc
+	put_proc_rel32(jit, instr->imm);
+	if (instr->op == SSA_CALL)
+		emit_move(jit, dst, reg_operand(RAX));
+}
+
+/* the RET or RETV right after the call at v that returns what it does, -1 if none */
+static int tail_return(SsaProc* proc, SsaBlock* block, int v) {
+	SsaInstr* call = &proc->instrs[v];
+	SsaInstr* ret;
+	int next;
+
+	for (next=v+1; next<block->first+block->count; next++)
+		if ((proc->instrs[next].op != SSA_INVALID) && (proc->instrs[next].op != SSA_CONST))
+			break;
+	if (next == block->first + block->count)
+		return -1;
+	ret = &proc->instrs[next];
+	if ((call->op == SSA_CALL) && (ret->op == SSA_RET) && (ssa_arg(proc, ret, 0) == v))
+		return next;
+	if ((call->op == SSA_CALLV) && (ret->op == SSA_RETV))
+		return next;
+	return -1;
+}
+
+/*
+ * A call in tail position jumps to the callee, which returns to our
+ * caller: the saved registers are restored from their slots, then the
+ * return address moves by the difference in params and the args over
+ * the params, from the last as they only move up the stack.
+ */
+static void emit_tail_call(SsaJit* jit, SsaProc* proc, SsaInstr* instr) {
+	static const uchar LOAD = 0x8B, STORE = 0x89, LEA = 0x8D;
+	Operand ret = { OPERAND_MEM, 8 + 8 * (proc->params - instr->arg_count) };
+	Operand ret_addr = { OPERAND_MEM, 8 };
+	Operand saved_rbp = { OPERAND_MEM, 0 };
+	int saved = 0;
+	int i;
+
+	emit_args(jit, proc, instr);
+	for (i=0; i<SSA_REGS; i++)
+		if ((proc->used_regs >> i) & 1) {
+			Operand slot = { OPERAND_MEM, -8 * (proc->spill_count + ++saved) };
+			put_op(jit, 1, &LOAD, 1, MACHINE_REGS[i], slot);     // movq slot, %reg
+		}
+	put_op(jit, 1, &LOAD, 1, R11, ret_addr);                     // movq 8(%rbp), %r11
+	put_op1(jit, 0xFF, 6, saved_rbp);                            // pushq (%rbp)
+	for (i=instr->arg_count-1; i>=0; i--) {
+		Operand param = { OPERAND_MEM, ret.value + 8 + 8 * i };
+		put(jit, 0x48);                                          // movq disp(%rsp), %rax
+		put(jit, 0x8B);
+		if (is_imm8(8 * i + 8)) {
+			put(jit, 0x44);
+			put(jit, 0x24);
+			put(jit, (uchar) (8 * i + 8));
+		} else {
+			put(jit, 0x84);
+			put(jit, 0x24);
+			put32(jit, 8 * i + 8);
+		}
+		put_op(jit, 1, &STORE, 1, RAX, param);                   // movq %rax, param
+	}
+	put(jit, 0x58);                                              // popq %rax
+	put_op(jit, 1, &LEA, 1, RSP, ret);                           // leaq ret, %rsp
+	put(jit, 0x4C);                                              // movq %r11, (%rsp)
+	put(jit, 0x89);
+	put(jit, 0x1C);
+	put(jit, 0x24);
+	put_op(jit, 1, &STORE, 1, RAX, reg_operand(RBP));            // movq %rax, %rbp
+	put(jit, 0xE9);                                              // jmp proc
+	put_proc_rel32(jit, instr->imm);
+}
+
+/* sets the sign flag to that of arg 0 - arg 1, or of arg 0 for SSA_JLTZ */
+static void emit_compare(SsaJit* jit, SsaProc* proc, SsaInstr* instr) {
+	Operand a = operand_of(proc, ssa_arg(proc, instr, 0));
+	Operand b;
+
+	if (instr->op == SSA_JLTZ) {
+		if (a.kind == OPERAND_MEM) {
+			put_op1(jit, 0x83, 7, a);                            // cmpl $0, disp(%rbp)
+			put(jit, 0);
+			return;
+		}
+		if (a.kind == OPERAND_IMM) {
+			emit_move(jit, reg_operand(RAX), a);
+			a = reg_operand(RAX);
+		}
+		put_op1(jit, 0x85, a.value, a);                          // testl %a, %a
+		return;
+	}
+	b = operand_of(proc, ssa_arg(proc, instr, 1));
+	if ((a.kind == OPERAND_MEM) && (b.kind == OPERAND_REG)) {
+		put_op1(jit, 0x39, b.value, a);                          // cmpl %b, disp(%rbp)
+		return;
+	}
+	if (a.kind != OPERAND_REG) {
+		emit_move(jit, reg_operand(RAX), a);
+		a = reg_operand(RAX);
+	}
+	emit_alu(jit, 0x3B, 7, a.value, b);
+}
+
+static void emit_parallel_moves(SsaJit* jit, Move* moves, int count) {
+	int i, k;
+
+	for (i=0; i<count; )
+		if (same_operand(moves[i].dst, moves[i].src))
+			moves[i] = moves[--count];
+		else
+			i++;
+	while (count) {
+		for (i=0; i<count; i++) {
+			for (k=0; k<count; k++)
+				if ((k != i) && same_operand(moves[k].src, moves[i].dst))
+					break;
+			if (k == count)
+				break;
+		}
+		if (i < count) {
+			emit_move(jit, moves[i].dst, moves[i].src);
+			moves[i] = moves[--count];
+		} else {
+			/* a cycle: the value of a destination moves to %rax first */
+			Operand dst = moves[0].dst;
+			emit_move(jit, reg_operand(RAX), dst);
+			for (k=0; k<count; k++)
+				if (same_operand(moves[k].src, dst))
+					moves[k].src = reg_operand(RAX);
+		}
+	}
+}
+
+static int phi_count(SsaProc* proc, int b) {
+	SsaBlock* block = &proc->blocks[b];
+	int count = 0;
+	int v;
+	for (v=block->first; v<block->first+block->count; v++)
+		if (proc->instrs[v].op == SSA_PHI)
+			count++;
+	return count;
+}
+
+/* the phis of block to take their args from pred */
+static void emit_edge_moves(SsaJit* jit, SsaProc* proc, int pred, int to) {
+	SsaBlock* block = &proc->blocks[to];
+	int index, count, v;
+
+	for (index=0; index<block->pred_count; index++)
+		if (proc->preds[block->preds + index] == pred)
+			break;
+	if (!grow_array((void**) &jit->moves, &jit->move_capacity, phi_count(proc, to), sizeof(Move))) {
+		jit->ok = 0;
+		return;
+	}
+	count = 0;
+	for (v=block->first; v<block->first+block->count; v++) {
+		SsaInstr* instr = &proc->instrs[v];
+		if (instr->op != SSA_PHI)
+			continue;
+		jit->moves[count].dst = operand_of(proc, v);
+		jit->moves[count].src = operand_of(proc, ssa_arg(proc, instr, index));
+		count++;
+	}
+	emit_parallel_moves(jit, jit->moves, count);
+}
+
+/* rel32 to block target, patched once the procedure is done */
+static void emit_jump(SsaJit* jit, uchar opcode, int target) {
+	if (opcode != 0xE9)
+		put(jit, 0x0F);
+	put(jit, opcode);
+	if (grow_array((void**) &jit->jumps, &jit->jump_capacity, jit->jump_count + 1, sizeof(Fixup))) {
+		jit->jumps[jit->jump_count].offset = jit->size;
+		jit->jumps[jit->jump_count++].target = target;
+	} else
+		jit->ok = 0;
+	put32(jit, 0);
+}
+
+static void emit_prologue(SsaJit* jit, SsaProc* proc) {
+	static const uchar ENTER[4] = { 0x55, 0x48, 0x89, 0xE5 };  // push %rbp; mov %rsp, %rbp
+	int i;
+
+	for (i=0; i<4; i++)
+		put(jit, ENTER[i]);
+	if (proc->spill_count) {
+		put(jit, 0x48);                                          // subq $spills, %rsp
+		put(jit, 0x81);
+		put(jit, 0xEC);
+		put32(jit, 8 * proc->spill_count);
+	}
+	for (i=0; i<SSA_REGS; i++)
+		if ((proc->used_regs >> i) & 1)
+			put_stack_op(jit, 0x50, MACHINE_REGS[i]);
+}
+
+static void emit_epilogue(SsaJit* jit, SsaProc* proc) {
+	int i;
+	for (i=SSA_REGS-1; i>=0; i--)
+		if ((proc->used_regs >> i) & 1)
+			put_stack_op(jit, 0x58, MACHINE_REGS[i]);
+	put(jit, 0xC9);                                              // leave
+	put(jit, 0xC2);                                              // retq $params
+	put(jit, (uchar) (8 * proc->params));
+	put(jit, (uchar) ((8 * proc->params) >> 8));
+}
+
+/* the next reachable block, where falling through goes */
+static inline int layout_next(SsaProc* proc, int b) {
+	for (b++; (b < proc->block_count) && !proc->blocks[b].reachable; b++)
+		;
+	return b;
+}
+
+static void emit_branch(SsaJit* jit, SsaProc* proc, int b, SsaInstr* instr) {
+	SsaBlock* block = &proc->blocks[b];
+
+	emit_compare(jit, proc, instr);
+	if (!phi_count(proc, block->target))
+		emit_jump(jit, 0x88, block->target);                     // js target
+	else {
+		size_t skip;
+		put(jit, 0x0F);                                          // jns skip
+		put(jit, 0x89);
+		skip = jit->size;
+		put32(jit, 0);
+		emit_edge_moves(jit, proc, b, block->target);
+		emit_jump(jit, 0xE9, block->target);
+		patch32(jit, skip, (int) (jit->size - (skip + 4)));
+	}
+}
+
+/*
+ * The branch of block b when the block does nothing else, so a back edge
+ * to it can repeat the test and jump straight into the loop body.
+ */
+static SsaInstr* loop_test(SsaProc* proc, int b) {
+	SsaBlock* block = &proc->blocks[b];
+	SsaInstr* test = NULL;
+	int v;
+
+	for (v=block->first; v<block->first+block->count; v++) {
+		SsaInstr* instr = &proc->instrs[v];
+		if ((instr->op == SSA_JLT) || (instr->op == SSA_JLTZ))
+			test = instr;
+		else if ((instr->op != SSA_INVALID) && (instr->op != SSA_PHI) && (instr->op != SSA_CONST))
+			return NULL;
+	}
+	if (!test || (block->next < 0) || phi_count(proc, block->next) || phi_count(proc, block->target))
+		return NULL;
+	return test;
+}
+
+static void emit_proc(SsaJit* jit, SsaProc* proc) {
+	int b, v, i;
+
+	jit->jump_count = 0;
+	emit_prologue(jit, proc);
+	for (b=0; b<proc->block_count; b++) {
+		SsaBlock* block = &proc->blocks[b];
+		int falls = 1;
+
+		jit->block_offsets[b] = jit->size;
+		if (!block->reachable)
+			continue;
+		for (v=block->first; v<block->first+block->count; v++) {
+			SsaInstr* instr = &proc->instrs[v];
+			Operand dst = operand_of(proc, v);
+
+			switch (instr->op) {
+			case SSA_PARAM:
+				if (dst.kind == OPERAND_REG) {
+					Operand param = { OPERAND_MEM, SSA_PARAM_DISP(instr->imm) };
+					emit_move(jit, dst, param);
+				}
+				break;
+			case SSA_COPY:
+				emit_move(jit, dst, operand_of(proc, ssa_arg(proc, instr, 0)));
+				break;
+			case SSA_ADD:
+			case SSA_MUL:
+			case SSA_SUB:
+				emit_binary(jit, proc, instr, dst);
+				break;
+			case SSA_CALL:
+			case SSA_CALLV: {
+				int ret = tail_return(proc, block, v);
+				if (ret < 0) {
+					emit_call(jit, proc, instr, dst);
+					break;
+				}
+				emit_tail_call(jit, proc, instr);
+				v = ret;
+				falls = 0;
+				break;
+			}
+			case SSA_JMP: {
+				SsaBlock* head = &proc->blocks[block->target];
+				SsaInstr* test = (block->target <= b) ? loop_test(proc, block->target) : NULL;
+
+				emit_edge_moves(jit, proc, b, block->target);
+				if (test) {
+					emit_compare(jit, proc, test);
+					emit_jump(jit, 0x89, head->next);            // jns body
+					if (head->target != layout_next(proc, b))
+						emit_jump(jit, 0xE9, head->target);
+				} else if (block->target != layout_next(proc, b))
+					emit_jump(jit, 0xE9, block->target);
+				falls = 0;
+				break;
+			}
+			case SSA_JLT:
+			case SSA_JLTZ:
+				emit_branch(jit, proc, b, instr);
+				break;
+			case SSA_RET:
+				emit_move(jit, reg_operand(RAX), operand_of(proc, ssa_arg(proc, instr, 0)));
+				/* fall through */
+			case SSA_RETV:
+				emit_epilogue(jit, proc);
+				falls = 0;
+				break;
+			default:
+				break;
+			}
+		}
+		if (falls && (block->next >= 0)) {
+			emit_edge_moves(jit, proc, b, block->next);
+			if (block->next != layout_next(proc, b))
+				emit_jump(jit, 0xE9, block->next);
+		}
+	}
+	for (i=0; i<jit->jump_count; i++) {
+		Fixup* jump = &jit->jumps[i];
+		patch32(jit, jump->offset, (int) (jit->block_offsets[jump->target] - (jump->offset + 4)));
+	}
+}
+
+static int emit_prog(SsaJit* jit, SsaProg* prog) {
+	int block_capacity = 0;
+	int i;
+
+	jit->ok = 1;
+	jit->proc_offsets = (size_t*) malloc(prog->proc_count * sizeof(size_t));
+	if (!jit->proc_offsets)
+		return 0;
+	for (i=0; jit->ok && (i<prog->proc_count); i++) {
+		SsaProc* proc = &prog->procs[i];
+		if (!grow_array((void**) &jit->block_offsets, &block_capacity, proc->block_count, sizeof(size_t)))
+			return 0;
+		jit->proc_offsets[i] = jit->size;
+		if (proc->block_count)
+			emit_proc(jit, proc);
+	}
+	for (i=0; jit->ok && (i<jit->call_count); i++) {
+		Fixup* call = &jit->calls[i];
+		patch32(jit, call->offset, (int) (jit->proc_offsets[call->target] - (call->offset + 4)));
+	}
+	return jit->ok;
+}
+
+static void destroy_ssa_jit(SsaJit* jit) {
+	free(jit->code);
+	free(jit->proc_offsets);
+	free(jit->block_offsets);
+	free(jit->jumps);
+	free(jit->calls);
+	free(jit->moves);
+}
+
+int eval_jit_ssa(SsaProg* prog, int* result) {
+	SsaJit jit = { 0 };
+	int ok = emit_prog(&jit, prog);
+
+	if (ok) {
+		void* exec_mem = mmap(NULL, jit.size, PROT_WRITE | PROT_EXEC, MAP_ANON | MAP_PRIVATE, -1, 0);
+		ok = exec_mem != MAP_FAILED;
+		if (ok) {
+			JITFunction fun = (JITFunction) ((uchar*) exec_mem + jit.proc_offsets[prog->main]);
+			memcpy(exec_mem, jit.code, jit.size);
+			*result = (*fun)();
+			ok = munmap(exec_mem, jit.size) == 0;
+		}
+	}
+	destroy_ssa_jit(&jit);
+	return ok;
+}
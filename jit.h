@@ -2,7 +2,11 @@
 #define JIT_H
 
 #include "interp.h"
+#include "ssa.h"
 
 int eval_jit(InterpProg* interp_prog, int* result);
 
+/* the optimizing tier, from the SSA form init_ssa_prog builds */
+int eval_jit_ssa(SsaProg* prog, int* result);
+
 #endif
\ No newline at end of file
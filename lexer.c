@@ -1,33 +1,50 @@
 #include "lexer.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define KEYWORD_COUNT    9
+/*
+ * Keywords are recognized through a perfect hash over the first and the
+ * last characters and the size of the identifier. KEYWORD_HASH places
+ * every keyword at compile time, so a new keyword only needs a new entry
+ * below (-Woverride-init reports a collision, in which case the multiplier
+ * must be changed).
+ */
+#define KEYWORD_TABLE_SIZE    32
+#define KEYWORD_HASH(first, last, size) \
+	(((first) + 3 * (last) + (size)) & (KEYWORD_TABLE_SIZE - 1))
+#define KEYWORD(id, first, last, token) \
+	[KEYWORD_HASH(first, last, sizeof(id) - 1)] = { sizeof(id) - 1, id, token }
 
 typedef struct Keyword {
-	int      size;
-	char*    id;
-	Token    token;
+	int          size;
+	const char*  id;
+	Token        token;
 } Keyword; 
 
-static const Keyword keywords[KEYWORD_COUNT] = {
-	{ 3, "end", TK_END },
-	{ 3, "var", TK_VAR },
-	{ 2, "do", TK_DO },
-	{ 4, "done", TK_DONE },
-	{ 2, "to", TK_TO },
-	{ 3, "for", TK_FOR },
-	{ 6, "return", TK_RETURN },
-	{ 5, "begin", TK_BEGIN },
-	{ 9, "procedure", TK_PROCEDURE }
+static const Keyword keywords[KEYWORD_TABLE_SIZE] = {
+	KEYWORD("end", 'e', 'd', TK_END),
+	KEYWORD("var", 'v', 'r', TK_VAR),
+	KEYWORD("do", 'd', 'o', TK_DO),
+	KEYWORD("done", 'd', 'e', TK_DONE),
+	KEYWORD("to", 't', 'o', TK_TO),
+	KEYWORD("for", 'f', 'r', TK_FOR),
+	KEYWORD("return", 'r', 'n', TK_RETURN),
+	KEYWORD("begin", 'b', 'n', TK_BEGIN),
+	KEYWORD("procedure", 'p', 'e', TK_PROCEDURE)
 };
 
-static inline Token lookup_keyword(char *id, int size) {
-	int i;
-	for (i=0; i<KEYWORD_COUNT; i++)
-		if  ((keywords[i].size == size) && (strncmp(id, keywords[i].id, size) == 0))
-			return keywords[i].token;
+static inline Token lookup_keyword(const char *id, int size) {
+	const Keyword *k;
+	k = &keywords[KEYWORD_HASH((unsigned char) id[0], (unsigned char) id[size - 1], size)];
+	if ((k->size == size) && (memcmp(id, k->id, size) == 0))
+		return k->token;
 	return TK_UNKNOWN;
 }
 
@@ -38,9 +55,14 @@ static inline void append_char(Lexer *l, int c) {
 	} else
 		l->location.until.column++;
 
-	if (l->lexeme_size < MAX_LEXEME_SIZE)
-		l->lexeme[l->lexeme_size] = c;
-	l->lexeme_size++;
+	if (l->lexeme_size + 1 >= l->lexeme_capacity) {
+		char *lexeme = (char*) realloc(l->lexeme, 2 * l->lexeme_capacity);
+		if (!lexeme)
+			return;
+		l->lexeme = lexeme;
+		l->lexeme_capacity *= 2;
+	}
+	l->lexeme[l->lexeme_size++] = c;
 }
 
 static inline int peek_char(Lexer *l) {
@@ -71,8 +93,11 @@ start:
 			c = peek_char(l);
 		}
 		l->token = lookup_keyword(l->lexeme, l->lexeme_size);
-		if (l->token == TK_UNKNOWN)
+		if (l->token == TK_UNKNOWN) {
 			l->token = TK_ID;
+			if (l->interner)
+				l->symbol = intern(l->interner, l->lexeme, l->lexeme_size);
+		}
 	} else if (isdigit(c)) {
 		c = peek_char(l);
 		while (isdigit(c)) {
@@ -111,17 +136,158 @@ start:
 	}
 }
 
+static inline void do_lex_buffer(Lexer *l) {
+	const char *buffer = l->buffer;
+	size_t size = l->buffer_size;
+	size_t i = l->offset;
+	int c;
+
+	i = l->scanner->space(buffer, i, size, &l->location.until.line, &l->line_offset);
+	l->lexeme_offset = i;
+	l->location.from.line = l->location.until.line;
+	l->location.from.column = i - l->line_offset + 1;
+
+	if (i == size) {
+		l->offset = i;
+		l->lexeme_size = 0;
+		l->location.until.column = l->location.from.column;
+		l->token = TK_EOF;
+		return;
+	}
+
+	c = (unsigned char) buffer[i++];
+	if (isalpha(c) || (c == '_')) {
+		i = l->scanner->ident(buffer, i, size);
+		l->token = lookup_keyword(&buffer[l->lexeme_offset], i - l->lexeme_offset);
+		if (l->token == TK_UNKNOWN) {
+			l->token = TK_ID;
+			if (l->interner)
+				l->symbol = intern(l->interner, &buffer[l->lexeme_offset], i - l->lexeme_offset);
+		}
+	} else if (isdigit(c)) {
+		i = l->scanner->digits(buffer, i, size);
+		l->token = TK_NUM;
+	} else if (c == ';') {
+		l->token = TK_SEMI;
+	} else if (c == '(') {
+		l->token = TK_LPAREN;
+	} else if (c == ')') {
+		l->token = TK_RPAREN;
+	} else if (c == ':') {
+		if ((i < size) && (buffer[i] == '=')) {
+			i++;
+			l->token = TK_ASSIGN;
+		} else
+			l->token = TK_COLON;
+	} else if (c == ',') {
+		l->token = TK_COMMA;
+	} else if (c == '*') {
+		l->token = TK_MULT;
+	} else if (c == '+') {
+		l->token = TK_ADD;
+	} else {
+		l->token = TK_UNKNOWN;
+	}
+
+	l->offset = i;
+	l->lexeme_size = i - l->lexeme_offset;
+	l->location.until.column = i - l->line_offset + 1;
+}
+
 void lex(Lexer *l) {
-	do_lex(l);
-	l->lexeme[ (l->lexeme_size <= MAX_LEXEME_SIZE) ? l->lexeme_size : MAX_LEXEME_SIZE ] = '\0';
+	l->symbol = NO_SYMBOL;
+	if (l->buffer)
+		do_lex_buffer(l);
+	else
+		do_lex(l);
 }
 
-void init_lexer(Lexer *lexer, GetChar input_fun, void *user_data) {
-	lexer->user_data = user_data;
-	lexer->input_fun = input_fun;
+static inline void reset_lexer(Lexer *lexer, Interner *interner) {
+	lexer->user_data = NULL;
+	lexer->input_fun = NULL;
+	lexer->scanner = NULL;
+	lexer->interner = interner;
+	lexer->buffer = NULL;
+	lexer->buffer_size = 0;
+	lexer->offset = 0;
+	lexer->line_offset = 0;
+	lexer->lexeme = NULL;
+	lexer->lexeme_capacity = 0;
+	lexer->lexeme_offset = 0;
 	lexer->lexeme_size = 0;
 	lexer->last_char = EOF;
+	lexer->symbol = NO_SYMBOL;
 	lexer->location.until.line = 1;
 	lexer->location.until.column = 1;
 	lexer->token = TK_UNKNOWN;
 }
+
+int init_lexer(Lexer *lexer, GetChar input_fun, void *user_data, Interner *interner) {
+	reset_lexer(lexer, interner);
+	lexer->user_data = user_data;
+	lexer->input_fun = input_fun;
+	lexer->lexeme_capacity = 32;
+	lexer->lexeme = (char*) malloc(lexer->lexeme_capacity);
+	return lexer->lexeme ? 1 : 0;
+}
+
+void init_lexer_buffer(Lexer *lexer, const char *data, size_t size, Interner *interner) {
+	reset_lexer(lexer, interner);
+	lexer->scanner = select_scanner();
+	lexer->buffer = data ? data : "";
+	lexer->buffer_size = size;
+}
+
+void destroy_lexer(Lexer *lexer) {
+	free(lexer->lexeme);
+	lexer->lexeme = NULL;
+}
+
+const char* lexeme_text(Lexer *l, int *size) {
+	*size = l->lexeme_size;
+	return l->buffer ? &l->buffer[l->lexeme_offset] : l->lexeme;
+}
+
+int lexeme_int(const char *text, int size) {
+	int i;
+	unsigned value = 0;
+	for (i=0; (i<size) && isdigit((unsigned char) text[i]); i++)
+		value = 10 * value + (text[i] - '0');
+	return (int) value;
+}
+
+int map_source(Source *source, const char *path) {
+	int fd;
+	struct stat st;
+	void *data;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return 0;
+	if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return 0;
+	}
+
+	source->size = st.st_size;
+	if (source->size == 0) {
+		source->data = NULL;
+		close(fd);
+		return 1;
+	}
+
+	data = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return 0;
+	madvise(data, source->size, MADV_SEQUENTIAL);
+	source->data = (const char*) data;
+	return 1;
+}
+
+void unmap_source(Source *source) {
+	if (source->data)
+		munmap((void*) source->data, source->size);
+	source->data = NULL;
+	source->size = 0;
+}
@@ -1,7 +1,9 @@
 #ifndef LEXER_H
 #define LEXER_H
 
-#define MAX_LEXEME_SIZE  20
+#include <stddef.h>
+#include "intern.h"
+#include "scan.h"
 
 typedef enum Token {
 	TK_UNKNOWN,
@@ -39,18 +41,51 @@ typedef struct Location {
 
 typedef int (*GetChar)(void *user_data);
 
+/*
+ * A lexer reads either through input_fun, one character at a time, or
+ * straight from a memory buffer. In buffer mode the lexeme is not copied:
+ * it is the slice [lexeme_offset, lexeme_offset + lexeme_size) of buffer,
+ * and runs of characters are skipped by scanner. With an interner, every
+ * TK_ID gets its symbol (NO_SYMBOL if out of memory).
+ */
 typedef struct Lexer {
-	void*      user_data;
-	GetChar    input_fun;
-	char       lexeme[MAX_LEXEME_SIZE+1];
-	int        lexeme_size;
-	int        last_char;
-	Location   location;
-	Token      token;
+	void*           user_data;
+	GetChar         input_fun;
+	const Scanner*  scanner;
+	Interner*       interner;
+	const char*     buffer;
+	size_t          buffer_size;
+	size_t          offset;
+	size_t          line_offset;
+	char*           lexeme;
+	int             lexeme_capacity;
+	size_t          lexeme_offset;
+	int             lexeme_size;
+	int             last_char;
+	Symbol          symbol;
+	Location        location;
+	Token           token;
 } Lexer;
 
+typedef struct Source {
+	const char*  data;
+	size_t       size;
+} Source;
+
 void lex(Lexer *l);
 
-void init_lexer(Lexer *lexer, GetChar input_fun, void *user_data);
+int init_lexer(Lexer *lexer, GetChar input_fun, void *user_data, Interner *interner);
+
+void init_lexer_buffer(Lexer *lexer, const char *data, size_t size, Interner *interner);
+
+void destroy_lexer(Lexer *lexer);
+
+const char* lexeme_text(Lexer *l, int *size);
+
+int lexeme_int(const char *text, int size);
+
+int map_source(Source *source, const char *path);
+
+void unmap_source(Source *source);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,590 @@
+#include "interp.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* calls nested deeper than this are not worth hoisting, nor following */
+#define MAX_PURE_DEPTH   32
+
+typedef enum Purity {
+	PURITY_UNKNOWN = 0,
+	PURITY_VISITING,
+	PURITY_PURE,
+	PURITY_IMPURE
+} Purity;
+
+/* an entry of the simulated stack, computed by the code in [start, end) */
+typedef struct Value {
+	int  start;
+	int  end;
+	int  invariant;
+	int  ops;
+} Value;
+
+/*
+ * Code moved to the preheader; var is the temp holding its value, or the
+ * one it stores to. A reduced product of the induction var also steps its
+ * temp at the latch, by step_op step: ADDI by the constant factor or
+ * LOADVAR of the invariant one. Products sharing a step share the temp,
+ * only the first computes it.
+ */
+typedef struct Hoist {
+	int       start;
+	int       end;
+	int       var;
+	int       moves_store;
+	int       first;
+	InterpOp  step_op;
+	int       step;
+} Hoist;
+
+typedef struct LoopCtx {
+	InterpProg*  prog;
+	char*        purity;
+	InterpCode*  code;
+	int          temps;
+	int          new_temps;
+	int          vars;
+	int          params;
+	char*        target;
+	int*         var_stores;
+	char*        param_stored;
+	int          depth;
+	int          stack_capacity;
+	Value*       stack;
+	int          hoist_count;
+	int          hoist_capacity;
+	Hoist*       hoists;
+} LoopCtx;
+
+static inline int is_jump(InterpOp op) {
+	return (op == INTERP_JMP) || (op == INTERP_JLT);
+}
+
+static inline int is_var_op(InterpOp op) {
+	return (op == INTERP_VAR) || (op == INTERP_LOADVAR) || (op == INTERP_STOREVAR)
+		|| (op == INTERP_INCVAR);
+}
+
+static inline int is_param_op(InterpOp op) {
+	return (op == INTERP_PARAM) || (op == INTERP_LOADPARAM) || (op == INTERP_STOREPARAM);
+}
+
+/* every RET pops the params, -1 for a procedure that never returns */
+static int proc_params(InterpCode* code) {
+	int i;
+	for (i=0; i<code->size; i++) {
+		InterpOp op = base_op(code->data[i].op);
+		if ((op == INTERP_RET) || (op == INTERP_RETV))
+			return code->data[i].value;
+	}
+	return -1;
+}
+
+/*
+ * Procedures only write their own frames, so the one effect a call can
+ * have is taking long or not returning at all. A pure procedure returns
+ * without loops or recursion, and only calls pure ones: hoisting a call
+ * to it out of a loop that never runs costs little.
+ */
+static int is_pure(LoopCtx* ctx, int proc, int depth) {
+	InterpCode* code = &ctx->prog->procs[proc];
+	int pure, i;
+
+	if (ctx->purity[proc] == PURITY_VISITING)
+		return 0;
+	if (ctx->purity[proc] != PURITY_UNKNOWN)
+		return ctx->purity[proc] == PURITY_PURE;
+	if (depth > MAX_PURE_DEPTH)
+		return 0;
+
+	ctx->purity[proc] = PURITY_VISITING;
+	pure = proc_params(code) >= 0;
+	for (i=0; pure && (i<code->size); i++) {
+		InterpOp op = base_op(code->data[i].op);
+		if (is_jump(op))
+			pure = 0;
+		else if ((op == INTERP_PROC) || (op == INTERP_CALLPROC) || (op == INTERP_CALLVPROC))
+			pure = is_pure(ctx, code->data[i].value, depth + 1);
+	}
+	ctx->purity[proc] = pure ? PURITY_PURE : PURITY_IMPURE;
+	return pure;
+}
+
+static int push_value(LoopCtx* ctx, int start, int end, int invariant, int ops) {
+	Value* value;
+	if (ctx->depth == ctx->stack_capacity) {
+		int capacity = ctx->stack_capacity ? 2 * ctx->stack_capacity : 16;
+		Value* stack = (Value*) realloc(ctx->stack, capacity * sizeof(Value));
+		if (!stack)
+			return 0;
+		ctx->stack = stack;
+		ctx->stack_capacity = capacity;
+	}
+	value = &ctx->stack[ctx->depth++];
+	value->start = start;
+	value->end = end;
+	value->invariant = invariant;
+	value->ops = ops;
+	return 1;
+}
+
+/* what was pushed before the loop head is not known */
+static inline Value pop_value(LoopCtx* ctx) {
+	Value unknown = { 0, 0, 0, 0 };
+	return ctx->depth ? ctx->stack[--ctx->depth] : unknown;
+}
+
+static int add_hoist(LoopCtx* ctx, int start, int end, int var, int moves_store) {
+	Hoist* hoist;
+	if (ctx->hoist_count == ctx->hoist_capacity) {
+		int capacity = ctx->hoist_capacity ? 2 * ctx->hoist_capacity : 8;
+		Hoist* hoists = (Hoist*) realloc(ctx->hoists, capacity * sizeof(Hoist));
+		if (!hoists)
+			return 0;
+		ctx->hoists = hoists;
+		ctx->hoist_capacity = capacity;
+	}
+	hoist = &ctx->hoists[ctx->hoist_count++];
+	hoist->start = start;
+	hoist->end = end;
+	hoist->var = var;
+	hoist->moves_store = moves_store;
+	hoist->first = 1;
+	hoist->step_op = INTERP_INVALID;
+	hoist->step = 0;
+	return 1;
+}
+
+/* a value used by variant code is hoisted when it is invariant and computes something */
+static inline int consume(LoopCtx* ctx, Value value) {
+	return !value.invariant || !value.ops || add_hoist(ctx, value.start, value.end, ctx->new_temps++, 0);
+}
+
+/* code from here on cannot extend what is on the stack: a jump or its target is between them */
+static int flush(LoopCtx* ctx) {
+	int ok = 1;
+	int i;
+	for (i=0; ok && (i<ctx->depth); i++) {
+		ok = consume(ctx, ctx->stack[i]);
+		ctx->stack[i].invariant = 0;
+	}
+	return ok;
+}
+
+/* pops the operands of op and pushes its result, or consumes operands it makes variant */
+static int combine(LoopCtx* ctx, int operands, int pc, int invariant, int produces) {
+	Value args[2];
+	int start = pc;
+	int ops = 1;
+	int ok = 1;
+	int i;
+
+	for (i=operands-1; i>=0; i--) {
+		args[i] = pop_value(ctx);
+		invariant = invariant && args[i].invariant;
+		ops += args[i].ops;
+	}
+	if (operands)
+		start = args[0].start;
+	for (i=0; ok && !invariant && (i<operands); i++)
+		ok = consume(ctx, args[i]);
+	return ok && (!produces || push_value(ctx, start, pc + 1, invariant, invariant ? ops : 0));
+}
+
+static int simulate_call(LoopCtx* ctx, int pc, int produces) {
+	int callee = ctx->code->data[pc].value;
+	int params = proc_params(&ctx->prog->procs[callee]);
+	int pure, start, ops, i, ok;
+
+	if (params < 0) {
+		ok = flush(ctx);
+		ctx->depth = 0;
+		return ok && (!produces || push_value(ctx, pc, pc + 1, 0, 0));
+	}
+	pure = produces && is_pure(ctx, callee, 0);
+	for (i=0; i<params; i++)
+		if (i < ctx->depth)
+			pure = pure && ctx->stack[ctx->depth - 1 - i].invariant;
+		else
+			pure = 0;
+	if (pure) {
+		start = params ? ctx->stack[ctx->depth - params].start : pc;
+		ops = 1;
+		for (i=0; i<params; i++)
+			ops += pop_value(ctx).ops;
+		return push_value(ctx, start, pc + 1, 1, ops);
+	}
+	ok = 1;
+	for (i=0; ok && (i<params); i++)
+		ok = consume(ctx, pop_value(ctx));
+	return ok && (!produces || push_value(ctx, pc, pc + 1, 0, 0));
+}
+
+/* the hoists of loop [head, latch], where latch is the JMP back to head */
+static int find_hoists(LoopCtx* ctx, int head, int latch) {
+	InterpInstr* data = ctx->code->data;
+	int ok = 1;
+	int pc;
+
+	ctx->depth = 0;
+	ctx->hoist_count = 0;
+	ctx->new_temps = 0;
+	for (pc=head; ok && (pc<=latch); pc++) {
+		int value = data[pc].value;
+		Value top;
+
+		if (ctx->target[pc])
+			ok = flush(ctx);
+		if (!ok)
+			break;
+		switch (data[pc].op) {
+		case INTERP_PUSH:
+			ok = push_value(ctx, pc, pc + 1, 1, 0);
+			break;
+		case INTERP_LOADVAR:
+			ok = push_value(ctx, pc, pc + 1, !ctx->var_stores[value], 0);
+			break;
+		case INTERP_LOADPARAM:
+			ok = push_value(ctx, pc, pc + 1, !ctx->param_stored[value], 0);
+			break;
+		case INTERP_VAR:
+		case INTERP_PARAM:
+		case INTERP_PROC:
+			ok = push_value(ctx, pc, pc + 1, 0, 0);
+			break;
+		case INTERP_LOAD:
+			ok = combine(ctx, 1, pc, 0, 1);
+			break;
+		case INTERP_ADDI:
+		case INTERP_MULI:
+		case INTERP_SHLI:
+			ok = combine(ctx, 1, pc, 1, 1);
+			break;
+		case INTERP_ADD:
+		case INTERP_MUL:
+			ok = combine(ctx, 2, pc, 1, 1);
+			break;
+		case INTERP_CMP:
+			ok = combine(ctx, 2, pc, 0, 1);
+			break;
+		case INTERP_DUP:
+			ok = consume(ctx, pop_value(ctx)) && push_value(ctx, pc, pc + 1, 0, 0)
+				&& push_value(ctx, pc, pc + 1, 0, 0);
+			break;
+		case INTERP_POP:
+		case INTERP_JLT:
+		case INTERP_RET:
+		case INTERP_STOREPARAM:
+		case INTERP_INC:
+			ok = combine(ctx, 1, pc, 0, 0);
+			break;
+		case INTERP_STORE:
+			ok = combine(ctx, 2, pc, 0, 0);
+			break;
+		case INTERP_STOREVAR:
+			/* an invariant temp set once in the loop, by an inner preheader, moves out with its store */
+			top = pop_value(ctx);
+			if (top.invariant && top.ops && (value < ctx->temps) && (ctx->var_stores[value] == 1))
+				ok = add_hoist(ctx, top.start, pc + 1, value, 1);
+			else
+				ok = consume(ctx, top);
+			break;
+		case INTERP_CALLPROC:
+		case INTERP_CALLVPROC:
+			ok = simulate_call(ctx, pc, data[pc].op == INTERP_CALLPROC);
+			break;
+		case INTERP_CALL:
+		case INTERP_CALLV:
+			ok = flush(ctx);
+			ctx->depth = 0;
+			if (ok && (data[pc].op == INTERP_CALL))
+				ok = push_value(ctx, pc, pc + 1, 0, 0);
+			break;
+		default:
+			break;
+		}
+	}
+	return ok;
+}
+
+static int compare_hoists(const void* a, const void* b) {
+	return ((const Hoist*) a)->start - ((const Hoist*) b)->start;
+}
+
+static void mark_loop(LoopCtx* ctx, int head, int latch) {
+	InterpInstr* data = ctx->code->data;
+	int pc;
+
+	memset(ctx->target, 0, ctx->code->size + 1);
+	for (pc=0; pc<ctx->code->size; pc++)
+		if (is_jump(data[pc].op))
+			ctx->target[data[pc].value] = 1;
+	memset(ctx->var_stores, 0, ctx->vars * sizeof(int));
+	memset(ctx->param_stored, 0, ctx->params);
+	for (pc=head; pc<=latch; pc++) {
+		InterpOp op = data[pc].op;
+		if ((op == INTERP_VAR) || (op == INTERP_STOREVAR) || (op == INTERP_INCVAR))
+			ctx->var_stores[data[pc].value]++;
+		else if ((op == INTERP_PARAM) || (op == INTERP_STOREPARAM))
+			ctx->param_stored[data[pc].value] = 1;
+	}
+}
+
+static inline void put_instr(InterpInstr* data, int* out, InterpOp op, int value) {
+	data[*out].op = op;
+	data[*out].value = value;
+	(*out)++;
+}
+
+/*
+ * A for loop's head is DUP; LOADVAR i; CMP; JLT and its latch INCVAR i;
+ * JMP. When nothing else in the loop stores i, it steps by one and i * k
+ * steps by k.
+ */
+static int induction_var(LoopCtx* ctx, int head, int latch) {
+	InterpInstr* data = ctx->code->data;
+	int var;
+
+	if ((latch - head < 5) || (data[head].op != INTERP_DUP) || (data[head + 1].op != INTERP_LOADVAR)
+		|| (data[head + 2].op != INTERP_CMP) || (data[head + 3].op != INTERP_JLT)
+		|| (data[latch - 1].op != INTERP_INCVAR))
+		return -1;
+	var = data[head + 1].value;
+	return ((data[latch - 1].value == var) && (ctx->var_stores[var] == 1)) ? var : -1;
+}
+
+static inline int is_load(InterpInstr* instr, int var) {
+	return (instr->op == INTERP_LOADVAR) && (instr->value == var);
+}
+
+static inline int is_invariant_load(LoopCtx* ctx, InterpInstr* instr) {
+	return (instr->op == INTERP_LOADVAR) && !ctx->var_stores[instr->value];
+}
+
+/*
+ * Products of the induction var and a constant or an invariant var become
+ * temps the latch steps, an add where the body had a multiply. Params are
+ * left alone: their update has no superinstruction, nor have shifts.
+ */
+static int find_reductions(LoopCtx* ctx, int head, int latch) {
+	InterpInstr* data = ctx->code->data;
+	int var = induction_var(ctx, head, latch);
+	int pc, h;
+
+	ctx->hoist_count = 0;
+	ctx->new_temps = 0;
+	if (var < 0)
+		return 1;
+	for (pc=head+4; pc+1<latch-1; pc++) {
+		InterpOp step_op = INTERP_INVALID;
+		int step = 0;
+		int end = pc + 3;
+		Hoist* hoist;
+
+		if (ctx->target[pc + 1])
+			continue;
+		if (is_load(&data[pc], var) && (data[pc + 1].op == INTERP_MULI)) {
+			step_op = INTERP_ADDI;
+			step = data[pc + 1].value;
+			end = pc + 2;
+		} else if ((pc + 2 < latch - 1) && !ctx->target[pc + 2] && (data[pc + 2].op == INTERP_MUL)) {
+			step_op = INTERP_LOADVAR;
+			if (is_load(&data[pc], var) && is_invariant_load(ctx, &data[pc + 1]))
+				step = data[pc + 1].value;
+			else if (is_invariant_load(ctx, &data[pc]) && is_load(&data[pc + 1], var))
+				step = data[pc].value;
+			else
+				step_op = INTERP_INVALID;
+		}
+		if (step_op == INTERP_INVALID)
+			continue;
+
+		for (h=0; h<ctx->hoist_count; h++)
+			if ((ctx->hoists[h].step_op == step_op) && (ctx->hoists[h].step == step))
+				break;
+		if (!add_hoist(ctx, pc, end, (h < ctx->hoist_count) ? ctx->hoists[h].var : ctx->new_temps, 0))
+			return 0;
+		hoist = &ctx->hoists[ctx->hoist_count - 1];
+		hoist->first = (h == ctx->hoist_count - 1);
+		hoist->step_op = step_op;
+		hoist->step = step;
+		if (hoist->first)
+			ctx->new_temps++;
+		pc = end - 1;
+	}
+	return 1;
+}
+
+/*
+ * New temps take the first frame slots, so the prologue grows by one
+ * PUSH 0 each and every var moves up. The preheader goes right before
+ * head: the back edge jumps past it. Steps go before the INCVAR of the
+ * latch, which then maps to them.
+ */
+static int rewrite_loop(LoopCtx* ctx, int head, int* latch) {
+	InterpCode* code = ctx->code;
+	int temps = ctx->new_temps;
+	int size = code->size + temps;
+	int* map;
+	InterpInstr* data;
+	int out, pc, h, i;
+
+	/* at most the code of each hoist, its STOREVAR, its LOADVAR and a step of four */
+	for (h=0; h<ctx->hoist_count; h++)
+		size += ctx->hoists[h].end - ctx->hoists[h].start + 6;
+	map = (int*) malloc((code->size + 1) * sizeof(int));
+	data = (InterpInstr*) malloc(size * sizeof(InterpInstr));
+	if (!map || !data) {
+		free(map);
+		free(data);
+		return 0;
+	}
+	for (pc=0; pc<code->size; pc++)
+		if (is_var_op(code->data[pc].op))
+			code->data[pc].value += temps;
+
+	out = 0;
+	for (i=0; i<temps; i++)
+		put_instr(data, &out, INTERP_PUSH, 0);
+	h = 0;
+	for (pc=0; pc<code->size; ) {
+		Hoist* hoist = (h < ctx->hoist_count) ? &ctx->hoists[h] : NULL;
+		int at = out;
+		if (pc == head)
+			for (i=0; i<ctx->hoist_count; i++) {
+				Hoist* moved = &ctx->hoists[i];
+				if (!moved->first)
+					continue;
+				memcpy(&data[out], &code->data[moved->start], (moved->end - moved->start) * sizeof(InterpInstr));
+				out += moved->end - moved->start;
+				if (!moved->moves_store)
+					put_instr(data, &out, INTERP_STOREVAR, moved->var);
+			}
+		if (pc == *latch - 1)
+			for (i=0; i<ctx->hoist_count; i++) {
+				Hoist* stepped = &ctx->hoists[i];
+				if (!stepped->first || (stepped->step_op == INTERP_INVALID))
+					continue;
+				put_instr(data, &out, INTERP_LOADVAR, stepped->var);
+				if (stepped->step_op == INTERP_ADDI)
+					put_instr(data, &out, INTERP_ADDI, stepped->step);
+				else {
+					put_instr(data, &out, INTERP_LOADVAR, stepped->step + temps);
+					put_instr(data, &out, INTERP_ADD, 0);
+				}
+				put_instr(data, &out, INTERP_STOREVAR, stepped->var);
+			}
+		if (hoist && (pc == hoist->start)) {
+			for (; pc<hoist->end; pc++)
+				map[pc] = out;
+			if (!hoist->moves_store)
+				put_instr(data, &out, INTERP_LOADVAR, hoist->var);
+			h++;
+		} else {
+			map[pc] = (pc == *latch - 1) ? at : out;
+			data[out++] = code->data[pc++];
+		}
+	}
+	map[code->size] = out;
+	for (pc=0; pc<out; pc++)
+		if (is_jump(data[pc].op))
+			data[pc].value = map[data[pc].value];
+
+	*latch = map[*latch];
+	free(code->data);
+	free(map);
+	code->data = data;
+	code->size = out;
+	ctx->temps += temps;
+	return 1;
+}
+
+static int grow_proc_ctx(LoopCtx* ctx) {
+	InterpCode* code = ctx->code;
+	int pc;
+
+	ctx->vars = 0;
+	ctx->params = 0;
+	for (pc=0; pc<code->size; pc++) {
+		if (is_var_op(code->data[pc].op) && (code->data[pc].value >= ctx->vars))
+			ctx->vars = code->data[pc].value + 1;
+		if (is_param_op(code->data[pc].op) && (code->data[pc].value >= ctx->params))
+			ctx->params = code->data[pc].value + 1;
+	}
+	free(ctx->target);
+	free(ctx->var_stores);
+	free(ctx->param_stored);
+	ctx->target = (char*) malloc(code->size + 1);
+	ctx->var_stores = (int*) malloc((ctx->vars + 1) * sizeof(int));
+	ctx->param_stored = (char*) malloc(ctx->params + 1);
+	return ctx->target && ctx->var_stores && ctx->param_stored;
+}
+
+/*
+ * Loops are found by their back edges. An inner loop's JMP comes before
+ * the outer one's, so inner loops go first and the outer ones can take
+ * what their preheaders compute further out.
+ */
+static int optimize_proc(LoopCtx* ctx, InterpCode* code) {
+	int loops = 0;
+	int ok = 1;
+	int pc;
+
+	for (pc=0; pc<code->size; pc++)
+		if ((code->data[pc].op == INTERP_JMP) && (code->data[pc].value <= pc))
+			loops = 1;
+	if (!loops)
+		return 1;
+
+	/* superinstructions keep their sequences' slots, they are formed again at the end */
+	for (pc=0; pc<code->size; pc++)
+		code->data[pc].op = base_op(code->data[pc].op);
+	ctx->code = code;
+	ctx->temps = 0;
+	for (pc=0; ok && (pc<code->size); pc++) {
+		int head = code->data[pc].value;
+		if ((code->data[pc].op != INTERP_JMP) || (head > pc))
+			continue;
+		ok = grow_proc_ctx(ctx);
+		if (ok) {
+			mark_loop(ctx, head, pc);
+			ok = find_hoists(ctx, head, pc);
+		}
+		if (ok && ctx->hoist_count) {
+			qsort(ctx->hoists, ctx->hoist_count, sizeof(Hoist), compare_hoists);
+			ok = rewrite_loop(ctx, head, &pc);
+		}
+		/* hoisting first leaves products of i and a temp for it to reduce */
+		ok = ok && grow_proc_ctx(ctx);
+		if (ok) {
+			head = code->data[pc].value;
+			mark_loop(ctx, head, pc);
+			ok = find_reductions(ctx, head, pc);
+		}
+		if (ok && ctx->hoist_count)
+			ok = rewrite_loop(ctx, head, &pc);
+	}
+	return ok && super_instr_code(code);
+}
+
+int optimize_loops(InterpProg* prog) {
+	LoopCtx ctx;
+	int ok = 1;
+	int i;
+
+	memset(&ctx, 0, sizeof(LoopCtx));
+	ctx.prog = prog;
+	ctx.purity = (char*) calloc(prog->proc_count + 1, 1);
+	if (!ctx.purity)
+		return 0;
+	for (i=0; ok && (i<prog->proc_count); i++)
+		ok = optimize_proc(&ctx, &prog->procs[i]);
+	free(ctx.purity);
+	free(ctx.target);
+	free(ctx.var_stores);
+	free(ctx.param_stored);
+	free(ctx.stack);
+	free(ctx.hoists);
+	return ok;
+}
@@ -1,34 +1,136 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "parser.h"
+#include "jit.h"
+#include "regvm.h"
 
-int main(int argc, char *argv[]) {
-	FILE *fp;
+#define PROFILE_TOP   10
+
+static void run_reg(Prog* prog) {
+	RegProg reg;
+	int result;
+
+	if (!init_reg_prog(&reg, &prog->interp)) {
+		printf("Register Code Error\n");
+		return;
+	}
+	dump_reg_prog(&reg, stdout);
+	if (eval_reg_prog(&reg, &result))
+		printf("Eval %d\n", result);
+	else
+		printf("Eval Error\n");
+	destroy_reg_prog(&reg);
+}
+
+static void run_stack(Prog* prog, int profile) {
+	InterpProfile* counts = profile ? (InterpProfile*) calloc(1, sizeof(InterpProfile)) : NULL;
+	int result;
+
+	dump_interp_prog(&prog->interp, stdout);
+	if (eval_interp_profile(&prog->interp, &result, counts))
+		printf("Eval %d\n", result);
+	if (counts) {
+		dump_interp_profile(counts, PROFILE_TOP, stdout);
+		free(counts);
+	}
+}
+
+static void run_ssa(Prog* prog) {
+	SsaProg ssa;
+	int result;
+
+	if (!init_ssa_prog(&ssa, &prog->interp)) {
+		printf("SSA Error\n");
+		return;
+	}
+	dump_ssa_prog(&ssa, stdout);
+	if (eval_jit_ssa(&ssa, &result))
+		printf("JIT Eval %d\n", result);
+	destroy_ssa_prog(&ssa);
+}
+
+static void run(Prog* prog, int profile, int reg, int optimize) {
+	int result;
+
+	if (reg)
+		run_reg(prog);
+	else
+		run_stack(prog, profile);
+	if (optimize)
+		run_ssa(prog);
+	else if (eval_jit(&prog->interp, &result))
+		printf("JIT Eval %d\n", result);
+}
+
+static void run_stream(Source* source, FILE* fp, int profile, int reg, int optimize,
+	Interner* names) {
+	Prog* prog;
+	StreamStatus status;
+
+	if (fp)
+		status = compile_stream((GetChar)fgetc, fp, names, &prog);
+	else
+		status = compile_stream_buffer(source->data, source->size, names, &prog);
+
+	switch (status) {
+		case STREAM_OK:
+			printf("Syntax Ok\nNames Ok\nTypes Ok\nCompiling Ok\n");
+			run(prog, profile, reg, optimize);
+			free_prog(prog);
+			break;
+		case STREAM_NO_MEM:
+			printf("No Mem\n");
+			break;
+		case STREAM_SYNTAX_ERROR:
+			printf("Syntax Error\n");
+			break;
+		case STREAM_NAME_ERROR:
+			printf("Name Error\n");
+			break;
+		case STREAM_TYPE_ERROR:
+			printf("Type Error\n");
+			break;
+		case STREAM_CODE_ERROR:
+			printf("Compile Error\n");
+			break;
+	}
+}
+
+static void run_batch(Source* source, FILE* fp, int threads, int lazy, int fused, int profile,
+	int reg, int optimize, Interner* names) {
+	TokenStream tokens;
 	Prog *prog;
 	ParseStatus status;
+	int tokenized;
 
-	fp = fopen("input.txt", "r");
-	if (!fp) {
-		perror("Cannot open input file");
-		return EXIT_FAILURE;
-	}
+	tokenized = !fp && tokenize(&tokens, source->data, source->size, threads, names);
+	if (tokenized) {
+		if (lazy)
+			status = parse_tokens_lazy(&tokens, names, &prog);
+		else
+			status = parse_tokens(&tokens, names, threads, &prog);
+	} else if (!fp)
+		status = PARSE_NO_MEM;
+	else
+		status = parse((GetChar)fgetc, fp, names, &prog);
 
-	status = parse((GetChar)fgetc, fp, &prog);
 	switch (status) {
 		case PARSE_OK:
 			printf("Syntax Ok\n");
-			if (resolve_binds(prog)) {
+			if (fused) {
+				if (compile_parallel(prog, threads)) {
+					printf("Compiling Ok\n");
+					run(prog, profile, reg, optimize);
+				}
+			} else if (resolve_binds(prog)) {
 				printf("Names Ok\n");
 				if (type_check(prog)) {
 					printf("Types Ok\n");
 					if (compile(prog)) {
-						int result;
 						printf("Compiling Ok\n");
-						dump_interp_prog(&prog->interp, stdout);
-						if (eval_interp_prog(&prog->interp, &result))
-							printf("Eval %d\n", result);
-						if (eval_jit(&prog->interp, &result))
-							printf("JIT Eval %d\n", result);
+						run(prog, profile, reg, optimize);
 					}
 				}
 			}
@@ -41,8 +143,84 @@ int main(int argc, char *argv[]) {
 			printf("Syntax Error\n");
 			break;
 	}
+	if (tokenized)
+		destroy_tokens(&tokens);
+}
+
+/*
+ * usage: main [-j threads] [-p | -r] [-O] [-s | -l | -f] [file]
+ * -p: count the ops, pairs and triples of ops the interpreter dispatches
+ * -r: translate to register code and run that instead of the stack code
+ * -O: JIT through the SSA form, with registers allocated, instead of stack code templates
+ * -s: bind, check and compile each procedure as soon as it is parsed
+ * -l: parse only the bodies reached from main
+ * -f: bind, check and compile in a single walk over each body, on threads
+ */
+int main(int argc, char *argv[]) {
+	FILE *fp;
+	Source source;
+	Interner names;
+	const char *path;
+	int threads;
+	int streaming;
+	int lazy;
+	int fused;
+	int profile;
+	int reg;
+	int optimize;
+	int i;
+
+	path = "input.txt";
+	threads = sysconf(_SC_NPROCESSORS_ONLN);
+	streaming = 0;
+	lazy = 0;
+	fused = 0;
+	profile = 0;
+	reg = 0;
+	optimize = 0;
+	for (i=1; i<argc; i++) {
+		if ((strcmp(argv[i], "-j") == 0) && (i + 1 < argc))
+			threads = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-s") == 0)
+			streaming = 1;
+		else if (strcmp(argv[i], "-l") == 0)
+			lazy = 1;
+		else if (strcmp(argv[i], "-f") == 0)
+			fused = 1;
+		else if (strcmp(argv[i], "-p") == 0)
+			profile = 1;
+		else if (strcmp(argv[i], "-r") == 0)
+			reg = 1;
+		else if (strcmp(argv[i], "-O") == 0)
+			optimize = 1;
+		else
+			path = argv[i];
+	}
+
+	if (!init_interner(&names)) {
+		printf("No Mem\n");
+		return EXIT_FAILURE;
+	}
+
+	fp = NULL;
+	if (!map_source(&source, path)) {
+		fp = fopen(path, "r");
+		if (!fp) {
+			perror("Cannot open input file");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (streaming)
+		run_stream(&source, fp, profile, reg, optimize, &names);
+	else
+		run_batch(&source, fp, threads, lazy, fused, profile, reg, optimize, &names);
 
-	fclose(fp);
+	if (fp)
+		fclose(fp);
+	else
+		unmap_source(&source);
+	destroy_interner(&names);
 
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
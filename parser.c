@@ -1,34 +1,140 @@
 #include "parser.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define INITIAL_ITEMS          64
+#define MIN_PROCS_PER_THREAD   64
+
+/*
+ * Growable scratch array. Nodes of the procedure being parsed are built
+ * here and copied to the Prog arena with their final size once it ends.
+ */
+typedef struct Vector {
+	char*     data;
+	unsigned  count;
+	unsigned  capacity;
+	size_t    item_size;
+} Vector;
+
 typedef struct ParseCtx {
-	Lexer     lexer;
-	Context*  upper_context;
-	Proc*     current_proc;
-	int       move_next;
+	Lexer         lexer;
+	Interner*     names;
+	TokenStream*  tokens;
+	int           position;
+	Arena*        arena;
+	int           move_next;
+	int           lazy;
+	Vector        procs;
+	Vector        fparams;
+	Vector        vars;
+	Vector        exprs;
+	Vector        args;
+	Vector        arg_stack;
+	Vector        op_stack;
+	Vector        stmts;
+	Vector        stmt_stack;
 } ParseCtx;
 
-Type INTEGER = { 
+Type INTEGER = {
 	.kind = TYPE_INTEGER,
 	.content = { .as_proc = NULL }
 };
 
 static Bind INTEGER_BIND = {
-	.id = "integer",
+	.id = SYMBOL_INTEGER,
 	.type = BIND_TYPE,
 	.content = { .as_type = &INTEGER },
 	.next = NULL
 };
 
-static Context BUILTIN = { 
+/* binding power of each binary operator token, 0 for every other token */
+typedef struct BinaryOpInfo {
+	int       precedence;
+	BinaryOp  op;
+} BinaryOpInfo;
+
+static const BinaryOpInfo BINARY_OPS[TK_EOF + 1] = {
+	[TK_ADD]  = { 1, OP_ADD },
+	[TK_MULT] = { 2, OP_MULT },
+};
+
+/* a left operand waiting for the right one of op */
+typedef struct PendingOp {
+	BinaryOp   op;
+	int        precedence;
+	NodeIndex  left;
+} PendingOp;
+
+static Context BUILTIN = {
 	.upper_context = NULL,
-	.first_bind = &INTEGER_BIND
+	.arena = NULL,
+	.first_bind = &INTEGER_BIND,
+	.bind_count = 1
 };
 
+static inline void init_vector(Vector* v, size_t item_size) {
+	v->data = NULL;
+	v->count = 0;
+	v->capacity = 0;
+	v->item_size = item_size;
+}
+
+static inline void destroy_vector(Vector* v) {
+	free(v->data);
+	v->data = NULL;
+}
+
+static inline void* vector_item(Vector* v, unsigned i) {
+	return v->data + i * v->item_size;
+}
+
+/* NULL when out of memory */
+static void* push_item(Vector* v, const void* item) {
+	void* dst;
+
+	if (v->count == v->capacity) {
+		unsigned capacity = v->capacity ? 2 * v->capacity : INITIAL_ITEMS;
+		char* data = (char*) realloc(v->data, capacity * v->item_size);
+		if (!data)
+			return NULL;
+		v->data = data;
+		v->capacity = capacity;
+	}
+	dst = vector_item(v, v->count++);
+	memcpy(dst, item, v->item_size);
+	return dst;
+}
+
+/* moves the items of stack from mark on to the end of v */
+static ParseStatus move_items(Vector* v, Vector* stack, unsigned mark, NodeRange* range) {
+	unsigned i;
+
+	range->first = v->count;
+	range->count = stack->count - mark;
+	for (i=mark; i<stack->count; i++)
+		if (!push_item(v, vector_item(stack, i)))
+			return PARSE_NO_MEM;
+	stack->count = mark;
+	return PARSE_OK;
+}
+
+/* copies all items to the arena and empties v */
+static void* vector_to_arena(ParseCtx* pctx, Vector* v) {
+	size_t size = v->count * v->item_size;
+	void* copy = arena_alloc(pctx->arena, size);
+	if (copy && size) {
+		memcpy(copy, v->data, size);
+		v->count = 0;
+	}
+	return copy;
+}
+
 static inline Token peek_token(ParseCtx *pctx) {
+	if (pctx->tokens)
+		return pctx->tokens->kind[pctx->position];
 	if (pctx->move_next) {
 		pctx->move_next = 0;
 		lex(&pctx->lexer);
@@ -36,708 +142,345 @@ static inline Token peek_token(ParseCtx *pctx) {
 	return pctx->lexer.token;
 }
 
-static inline next_token(ParseCtx *pctx) {
-	pctx->move_next = 1;
+static inline void next_token(ParseCtx *pctx) {
+	if (pctx->tokens) {
+		if (pctx->tokens->kind[pctx->position] != TK_EOF)
+			pctx->position++;
+	} else
+		pctx->move_next = 1;
 }
 
-static void free_fparam(FParam *fparam) {
-	if (!fparam)
-		return;
-	free_fparam(fparam->next);
-	free(fparam);
-}
-
-static void free_var(Var *var) {
-	if (!var)
-		return;
-	free_var(var->next);
-	free(var);
-}
-
-static void free_expr(Expr* expr);
-
-static inline void free_binary_expr(BinaryExpr* bin) {
-	if (!bin)
-		return;
-	free_expr(bin->left);
-	free_expr(bin->right);
-	free(bin);
-}
-
-static inline void free_id_expr(IdExpr* id) {
-	if (!id)
-		return;
-	free(id);
-}
-
-static inline void free_num_expr(NumExpr* num) {
-	if (!num)
-		return;
-	free(num);
-}
-
-static void free_param(Param *param) {
-	if (!param)
-		return;
-	free_expr(param->value);
-	free_param(param->next);
-	free(param);
-}
-
-static inline void free_call_expr(CallExpr* call) {
-	if (!call)
-		return;
-	free_expr(call->lvalue);
-	free_param(call->first_param);
-	free(call);
-}
-
-void free_expr(Expr* expr) {
-	if (!expr)
-		return;
-	switch (expr->type) {
-	case EXPR_BINARY:
-		free_binary_expr(expr->content.as_binary);
-		break;
-	case EXPR_ID:
-		free_id_expr(expr->content.as_id);
-		break;
-	case EXPR_NUM:
-		free_num_expr(expr->content.as_num);
-		break;
-	case EXPR_CALL:
-		free_call_expr(expr->content.as_call);
-		break;
-	default:
-		assert(0);
-	}
-	free(expr);
-}
-
-static void free_stmt(Stmt* stmt);
-
-static inline void free_for(ForStmt* forstmt) {
-	if (!forstmt)
-		return;
-	free_expr(forstmt->from);
-	free_expr(forstmt->to);
-	free_stmt(forstmt->first_stmt);
-	free(forstmt);
-}
-
-static inline void free_return(ReturnStmt* ret) {
-	if (!ret)
-		return;
-	if (ret->expr)
-		free_expr(ret->expr);
-	free(ret);
-}
-
-static inline void free_call(CallStmt* call) {
-	if (!call)
-		return;
-	free_expr(call->expr);
-	free(call);
-}
-
-static inline void free_assign(AssignStmt *assign) {
-	if (!assign)
-		return;
-	free_expr(assign->lvalue);
-	free_expr(assign->rvalue);
-	free(assign);
-}
-
-void free_stmt(Stmt* stmt) {
-	if (!stmt)
-		return;
-	switch (stmt->type) {
-	case STMT_ASSIGN:
-		free_assign(stmt->content.as_assign);
-		break;
-	case STMT_FOR:
-		free_for(stmt->content.as_for);
-		break;
-	case STMT_RETURN:
-		free_return(stmt->content.as_return);
-		break;
-	case STMT_CALL:
-		free_call(stmt->content.as_call);
-		break;
-	default:
-		assert(0);
+static inline const char* token_text(ParseCtx *pctx, int *size) {
+	if (pctx->tokens) {
+		*size = pctx->tokens->size[pctx->position];
+		return &pctx->tokens->buffer[pctx->tokens->offset[pctx->position]];
 	}
-	if (stmt->next)
-		free_stmt(stmt->next);
-	free(stmt);
+	return lexeme_text(&pctx->lexer, size);
+}
+
+/* NO_SYMBOL when the identifier could not be interned */
+static inline Symbol token_symbol(ParseCtx *pctx) {
+	if (pctx->tokens)
+		return pctx->tokens->symbol[pctx->position];
+	return pctx->lexer.symbol;
 }
 
-static void free_proc(Proc *proc) {
-	if (!proc)
-		return;
-	destroy_type(&proc->type);
-	free_fparam(proc->first_fparam);
-	free_var(proc->first_var);
-	free_stmt(proc->first_stmt);
-	free_proc(proc->next);
-	free_context(&proc->ctx);
-	free(proc);
+static inline ParseStatus expect(ParseCtx *pctx, Token token) {
+	if (peek_token(pctx) != token)
+		return PARSE_SYNTAX_ERROR;
+	next_token(pctx);
+	return PARSE_OK;
 }
 
-static ParseStatus parse_type(ParseCtx *pctx, char *id) {
+static ParseStatus parse_type(ParseCtx *pctx, Symbol *id) {
 	if (peek_token(pctx) != TK_ID)
 		return PARSE_SYNTAX_ERROR;
-	strcpy(id, &pctx->lexer.lexeme[0]);
+	*id = token_symbol(pctx);
+	if (!*id)
+		return PARSE_NO_MEM;
 	next_token(pctx);
 	return PARSE_OK;
 }
 
-static ParseStatus parse_fparam(ParseCtx* pctx, FParam** first, FParam** last, int* fparam_count) {
+/* a, b, ... : type */
+static ParseStatus parse_fparam(ParseCtx* pctx) {
 	ParseStatus status;
-	FParam* fst;
-	FParam* lst;
+	unsigned first = pctx->fparams.count;
+	unsigned i;
+	Symbol type;
 
-	fst = (FParam*) calloc(1, sizeof(FParam));
-	if (!fst)
-		return PARSE_NO_MEM;
+	while (1) {
+		FParam fparam = { .nid = pctx->fparams.count };
 
-	if (peek_token(pctx) == TK_ID) {
-		fst->nid = *fparam_count;
-		strcpy(&fst->id[0], &pctx->lexer.lexeme[0]);
+		if (peek_token(pctx) != TK_ID)
+			return PARSE_SYNTAX_ERROR;
+		fparam.id = token_symbol(pctx);
+		if (!fparam.id)
+			return PARSE_NO_MEM;
 		next_token(pctx);
-		status = PARSE_OK;
-	} else
-		status = PARSE_SYNTAX_ERROR;
+		if (!push_item(&pctx->fparams, &fparam))
+			return PARSE_NO_MEM;
 
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_COMMA) {
-			FParam *f;
-			next_token(pctx);
-			status = parse_fparam(pctx, &f, &lst, fparam_count);
-			if (status == PARSE_OK) {
-				strcpy(&fst->type[0], &lst->type[0]);
-				fst->next = f;
-			}
-		} else if (peek_token(pctx) == TK_COLON) {
-			next_token(pctx);
-			status = parse_type(pctx, &fst->type[0]);
-			lst = fst;
-		} else
-			status = PARSE_SYNTAX_ERROR;		
+		if (peek_token(pctx) != TK_COMMA)
+			break;
+		next_token(pctx);
 	}
 
-	if (status == PARSE_OK) {
-		(*fparam_count)++;
-		*first = fst;
-		*last = lst;
-	}
-	else
-		free_fparam(fst);
- 	return PARSE_OK; 	
+	status = expect(pctx, TK_COLON);
+	if (status == PARSE_OK)
+		status = parse_type(pctx, &type);
+	if (status == PARSE_OK)
+		for (i=first; i<pctx->fparams.count; i++)
+			((FParam*) vector_item(&pctx->fparams, i))->type = type;
+	return status;
 }
 
-static ParseStatus parse_fparams(ParseCtx* pctx, FParam** result, int* fparam_count) {
-	FParam* last;
-	FParam* first;
+static ParseStatus parse_fparams(ParseCtx* pctx, Proc* proc) {
 	ParseStatus status;
 
-	if (peek_token(pctx) != TK_LPAREN) {
-		*result = NULL;
+	if (peek_token(pctx) != TK_LPAREN)
 		return PARSE_OK;
-	}
 	next_token(pctx);
 
-	first = last = NULL;
 	status = PARSE_OK;
 	if (peek_token(pctx) != TK_RPAREN) {
 		while (status == PARSE_OK) {
-			FParam* fst;
-			FParam* lst;
-
-			status = parse_fparam(pctx, &fst, &lst, fparam_count);
-			if (status == PARSE_OK) {
-				if (last)
-					last->next = fst;
-				if (!first)
-					first = fst;
-				last = lst;
-				if (peek_token(pctx) == TK_SEMI)
-					next_token(pctx);
-				else
-					break;
-			}
+			status = parse_fparam(pctx);
+			if ((status == PARSE_OK) && (peek_token(pctx) == TK_SEMI))
+				next_token(pctx);
+			else
+				break;
 		}
 	}
 
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_RPAREN);
+
 	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_RPAREN)
-			next_token(pctx);
-		else
-			status = PARSE_SYNTAX_ERROR;
+		proc->fparam_count = pctx->fparams.count;
+		proc->fparams = (FParam*) vector_to_arena(pctx, &pctx->fparams);
+		if (!proc->fparams)
+			status = PARSE_NO_MEM;
 	}
-
-	if (status == PARSE_OK)
-		*result = first;
-	else
-		free_fparam(first);
 	return status;
 }
 
-static ParseStatus parse_var(ParseCtx* pctx, int* var_count, Var** first, Var** last) {
+/* a, b, ... : type; */
+static ParseStatus parse_var(ParseCtx* pctx) {
 	ParseStatus status;
-	Var* fst;
-	Var* lst;
+	unsigned first = pctx->vars.count;
+	unsigned i;
+	Symbol type;
 
-	fst = (Var*)calloc(1, sizeof(Var));
-	if (!fst)
-		return PARSE_NO_MEM;
+	while (1) {
+		Var var = { .nid = pctx->vars.count };
 
-	if (peek_token(pctx) == TK_ID) {
-		fst->nid = (*var_count)++;
-		strcpy(&fst->id[0], &pctx->lexer.lexeme[0]);
+		if (peek_token(pctx) != TK_ID)
+			return PARSE_SYNTAX_ERROR;
+		var.id = token_symbol(pctx);
+		if (!var.id)
+			return PARSE_NO_MEM;
 		next_token(pctx);
-		status = PARSE_OK;
-	} else
-		status = PARSE_SYNTAX_ERROR;
+		if (!push_item(&pctx->vars, &var))
+			return PARSE_NO_MEM;
 
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_COMMA) {
-			Var* f;
-			next_token(pctx);
-			status = parse_var(pctx, var_count, &f, &lst);
-			if (status == PARSE_OK) {
-				fst->next = f;
-				strcpy(&fst->type[0], &lst->type[0]);
-			}
-		} else if (peek_token(pctx) == TK_COLON) {
-			next_token(pctx);
-			lst = fst;
-			status = parse_type(pctx, &fst->type[0]);
-			if (status == PARSE_OK) {
-				if (peek_token(pctx) == TK_SEMI)
-					next_token(pctx);
-				else
-				status = PARSE_SYNTAX_ERROR;
-			}
-		} else
-			status = PARSE_SYNTAX_ERROR;
+		if (peek_token(pctx) != TK_COMMA)
+			break;
+		next_token(pctx);
 	}
 
-	if (status == PARSE_OK) {
-		*first = fst;
-		*last = lst;
-	}
-	else
-		free_var(fst);
+	status = expect(pctx, TK_COLON);
+	if (status == PARSE_OK)
+		status = parse_type(pctx, &type);
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_SEMI);
+	if (status == PARSE_OK)
+		for (i=first; i<pctx->vars.count; i++)
+			((Var*) vector_item(&pctx->vars, i))->type = type;
 	return status;
 }
 
-static ParseStatus parse_vars(ParseCtx *pctx, Var **result, int* var_count) {
+static ParseStatus parse_vars(ParseCtx *pctx, Proc* proc) {
 	ParseStatus status;
-	Var* first;
-	Var* last;
 
-	if (peek_token(pctx) != TK_VAR) {
-		*result = NULL;
+	if (peek_token(pctx) != TK_VAR)
 		return PARSE_OK;
-	}
 	next_token(pctx);
 
-	first = last = NULL;
 	do {
-		Var* fst;
-		Var* lst;
-		status = parse_var(pctx, var_count, &fst, &lst);
-		if (status == PARSE_OK) {
-			if (!first)
-				first = fst;
-			if (last)
-				last->next = fst;
-			last = lst;
-		}
+		status = parse_var(pctx);
 	} while ((status == PARSE_OK) && (peek_token(pctx) == TK_ID));
 
-	if (status != PARSE_OK) {
-		if (first)
-			free_var(first);
-		return status;
+	if (status == PARSE_OK) {
+		proc->var_count = pctx->vars.count;
+		proc->vars = (Var*) vector_to_arena(pctx, &pctx->vars);
+		if (!proc->vars)
+			status = PARSE_NO_MEM;
 	}
+	return status;
+}
 
-	*result = first;
+static inline ParseStatus add_expr(ParseCtx* pctx, Expr* expr, NodeIndex* result) {
+	if (!push_item(&pctx->exprs, expr))
+		return PARSE_NO_MEM;
+	*result = pctx->exprs.count - 1;
 	return PARSE_OK;
 }
 
-static ParseStatus parse_expr(ParseCtx* pctx, Expr** result);
+static ParseStatus parse_expr(ParseCtx* pctx, NodeIndex* result);
 
-static inline ParseStatus parse_id_expr(ParseCtx* pctx, IdExpr** result) {
-	IdExpr *id;
+static inline ParseStatus parse_id_expr(ParseCtx* pctx, NodeIndex* result) {
+	Expr expr = { .type = EXPR_ID };
 
-	id = (IdExpr*) calloc(1, sizeof(IdExpr));
-	if (!id)
-		return PARSE_NO_MEM;
-	strcpy(&id->name[0], &pctx->lexer.lexeme[0]);
+	expr.content.as_id.name = token_symbol(pctx);
 	next_token(pctx);
-
-	*result = id;
-	return PARSE_OK;
+	if (!expr.content.as_id.name)
+		return PARSE_NO_MEM;
+	return add_expr(pctx, &expr, result);
 }
 
-static inline ParseStatus parse_num_expr(ParseCtx* pctx, NumExpr** result) {
-	NumExpr *num;
+static inline ParseStatus parse_num_expr(ParseCtx* pctx, NodeIndex* result) {
+	Expr expr = { .type = EXPR_NUM };
+	const char *text;
+	int size;
 
-	num = (NumExpr*) calloc(1, sizeof(NumExpr));
-	if (!num)
-		return PARSE_NO_MEM;
-	num->value = atoi(&pctx->lexer.lexeme[0]);
+	text = token_text(pctx, &size);
+	expr.content.as_num.value = lexeme_int(text, size);
 	next_token(pctx);
-
-	*result = num;
-	return PARSE_OK;
+	return add_expr(pctx, &expr, result);
 }
 
-static ParseStatus parse_atom_expr(ParseCtx* pctx, Expr** result) {
-	Expr *expr;
+static ParseStatus parse_atom_expr(ParseCtx* pctx, NodeIndex* result) {
 	ParseStatus status;
 
-	expr = NULL;
-	if (peek_token(pctx) == TK_ID) {
-		expr = (Expr*) calloc(1, sizeof(Expr));
-		if (!expr)
-			return PARSE_NO_MEM;
-		expr->type = EXPR_ID;
-		status = parse_id_expr(pctx, &expr->content.as_id);
-	} else if (peek_token(pctx) == TK_NUM) {
-		expr = (Expr*) calloc(1, sizeof(Expr));
-		if (!expr)
-			return PARSE_NO_MEM;
-		expr->type = EXPR_NUM;
-		status = parse_num_expr(pctx, &expr->content.as_num);
-	} else if (peek_token(pctx) == TK_LPAREN) {
+	if (peek_token(pctx) == TK_ID)
+		status = parse_id_expr(pctx, result);
+	else if (peek_token(pctx) == TK_NUM)
+		status = parse_num_expr(pctx, result);
+	else if (peek_token(pctx) == TK_LPAREN) {
 		next_token(pctx);
-		status = parse_expr(pctx, &expr);
-		if (status == PARSE_OK) {
-			if (peek_token(pctx) == TK_RPAREN)
-				next_token(pctx);
-			else
-				status = PARSE_SYNTAX_ERROR;
-		}
+		status = parse_expr(pctx, result);
+		if (status == PARSE_OK)
+			status = expect(pctx, TK_RPAREN);
 	} else
 		status = PARSE_SYNTAX_ERROR;
-
-	if (status == PARSE_OK) 
-		*result = expr;
-	else if (expr)
-		free_expr(expr);
 	return status;
 }
 
-static ParseStatus parse_params(ParseCtx* pctx, Param** result) {
+/* arguments of nested calls pile up on arg_stack until their call ends */
+static inline ParseStatus parse_call_expr(ParseCtx* pctx, NodeIndex lvalue, NodeIndex* result) {
 	ParseStatus status;
-	Param* param;
+	Expr expr = { .type = EXPR_CALL };
+	unsigned mark = pctx->arg_stack.count;
 
-	if (peek_token(pctx) == TK_RPAREN) {
-		*result = NULL;
-		return PARSE_OK;
-	}
-
-	param = (Param*) calloc(1, sizeof(Param));
-	if (!param)
-		return PARSE_NO_MEM;
+	next_token(pctx);
 
-	status = parse_expr(pctx, &param->value);
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_COMMA) {
-			Param* tail;
+	status = PARSE_OK;
+	while ((status == PARSE_OK) && (peek_token(pctx) != TK_RPAREN)) {
+		NodeIndex arg;
 
+		status = parse_expr(pctx, &arg);
+		if ((status == PARSE_OK) && !push_item(&pctx->arg_stack, &arg))
+			status = PARSE_NO_MEM;
+		if ((status == PARSE_OK) && (peek_token(pctx) == TK_COMMA))
 			next_token(pctx);
-			status = parse_params(pctx, &tail);
-			if (status == PARSE_OK)
-				param->next = tail;
-		}
-	}
-
-	if (status != PARSE_OK) {
-		free_param(param);
-		return status;
+		else
+			break;
 	}
 
-	*result = param;
-	return PARSE_OK;
-}
-
-static inline ParseStatus parse_call_expr(ParseCtx* pctx, Expr *lvalue, Expr** result) {
-	ParseStatus status;
-	Expr* expr;
-	CallExpr* call;
-
-	next_token(pctx);
-
-	expr = (Expr*) calloc(1, sizeof(Expr));
-	if (!expr)
-		return PARSE_NO_MEM;
-	expr->type = EXPR_CALL;
-	call = (CallExpr*) calloc(1, sizeof(CallExpr));
-	if (call) {
-		expr->content.as_call = call;
-		call->lvalue = lvalue;
-		status = parse_params(pctx, &call->first_param);
-		if (status == PARSE_OK) {
-			if (peek_token(pctx) == TK_RPAREN)
-				next_token(pctx);
-			else
-				status = PARSE_SYNTAX_ERROR;
-		}
-	} else {
-		free(lvalue);
-		status = PARSE_NO_MEM;
-	}
- 
 	if (status == PARSE_OK)
-		*result = expr;
-	else
-		free_expr(expr);
+		status = expect(pctx, TK_RPAREN);
+	if (status == PARSE_OK)
+		status = move_items(&pctx->args, &pctx->arg_stack, mark, &expr.content.as_call.args);
+	if (status == PARSE_OK) {
+		expr.content.as_call.lvalue = lvalue;
+		status = add_expr(pctx, &expr, result);
+	}
 	return status;
 }
 
-static ParseStatus parse_single_expr(ParseCtx* pctx, Expr** result) {
-	Expr* expr;
+static ParseStatus parse_single_expr(ParseCtx* pctx, NodeIndex* result) {
 	ParseStatus status;
 
-	status = parse_atom_expr(pctx, &expr);
+	status = parse_atom_expr(pctx, result);
 	if ((status == PARSE_OK) && (peek_token(pctx) == TK_LPAREN))
-		status = parse_call_expr(pctx, expr, &expr);
-
-	if (status == PARSE_OK)
-		*result = expr;
+		status = parse_call_expr(pctx, *result, result);
 	return status;
 }
 
-static ParseStatus parse_mult_expr(ParseCtx* pctx, Expr** result) {
-	Expr* expr;
-	ParseStatus status;
-
-	status = parse_single_expr(pctx, &expr);
-	if (status != PARSE_OK)
-		return status;
+/* folds the pending operators from mark on binding at least precedence into *result */
+static inline ParseStatus reduce_ops(ParseCtx* pctx, unsigned mark, int precedence, NodeIndex* result) {
+	ParseStatus status = PARSE_OK;
 
-	while (peek_token(pctx) == TK_MULT) {
-		Expr* mult;
-		BinaryExpr *bin;
+	while ((status == PARSE_OK) && (pctx->op_stack.count > mark)) {
+		PendingOp* top = (PendingOp*) vector_item(&pctx->op_stack, pctx->op_stack.count - 1);
+		Expr bin = { .type = EXPR_BINARY };
 
-		next_token(pctx);
-		mult = (Expr*) calloc(1, sizeof(Expr));
-		if (!mult) {
-			status = PARSE_NO_MEM;
+		if (top->precedence < precedence)
 			break;
-		}
-		mult->type = EXPR_BINARY;
-		bin = (BinaryExpr*) calloc(1, sizeof(BinaryExpr));
-		if (!bin) {
-			free_expr(mult);
-			status = PARSE_NO_MEM;
-			break;
-		}
-		mult->content.as_binary = bin;
-
-		status = parse_single_expr(pctx, &bin->right);
-		if (status != PARSE_OK) {
-			free_expr(mult);
-			break;
-		}
-
-		bin->op = OP_MULT;
-		bin->left = expr;
-		expr = mult;
+		bin.content.as_binary.op = top->op;
+		bin.content.as_binary.left = top->left;
+		bin.content.as_binary.right = *result;
+		pctx->op_stack.count--;
+		status = add_expr(pctx, &bin, result);
 	}
-
-	if (status != PARSE_OK) {
-		free_expr(expr);
-		return status;
-	}
-
-	*result = expr;
-	return PARSE_OK;
+	return status;
 }
 
-static ParseStatus parse_add_expr(ParseCtx* pctx, Expr** result) {
-	Expr *expr;
+/*
+ * Pratt style operator precedence loop driven by BINARY_OPS. Left operands
+ * wait on op_stack, so a flat expression of any length is parsed in one
+ * frame and only parentheses and call arguments recurse. Operators are left
+ * associative and nodes still come out in post-order.
+ */
+ParseStatus parse_expr(ParseCtx* pctx, NodeIndex* result) {
+	unsigned mark = pctx->op_stack.count;
 	ParseStatus status;
 
-	status = parse_mult_expr(pctx, &expr);
-	if (status != PARSE_OK)
-		return status;
-
-	while (peek_token(pctx) == TK_ADD) {
-		Expr *add;
-		BinaryExpr *bin;
+	status = parse_single_expr(pctx, result);
+	while (status == PARSE_OK) {
+		const BinaryOpInfo* info = &BINARY_OPS[peek_token(pctx)];
+		PendingOp pending;
 
-		next_token(pctx);
-		add = (Expr*) calloc(1, sizeof(Expr));
-		if (!add) {
-			status = PARSE_NO_MEM;
+		status = reduce_ops(pctx, mark, info->precedence, result);
+		if ((status != PARSE_OK) || !info->precedence)
 			break;
-		}
-		add->type = EXPR_BINARY;
-		bin = (BinaryExpr*) calloc(1, sizeof(BinaryExpr));
-		if (!bin) {
-			free_expr(add);
-			status = PARSE_NO_MEM;
-			break;
-		}
-		add->content.as_binary = bin;
 
-		status = parse_mult_expr(pctx, &bin->right);
-		if (status != PARSE_OK) {
-			free_expr(add);
-			break;
+		pending.op = info->op;
+		pending.precedence = info->precedence;
+		pending.left = *result;
+		if (!push_item(&pctx->op_stack, &pending))
+			status = PARSE_NO_MEM;
+		else {
+			next_token(pctx);
+			status = parse_single_expr(pctx, result);
 		}
-
-		bin->op = OP_ADD;
-		bin->left = expr;
-		expr = add;
-	}
-
-	if (status != PARSE_OK) {
-		free_expr(expr);
-		return status;
 	}
-
-	*result = expr;
-	return PARSE_OK;
-}
-
-ParseStatus parse_expr(ParseCtx* pctx, Expr** result) {
-	return parse_add_expr(pctx, result);
+	pctx->op_stack.count = mark;
+	return status;
 }
 
-static ParseStatus parse_stmts(ParseCtx* pctx, Stmt** result);
+static ParseStatus parse_stmts(ParseCtx* pctx, NodeRange* result);
 
-static ParseStatus parse_for(ParseCtx* pctx, ForStmt** result) {
+static ParseStatus parse_for(ParseCtx* pctx, ForStmt* forstmt) {
 	ParseStatus status;
-	ForStmt *forstmt;
-
-	forstmt = (ForStmt*) calloc(1, sizeof(ForStmt));
-	if (!forstmt)
-		return PARSE_NO_MEM;
 
 	next_token(pctx);
 	if (peek_token(pctx) != TK_ID)
 		return PARSE_SYNTAX_ERROR;
-	strcpy(&forstmt->id[0], &pctx->lexer.lexeme[0]);
+	forstmt->id = token_symbol(pctx);
 	next_token(pctx);
 
-	status = PARSE_OK;
-	if (peek_token(pctx) == TK_ASSIGN)
-		next_token(pctx);
-	else
-		status = PARSE_SYNTAX_ERROR;
-
+	status = forstmt->id ? PARSE_OK : PARSE_NO_MEM;
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_ASSIGN);
 	if (status == PARSE_OK)
 		status = parse_expr(pctx, &forstmt->from);
-
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_TO)
-			next_token(pctx);
-		else
-			status = PARSE_SYNTAX_ERROR;
-	}
-
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_TO);
 	if (status == PARSE_OK)
 		status = parse_expr(pctx, &forstmt->to);
-
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_DO)
-			next_token(pctx);
-		else
-			status = PARSE_SYNTAX_ERROR;
-	}
-
 	if (status == PARSE_OK)
-		status = parse_stmts(pctx, &forstmt->first_stmt);
-
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_DONE)
-			next_token(pctx);
-		else
-			status = PARSE_SYNTAX_ERROR;
-	}
-
-	if (status != PARSE_OK) {
-		free_for(forstmt);
-		return status;
-	}
-
-	*result = forstmt;
-	return PARSE_OK;
-}
-
-static ParseStatus parse_return(ParseCtx* pctx, ReturnStmt** result) {
-	ReturnStmt *ret;
-
-	next_token(pctx);
-	ret = (ReturnStmt*) calloc(1, sizeof(ReturnStmt));
-	if (!ret)
-		return PARSE_NO_MEM;
-	ret->proc = pctx->current_proc;
-	ret->expr = NULL;
-
-	if (peek_token(pctx) != TK_SEMI) {
-		ParseStatus status = parse_expr(pctx, &ret->expr);
-		if (status != PARSE_OK) {
-			free_return(ret);
-			return status;
-		}		
-	}
-
-	*result = ret;
-	return PARSE_OK;
+		status = expect(pctx, TK_DO);
+	if (status == PARSE_OK)
+		status = parse_stmts(pctx, &forstmt->body);
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_DONE);
+	return status;
 }
 
-static ParseStatus parse_assign(ParseCtx* pctx, Expr* lvalue, AssignStmt** result) {
-	AssignStmt *assign;
-	ParseStatus status;
-
+static ParseStatus parse_return(ParseCtx* pctx, ReturnStmt* ret) {
 	next_token(pctx);
-	assign = (AssignStmt*) calloc(1, sizeof(AssignStmt));
-	if (!assign)
-		return PARSE_NO_MEM;
-
-	assign->lvalue = lvalue;
-	status = parse_expr(pctx, &assign->rvalue);
-	if (status != PARSE_OK) {
-		free_assign(assign);
-		return status;
-	}
-
-	*result = assign;
+	ret->expr = NO_NODE;
+	if (peek_token(pctx) != TK_SEMI)
+		return parse_expr(pctx, &ret->expr);
 	return PARSE_OK;
 }
 
-static ParseStatus parse_call(ParseCtx* pctx, Expr* lvalue, CallStmt** result) {
-	CallStmt *call;
-
-	call = (CallStmt*) calloc(1, sizeof(CallStmt));
-	if (!call)
-		return PARSE_NO_MEM;
-	call->expr = lvalue;
-
-	*result = call;
-	return PARSE_OK;
-}
-
-ParseStatus parse_stmts(ParseCtx* pctx, Stmt** result) {
+static ParseStatus parse_stmt(ParseCtx* pctx, Stmt* stmt) {
 	ParseStatus status;
-	Stmt* stmt;
-
-	if ((peek_token(pctx) == TK_END) || (peek_token(pctx) == TK_DONE)) {
-		*result = NULL;
-		return PARSE_OK;
-	}
-
-	stmt = (Stmt*) calloc(1, sizeof(Stmt));
-	if (!stmt)
-		return PARSE_NO_MEM;
 
+	memset(stmt, 0, sizeof(Stmt));
 	if (peek_token(pctx) == TK_FOR) {
 		stmt->type = STMT_FOR;
 		status = parse_for(pctx, &stmt->content.as_for);
@@ -745,195 +488,607 @@ ParseStatus parse_stmts(ParseCtx* pctx, Stmt** result) {
 		stmt->type = STMT_RETURN;
 		status = parse_return(pctx, &stmt->content.as_return);
 	} else {
-		Expr* expr;
+		NodeIndex expr;
 		status = parse_expr(pctx, &expr);
 		if (status == PARSE_OK) {
 			if (peek_token(pctx) == TK_ASSIGN) {
+				next_token(pctx);
 				stmt->type = STMT_ASSIGN;
-				status = parse_assign(pctx, expr, &stmt->content.as_assign);
+				stmt->content.as_assign.lvalue = expr;
+				status = parse_expr(pctx, &stmt->content.as_assign.rvalue);
 			} else {
 				stmt->type = STMT_CALL;
-				status = parse_call(pctx, expr, &stmt->content.as_call);
+				stmt->content.as_call.expr = expr;
 			}
-			if (status != PARSE_OK)
-				free_expr(expr);
 		}
 	}
 
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_SEMI);
+	return status;
+}
+
+/* statements of enclosing blocks wait on stmt_stack while a loop body is parsed */
+ParseStatus parse_stmts(ParseCtx* pctx, NodeRange* result) {
+	ParseStatus status = PARSE_OK;
+	unsigned mark = pctx->stmt_stack.count;
+
+	while ((status == PARSE_OK)
+		&& (peek_token(pctx) != TK_END) && (peek_token(pctx) != TK_DONE)) {
+		Stmt stmt;
+
+		status = parse_stmt(pctx, &stmt);
+		if ((status == PARSE_OK) && !push_item(&pctx->stmt_stack, &stmt))
+			status = PARSE_NO_MEM;
+	}
+
+	if (status == PARSE_OK)
+		status = move_items(&pctx->stmts, &pctx->stmt_stack, mark, result);
+	return status;
+}
+
+static inline ParseStatus finish_proc(ParseCtx *pctx, Proc *proc) {
+	proc->expr_count = pctx->exprs.count;
+	proc->exprs = (Expr*) vector_to_arena(pctx, &pctx->exprs);
+	proc->stmt_count = pctx->stmts.count;
+	proc->stmts = (Stmt*) vector_to_arena(pctx, &pctx->stmts);
+	proc->arg_count = pctx->args.count;
+	proc->args = (NodeIndex*) vector_to_arena(pctx, &pctx->args);
+	return (proc->exprs && proc->stmts && proc->args) ? PARSE_OK : PARSE_NO_MEM;
+}
+
+static ParseStatus parse_proc_end(ParseCtx *pctx, Proc *proc) {
+	ParseStatus status = expect(pctx, TK_END);
+
 	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_SEMI)
+		if (peek_token(pctx) == TK_ID) {
+			if (token_symbol(pctx) != proc->id)
+				proc->mismatch = 1;
 			next_token(pctx);
+		}
 		else
 			status = PARSE_SYNTAX_ERROR;
 	}
 
-	if (status == PARSE_OK) {
-		Stmt* tail;
-		status = parse_stmts(pctx, &tail);
-		if (status == PARSE_OK)
-			stmt->next = tail;
-	}
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_SEMI);
+	return status;
+}
 
-	if (status != PARSE_OK) {
-		free_stmt(stmt);
-		return status;
-	}
+/* vars, begin, statements and end */
+static ParseStatus parse_proc_rest(ParseCtx *pctx, Proc *proc) {
+	ParseStatus status;
 
-	*result = stmt;
-	return PARSE_OK;
+	status = parse_vars(pctx, proc);
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_BEGIN);
+	if (status == PARSE_OK)
+		status = parse_stmts(pctx, &proc->body);
+	if (status == PARSE_OK)
+		status = parse_proc_end(pctx, proc);
+	if (status == PARSE_OK)
+		status = finish_proc(pctx, proc);
+	return status;
 }
 
-static ParseStatus parse_proc(ParseCtx *pctx, int nid, Proc **result) {
+/* statements close with done, so the first end keyword closes the procedure */
+static ParseStatus skip_proc_rest(ParseCtx *pctx, Proc *proc) {
+	TokenStream* tokens = pctx->tokens;
+
+	proc->lazy = 1;
+	proc->body_token = pctx->position;
+	while ((tokens->kind[pctx->position] != TK_END) && (tokens->kind[pctx->position] != TK_EOF))
+		pctx->position++;
+	return parse_proc_end(pctx, proc);
+}
+
+static ParseStatus parse_proc(ParseCtx *pctx, int nid, Proc *proc) {
 	ParseStatus status;
-	Proc* proc;
-	Context* saved_context;
 
+	memset(proc, 0, sizeof(Proc));
 	if (peek_token(pctx) != TK_PROCEDURE)
 		return PARSE_SYNTAX_ERROR;
 	next_token(pctx);
 
 	if (peek_token(pctx) != TK_ID)
 		return PARSE_SYNTAX_ERROR;
-	proc = (Proc*) calloc(1, sizeof(Proc));
-	if (!proc)
-		return PARSE_NO_MEM;
 	proc->nid = nid;
-	strcpy(&proc->id[0], &pctx->lexer.lexeme[0]);
+	proc->id = token_symbol(pctx);
 	next_token(pctx);
 
-	saved_context = pctx->upper_context;
-	init_context(&proc->ctx, saved_context);
-	pctx->upper_context = &proc->ctx;
+	status = proc->id ? PARSE_OK : PARSE_NO_MEM;
 
-	status = parse_fparams(pctx, &proc->first_fparam, &proc->fparam_count);
+	if (status == PARSE_OK)
+		status = parse_fparams(pctx, proc);
 
 	if ((status == PARSE_OK) && (peek_token(pctx) == TK_COLON)) {
 		next_token(pctx);
 		proc->is_function = 1;
-		status = parse_type(pctx, &proc->return_type[0]);
+		status = parse_type(pctx, &proc->return_type);
+	}
+
+	if (status == PARSE_OK)
+		status = expect(pctx, TK_SEMI);
+	if (status == PARSE_OK)
+		status = pctx->lazy ? skip_proc_rest(pctx, proc) : parse_proc_rest(pctx, proc);
+	return status;
+}
+
+static ParseStatus parse_procs(ParseCtx* pctx, Prog* prog) {
+	ParseStatus status = PARSE_OK;
+	int i;
+
+	while ((status == PARSE_OK) && (peek_token(pctx) != TK_EOF)) {
+		Proc proc;
+
+		status = parse_proc(pctx, pctx->procs.count, &proc);
+		if ((status == PARSE_OK) && !push_item(&pctx->procs, &proc))
+			status = PARSE_NO_MEM;
 	}
 
 	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_SEMI)
-			next_token(pctx);
-		else
-			status = PARSE_SYNTAX_ERROR;
+		prog->proc_count = pctx->procs.count;
+		prog->procs = (Proc*) vector_to_arena(pctx, &pctx->procs);
+		if (!prog->procs)
+			return PARSE_NO_MEM;
+		for (i=0; i<prog->proc_count; i++)
+			init_context(&prog->procs[i].ctx, &prog->ctx, pctx->arena);
 	}
+	return status;
+}
+
+static Prog* new_prog(Interner* names) {
+	Prog* prog = (Prog*) calloc(1, sizeof(Prog));
+	if (prog) {
+		init_arena(&prog->arena);
+		prog->names = names;
+		init_context(&prog->ctx, &BUILTIN, &prog->arena);
+		init_type_table(&prog->types, &prog->arena);
+	}
+	return prog;
+}
+
+static ParseStatus parse_prog(ParseCtx* pctx, Prog** result) {
+	Prog* prog;
+	ParseStatus status;
+
+	prog = new_prog(pctx->names);
+	if (!prog)
+		return PARSE_NO_MEM;
+	pctx->arena = &prog->arena;
+
+	status = parse_procs(pctx, prog);
 
 	if (status == PARSE_OK)
-		status = parse_vars(pctx, &proc->first_var, &proc->var_count);
+		*result = prog;
+	else
+		free_prog(prog);
 
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_BEGIN) {
-			next_token(pctx);
-			pctx->current_proc = proc;
-		}
-		else
-			status = PARSE_SYNTAX_ERROR;
+	return status;
+}
+
+static inline void init_parser(ParseCtx *pctx, Interner* names, TokenStream* tokens) {
+	pctx->names = names;
+	pctx->tokens = tokens;
+	pctx->position = 0;
+	pctx->arena = NULL;
+	pctx->move_next = 1;
+	pctx->lazy = 0;
+	init_vector(&pctx->procs, sizeof(Proc));
+	init_vector(&pctx->fparams, sizeof(FParam));
+	init_vector(&pctx->vars, sizeof(Var));
+	init_vector(&pctx->exprs, sizeof(Expr));
+	init_vector(&pctx->args, sizeof(NodeIndex));
+	init_vector(&pctx->arg_stack, sizeof(NodeIndex));
+	init_vector(&pctx->op_stack, sizeof(PendingOp));
+	init_vector(&pctx->stmts, sizeof(Stmt));
+	init_vector(&pctx->stmt_stack, sizeof(Stmt));
+}
+
+static inline void destroy_parser(ParseCtx *pctx) {
+	destroy_vector(&pctx->procs);
+	destroy_vector(&pctx->fparams);
+	destroy_vector(&pctx->vars);
+	destroy_vector(&pctx->exprs);
+	destroy_vector(&pctx->args);
+	destroy_vector(&pctx->arg_stack);
+	destroy_vector(&pctx->op_stack);
+	destroy_vector(&pctx->stmts);
+	destroy_vector(&pctx->stmt_stack);
+}
+
+ParseStatus parse(GetChar input_fun, void* user_data, Interner* names, Prog **result) {
+	ParseCtx pctx;
+	ParseStatus status;
+
+	if (!init_lexer(&pctx.lexer, input_fun, user_data, names))
+		return PARSE_NO_MEM;
+	init_parser(&pctx, names, NULL);
+	status = parse_prog(&pctx, result);
+	destroy_parser(&pctx);
+	destroy_lexer(&pctx.lexer);
+	return status;
+}
+
+ParseStatus parse_buffer(const char* data, size_t size, Interner* names, Prog **result) {
+	ParseCtx pctx;
+	ParseStatus status;
+
+	init_lexer_buffer(&pctx.lexer, data, size, names);
+	init_parser(&pctx, names, NULL);
+	status = parse_prog(&pctx, result);
+	destroy_parser(&pctx);
+	return status;
+}
+
+/*
+ * A run of consecutive procedures parsed by one thread into its own arena.
+ * Procs go straight to their nid slot of the Prog, which is sized by the
+ * pre-scan; the arena is merged into the Prog's once the thread is done.
+ */
+typedef struct ParseChunk {
+	TokenStream*  tokens;
+	Interner*     names;
+	Prog*         prog;
+	Arena         arena;
+	int           first_proc;
+	int           proc_count;
+	int           from;
+	int           until;
+	ParseStatus   status;
+	int           started;
+	pthread_t     thread;
+} ParseChunk;
+
+static void* parse_chunk(void* arg) {
+	ParseChunk* chunk = (ParseChunk*) arg;
+	Prog* prog = chunk->prog;
+	ParseCtx pctx;
+	int i;
+
+	init_lexer_buffer(&pctx.lexer, chunk->tokens->buffer, 0, chunk->names);
+	init_parser(&pctx, chunk->names, chunk->tokens);
+	pctx.position = chunk->from;
+	pctx.arena = &chunk->arena;
+
+	chunk->status = PARSE_OK;
+	for (i=chunk->first_proc; (chunk->status == PARSE_OK)
+		&& (i<chunk->first_proc + chunk->proc_count); i++) {
+		chunk->status = parse_proc(&pctx, i, &prog->procs[i]);
+		init_context(&prog->procs[i].ctx, &prog->ctx, &prog->arena);
 	}
+	/* anything between the last procedure and the next chunk */
+	if ((chunk->status == PARSE_OK) && (pctx.position != chunk->until))
+		chunk->status = PARSE_SYNTAX_ERROR;
 
-	status = parse_stmts(pctx, &proc->first_stmt);
+	destroy_parser(&pctx);
+	return NULL;
+}
 
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_END)
-			next_token(pctx);
-		else
-			status = PARSE_SYNTAX_ERROR;
+/* chunk boundaries are procedure keywords, which only ever start a procedure */
+static inline int split_procs(ParseChunk* chunks, int count, TokenStream* tokens, int* starts,
+	int proc_count) {
+	int i, n;
+
+	n = 0;
+	for (i=0; i<count; i++) {
+		int first = (int)((long) proc_count * i / count);
+		int until = (int)((long) proc_count * (i + 1) / count);
+		if (first == until)
+			continue;
+		chunks[n].first_proc = first;
+		chunks[n].proc_count = until - first;
+		chunks[n].from = first ? starts[first] : 0;
+		chunks[n].until = (until < proc_count) ? starts[until] : tokens->count - 1;
+		n++;
 	}
+	return n;
+}
 
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_ID) {
-			if (strcmp(&proc->id[0], &pctx->lexer.lexeme[0]) == 0)
-				proc->mismatch = 1;
-			next_token(pctx);
-		}
-		else
-			status = PARSE_SYNTAX_ERROR;
+static ParseStatus parse_parallel(TokenStream* tokens, Interner* names, int threads,
+	int* starts, int proc_count, Prog** result) {
+	ParseChunk* chunks;
+	ParseStatus status;
+	Prog* prog;
+	int i, count;
+
+	chunks = (ParseChunk*) calloc(threads, sizeof(ParseChunk));
+	prog = new_prog(names);
+	if (prog)
+		prog->procs = (Proc*) arena_alloc(&prog->arena, proc_count * sizeof(Proc));
+	if (!chunks || !prog || !prog->procs) {
+		free(chunks);
+		if (prog)
+			free_prog(prog);
+		return PARSE_NO_MEM;
+	}
+	prog->proc_count = proc_count;
+
+	count = split_procs(chunks, threads, tokens, starts, proc_count);
+	for (i=0; i<count; i++) {
+		chunks[i].tokens = tokens;
+		chunks[i].names = names;
+		chunks[i].prog = prog;
+		init_arena(&chunks[i].arena);
 	}
 
-	if (status == PARSE_OK) {
-		if (peek_token(pctx) == TK_SEMI)
-			next_token(pctx);
-		else
-			status = PARSE_SYNTAX_ERROR;
+	for (i=1; i<count; i++) {
+		chunks[i].started = pthread_create(&chunks[i].thread, NULL, parse_chunk, &chunks[i]) == 0;
+		if (!chunks[i].started)
+			parse_chunk(&chunks[i]);
 	}
+	parse_chunk(&chunks[0]);
+	for (i=1; i<count; i++)
+		if (chunks[i].started)
+			pthread_join(chunks[i].thread, NULL);
+
+	/* the first failing chunk is where a serial parse would have stopped */
+	status = PARSE_OK;
+	for (i=0; i<count; i++) {
+		if (status == PARSE_OK)
+			status = chunks[i].status;
+		merge_arena(&prog->arena, &chunks[i].arena);
+	}
+	free(chunks);
 
-	pctx->upper_context = saved_context;
 	if (status == PARSE_OK)
-		*result = proc;
+		*result = prog;
 	else
-		free_proc(proc);
+		free_prog(prog);
 	return status;
 }
 
-static ParseStatus parse_procs(ParseCtx* pctx, Proc** result, int* proc_count) {
-	Proc* proc;
+ParseStatus parse_tokens(TokenStream* tokens, Interner* names, int threads, Prog **result) {
+	ParseCtx pctx;
 	ParseStatus status;
+	int* starts;
+	int proc_count;
+	int i;
+
+	if (threads > 1) {
+		proc_count = 0;
+		for (i=0; i<tokens->count; i++)
+			proc_count += tokens->kind[i] == TK_PROCEDURE;
+		if (threads > proc_count / MIN_PROCS_PER_THREAD)
+			threads = proc_count / MIN_PROCS_PER_THREAD;
+	}
 
-	if (peek_token(pctx) == TK_EOF) {
-		*result = NULL;
-		return PARSE_OK;
+	if (threads > 1) {
+		starts = (int*) malloc(proc_count * sizeof(int));
+		if (!starts)
+			return PARSE_NO_MEM;
+		proc_count = 0;
+		for (i=0; i<tokens->count; i++)
+			if (tokens->kind[i] == TK_PROCEDURE)
+				starts[proc_count++] = i;
+		status = parse_parallel(tokens, names, threads, starts, proc_count, result);
+		free(starts);
+		return status;
 	}
 
-	status = parse_proc(pctx, *proc_count, &proc);
-	if (status == PARSE_OK) {
-		Proc* tail;
+	init_lexer_buffer(&pctx.lexer, tokens->buffer, 0, names);
+	init_parser(&pctx, names, tokens);
+	status = parse_prog(&pctx, result);
+	destroy_parser(&pctx);
+	return status;
+}
 
-		(*proc_count)++;
-		status = parse_procs(pctx, &tail, proc_count);
-		if (status == PARSE_OK) {
-			proc->next = tail;
-			*result = proc;
+ParseStatus parse_tokens_lazy(TokenStream* tokens, Interner* names, Prog **result) {
+	ParseCtx pctx;
+	ParseStatus status;
+
+	init_lexer_buffer(&pctx.lexer, tokens->buffer, 0, names);
+	init_parser(&pctx, names, tokens);
+	pctx.lazy = 1;
+	status = parse_prog(&pctx, result);
+	if (status == PARSE_OK)
+		(*result)->tokens = tokens;
+	destroy_parser(&pctx);
+	return status;
+}
+
+ParseStatus parse_proc_body(Prog* prog, Proc* proc) {
+	ParseCtx pctx;
+	ParseStatus status;
+
+	init_lexer_buffer(&pctx.lexer, prog->tokens->buffer, 0, prog->names);
+	init_parser(&pctx, prog->names, prog->tokens);
+	pctx.position = proc->body_token;
+	pctx.arena = &prog->arena;
+	status = parse_proc_rest(&pctx, proc);
+	if (status == PARSE_OK)
+		proc->lazy = 0;
+	destroy_parser(&pctx);
+	return status;
+}
+
+/*
+ * Streaming: a procedure is bound, checked and compiled right after it is
+ * parsed. Its body lives in its own arena, which is reset for the next
+ * procedure once the InterpCode exists; the header stays in the Prog
+ * arena for callers. A procedure using a name not declared yet is parked
+ * with its arena until that name is declared.
+ */
+typedef struct PendingProc {
+	Proc*     proc;
+	Arena     body;
+	unsigned  position;
+	Symbol    missing;
+} PendingProc;
+
+typedef struct StreamCtx {
+	Prog*   prog;
+	Arena   scratch;
+	Vector  pending;
+} StreamCtx;
+
+static inline void release_body(Proc* proc) {
+	init_context(&proc->ctx, proc->ctx.upper_context, proc->ctx.arena);
+	proc->fparams = NULL;
+	proc->vars = NULL;
+	proc->expr_count = 0;
+	proc->exprs = NULL;
+	proc->stmt_count = 0;
+	proc->stmts = NULL;
+	proc->arg_count = 0;
+	proc->args = NULL;
+}
+
+/* *waiting when a name used by the body is still undeclared */
+static StreamStatus advance_proc(StreamCtx* sctx, PendingProc* p, int* waiting) {
+	Proc* proc = p->proc;
+
+	*waiting = !resolve_proc_body(proc, &p->position, &p->missing);
+	if (*waiting)
+		return STREAM_OK;
+	if (!type_check_proc(proc))
+		return STREAM_TYPE_ERROR;
+	if (!compile_proc_code(proc, &sctx->scratch, &sctx->prog->interp.procs[proc->nid]))
+		return STREAM_NO_MEM;
+	release_body(proc);
+	return STREAM_OK;
+}
+
+static StreamStatus wake_pending(StreamCtx* sctx, Symbol id) {
+	StreamStatus status = STREAM_OK;
+	unsigned i = 0;
+
+	while ((status == STREAM_OK) && (i < sctx->pending.count)) {
+		PendingProc* p = (PendingProc*) vector_item(&sctx->pending, i);
+		int waiting = 1;
+
+		if (p->missing == id)
+			status = advance_proc(sctx, p, &waiting);
+		if (waiting)
+			i++;
+		else {
+			destroy_arena(&p->body);
+			sctx->pending.count--;
+			memcpy(p, vector_item(&sctx->pending, sctx->pending.count), sizeof(PendingProc));
 		}
-		else
-			free_proc(proc);
 	}
+	return status;
+}
 
+static inline StreamStatus stream_status(ParseStatus status) {
+	return (status == PARSE_NO_MEM) ? STREAM_NO_MEM : STREAM_SYNTAX_ERROR;
+}
+
+static StreamStatus stream_procs(ParseCtx* pctx, StreamCtx* sctx) {
+	Prog* prog = sctx->prog;
+	StreamStatus status = STREAM_OK;
+	PendingProc p;
+
+	init_arena(&p.body);
+	while ((status == STREAM_OK) && (peek_token(pctx) != TK_EOF)) {
+		ParseStatus parse_status;
+		int nid = prog->proc_count;
+		int waiting;
+
+		p.proc = (Proc*) arena_alloc(&prog->arena, sizeof(Proc));
+		if (!p.proc || !grow_interp(&prog->interp, nid + 1)) {
+			status = STREAM_NO_MEM;
+			break;
+		}
+		pctx->arena = &p.body;
+		parse_status = parse_proc(pctx, nid, p.proc);
+		if (parse_status != PARSE_OK) {
+			status = stream_status(parse_status);
+			break;
+		}
+		prog->proc_count++;
+
+		init_context(&p.proc->ctx, &prog->ctx, &p.body);
+		if (!declare_proc(prog, p.proc) || !resolve_proc_header(p.proc)) {
+			status = STREAM_NAME_ERROR;
+			break;
+		}
+		if (!type_check_header(&prog->types, p.proc)) {
+			status = STREAM_TYPE_ERROR;
+			break;
+		}
+		if (p.proc->id == SYMBOL_MAIN)
+			prog->interp.main = nid;
+
+		p.position = 0;
+		p.missing = NO_SYMBOL;
+		status = advance_proc(sctx, &p, &waiting);
+		if ((status == STREAM_OK) && waiting) {
+			if (push_item(&sctx->pending, &p))
+				init_arena(&p.body);
+			else
+				status = STREAM_NO_MEM;
+		} else
+			reset_arena(&p.body);
+
+		if (status == STREAM_OK)
+			status = wake_pending(sctx, p.proc->id);
+	}
+	destroy_arena(&p.body);
+
+	if ((status == STREAM_OK) && sctx->pending.count)
+		status = STREAM_NAME_ERROR;
+	if ((status == STREAM_OK) && !local_lookup(&prog->ctx, SYMBOL_MAIN))
+		status = STREAM_CODE_ERROR;
+	if ((status == STREAM_OK) && (!inline_procs(&prog->interp) || !optimize_loops(&prog->interp)))
+		status = STREAM_NO_MEM;
 	return status;
 }
 
-static ParseStatus parse_prog(ParseCtx* pctx, Prog** result) {
-	Prog* prog;
-	ParseStatus status;
-	Context* saved_context;
+static StreamStatus stream_prog(ParseCtx* pctx, Prog** result) {
+	StreamCtx sctx;
+	StreamStatus status;
+	unsigned i;
 
-	prog = (Prog*) calloc(1, sizeof(Prog));
-	if (!prog)
-		return PARSE_NO_MEM;
-	saved_context = pctx->upper_context;
-	init_context(&prog->ctx, saved_context);
-	pctx->upper_context = &prog->ctx;
+	sctx.prog = new_prog(pctx->names);
+	if (!sctx.prog)
+		return STREAM_NO_MEM;
+	init_arena(&sctx.scratch);
+	init_vector(&sctx.pending, sizeof(PendingProc));
 
-	status = parse_procs(pctx, &prog->first_proc, &prog->proc_count);
+	status = stream_procs(pctx, &sctx);
 
-	pctx->upper_context = saved_context;
-	if (status == PARSE_OK)
-		*result = prog;
-	else
-		free_prog(prog);
+	for (i=0; i<sctx.pending.count; i++)
+		destroy_arena(&((PendingProc*) vector_item(&sctx.pending, i))->body);
+	destroy_vector(&sctx.pending);
+	destroy_arena(&sctx.scratch);
 
+	if (status == STREAM_OK)
+		*result = sctx.prog;
+	else
+		free_prog(sctx.prog);
 	return status;
 }
 
-void init_parser(ParseCtx *pctx, GetChar input_fun, void* user_data) {
-	init_lexer(&pctx->lexer, input_fun, user_data);
-	pctx->upper_context = &BUILTIN;
-	pctx->current_proc = NULL;
-	next_token(pctx);
+StreamStatus compile_stream(GetChar input_fun, void* user_data, Interner* names, Prog **result) {
+	ParseCtx pctx;
+	StreamStatus status;
+
+	if (!init_lexer(&pctx.lexer, input_fun, user_data, names))
+		return STREAM_NO_MEM;
+	init_parser(&pctx, names, NULL);
+	status = stream_prog(&pctx, result);
+	destroy_parser(&pctx);
+	destroy_lexer(&pctx.lexer);
+	return status;
 }
 
-ParseStatus parse(GetChar input_fun, void* user_data, Prog **result) {
+StreamStatus compile_stream_buffer(const char* data, size_t size, Interner* names, Prog **result) {
 	ParseCtx pctx;
-	init_parser(&pctx, input_fun, user_data);
-	return parse_prog(&pctx, result);
+	StreamStatus status;
+
+	init_lexer_buffer(&pctx.lexer, data, size, names);
+	init_parser(&pctx, names, NULL);
+	status = stream_prog(&pctx, result);
+	destroy_parser(&pctx);
+	return status;
 }
 
 void free_prog(Prog *prog) {
 	assert(prog);
 
-	free_proc(prog->first_proc);
-	free_context(&prog->ctx);
+	destroy_arena(&prog->arena);
 	destroy_interp(&prog->interp);
 
 	free(prog);
-}
\ No newline at end of file
+}
@@ -2,6 +2,7 @@
 #define PARSER_H
 
 #include "lexer.h"
+#include "tokens.h"
 #include "interp.h"
 
 typedef struct Type     Type;
@@ -10,7 +11,6 @@ typedef struct Bind     Bind;
 typedef struct Context  Context;
 typedef struct Var      Var;
 typedef struct Expr     Expr;
-typedef struct Param    Param;
 typedef struct Stmt     Stmt;
 typedef struct Proc     Proc;
 
@@ -33,6 +33,18 @@ struct Type {
 	} content;
 };
 
+/*
+ * Every distinct procedure signature is built once, so two types are the
+ * same exactly when their pointers are; INTEGER is the only other type.
+ * Signatures and the table live in arena.
+ */
+typedef struct TypeTable {
+	Arena*    arena;
+	unsigned  count;
+	unsigned  mask;
+	Type**    table;
+} TypeTable;
+
 typedef struct ActualType {
 	Type*  type;
 	int    lvalue;
@@ -41,22 +53,35 @@ typedef struct ActualType {
 
 struct FParam {
 	int          nid;
-	char         id[MAX_LEXEME_SIZE+1];
-	char         type[MAX_LEXEME_SIZE+1];
+	Symbol       id;
+	Symbol       type;
 	Bind*        type_bind;
 	ActualType   actual_type;
-	FParam*      next; 
 };
 
 struct Var {
 	int          nid;
-	char         id[MAX_LEXEME_SIZE+1];
-	char         type[MAX_LEXEME_SIZE+1];
+	Symbol       id;
+	Symbol       type;
 	Bind*        type_bind;
 	ActualType   actual_type;
-	Var*         next;
 };
 
+/*
+ * Expressions and statements of a procedure live in flat arrays owned by
+ * the Proc and refer to each other by index. Expressions are stored in
+ * post-order, so the children of exprs[i] always come before i; statement
+ * blocks and call arguments are contiguous ranges of stmts and args.
+ */
+typedef unsigned NodeIndex;
+
+#define NO_NODE   ((NodeIndex) -1)
+
+typedef struct NodeRange {
+	unsigned  first;
+	unsigned  count;
+} NodeRange;
+
 typedef enum ExprType {
 	EXPR_BINARY,
 	EXPR_ID,
@@ -70,39 +95,35 @@ typedef enum BinaryOp {
 } BinaryOp;
 
 typedef struct BinaryExpr {
-	BinaryOp  op;
-	Expr*     left;
-	Expr*     right;	
+	BinaryOp   op;
+	NodeIndex  left;
+	NodeIndex  right;	
 } BinaryExpr;
 
 typedef struct IdExpr {
-	char   name[MAX_LEXEME_SIZE+1];
-	Bind*  bind;
+	Symbol  name;
+	Bind*   bind;
 } IdExpr;
 
 typedef struct NumExpr {
 	int value;
 } NumExpr;
 
-struct Param {
-	Expr*   value;
-	Param*  next;
-};
-
+/* args indexes proc->args, which holds expression indices */
 typedef struct CallExpr {
-	Expr*   lvalue;
-	Param*  first_param;
+	NodeIndex  lvalue;
+	NodeRange  args;
 } CallExpr;
 
 struct Expr {
-	ExprType         type;
+	ExprType        type;
 	union {
-		BinaryExpr*  as_binary;
-		IdExpr*      as_id;
-		NumExpr*     as_num;
-		CallExpr*    as_call;
+		BinaryExpr  as_binary;
+		IdExpr      as_id;
+		NumExpr     as_num;
+		CallExpr    as_call;
 	} content;
-	ActualType       actual_type;
+	ActualType      actual_type;
 };
 
 typedef enum StmtType {
@@ -113,36 +134,35 @@ typedef enum StmtType {
 } StmtType;
 
 typedef struct AssignStmt {
-	Expr*   lvalue;
-	Expr*   rvalue;
+	NodeIndex  lvalue;
+	NodeIndex  rvalue;
 } AssignStmt;
 
 typedef struct ForStmt {
-	char    id[MAX_LEXEME_SIZE+1];
-	Bind*   bind;
-	Expr*   from;
-	Expr*   to;
-	Stmt*   first_stmt;
+	Symbol     id;
+	Bind*      bind;
+	NodeIndex  from;
+	NodeIndex  to;
+	NodeRange  body;
 } ForStmt;
 
+/* expr is NO_NODE for a bare return */
 typedef struct ReturnStmt {
-	Proc*  proc;
-	Expr*  expr;
+	NodeIndex  expr;
 } ReturnStmt;
 
 typedef struct CallStmt {
-	Expr* expr;
+	NodeIndex  expr;
 } CallStmt;
 
 struct Stmt {
-	StmtType         type;
+	StmtType        type;
 	union {
-		AssignStmt*  as_assign;
-		ForStmt*     as_for;
-		ReturnStmt*  as_return;
-		CallStmt*    as_call;
+		AssignStmt  as_assign;
+		ForStmt     as_for;
+		ReturnStmt  as_return;
+		CallStmt    as_call;
 	} content;
-	Stmt*            next;
 };
 
 typedef enum BindType {
@@ -153,7 +173,7 @@ typedef enum BindType {
 } BindType;
 
 struct Bind {
-	const char*   id;
+	Symbol        id;
 	BindType      type;
 	union {
 		FParam*   as_fparam;
@@ -164,35 +184,59 @@ struct Bind {
 	Bind*         next;
 };
 
+/*
+ * Binds are chained from first_bind; once a scope holds more than a few,
+ * they are also indexed by symbol in an open addressing table, which is
+ * reallocated from arena as it fills up.
+ */
 struct Context {
 	Context*  upper_context;
+	Arena*    arena;
 	Bind*     first_bind;
+	unsigned  bind_count;
+	unsigned  mask;
+	Bind**    table;
 };
 
 struct Proc {
 	int         nid;
 	Context     ctx;
-	Type        type;
+	Type*       type;
 	ActualType  actual_type;
-	char        id[MAX_LEXEME_SIZE+1];
+	Symbol      id;
 	int         fparam_count;
-	FParam*     first_fparam;
+	FParam*     fparams;
 	int         is_function;
-	char        return_type[MAX_LEXEME_SIZE+1];
+	Symbol      return_type;
 	Bind*       return_type_bind;
 	ActualType  actual_return_type;
 	int         var_count;
-	Var*        first_var;
-	Stmt*       first_stmt;
+	Var*        vars;
+	NodeRange   body;
+	unsigned    expr_count;
+	Expr*       exprs;
+	unsigned    stmt_count;
+	Stmt*       stmts;
+	unsigned    arg_count;
+	NodeIndex*  args;
 	int         mismatch;
-	Proc*       next;
+	int         lazy;
+	int         body_token;
 };
 
+/*
+ * Everything reachable from a Prog but the interpreter code is allocated
+ * in its arena, so free_prog releases the whole AST at once.
+ */
 typedef struct Prog {
-	Context     ctx;
-	int         proc_count;
-	InterpProg  interp;
-	Proc*       first_proc;
+	Arena         arena;
+	Interner*     names;
+	Context       ctx;
+	int           proc_count;
+	Proc*         procs;
+	TypeTable     types;
+	TokenStream*  tokens;
+	InterpProg    interp;
 } Prog;
 
 typedef enum ParseStatus {
@@ -203,43 +247,164 @@ typedef enum ParseStatus {
 
 /* context */
 
-void init_context(Context* context, Context* upper_context);
+/* binds are allocated in arena */
+void init_context(Context* context, Context* upper_context, Arena* arena);
 
-void free_context(Context* context);
+Bind* local_lookup(Context* context, Symbol id);
 
-Bind* local_lookup(Context* context, const char* id);
+Bind* lookup(Context* context, Symbol id);
 
-Bind* lookup(Context* context, const char* id);
+Type* lookup_type(Context* context, Symbol id);
 
-Type* lookup_type(Context* context, const char* id);
+Bind* bind_fparam(Context* context, Symbol id, FParam* fparam);
 
-Bind* bind_fparam(Context* context, const char* id, FParam* fparam);
+Bind* bind_var(Context* context, Symbol id, Var* var);
 
-Bind* bind_var(Context* context, const char* id, Var* var);
+Bind* bind_proc(Context* context, Symbol id, Proc* proc);
 
-Bind* bind_proc(Context* context, const char* id, Proc* proc);
-
-Bind* bind_type(Context* context, const char* id, Type* type);
+Bind* bind_type(Context* context, Symbol id, Type* type);
 
 /* parsing */
 
-ParseStatus parse(GetChar input_fun, void* user_data, Prog **result);
+ParseStatus parse(GetChar input_fun, void* user_data, Interner* names, Prog **result);
+
+ParseStatus parse_buffer(const char* data, size_t size, Interner* names, Prog **result);
+
+/*
+ * With threads > 1 and enough procedures, runs of procedures are parsed
+ * in parallel; the Prog is the same as a serial parse would build.
+ */
+ParseStatus parse_tokens(TokenStream* tokens, Interner* names, int threads, Prog **result);
+
+/*
+ * Lazy mode: only procedure signatures are parsed, each body is skipped up
+ * to its end keyword and parsed, bound and type checked by compile when
+ * main first reaches it. tokens must outlive compile. Unreached bodies are
+ * never looked at, so errors in them go unreported.
+ */
+ParseStatus parse_tokens_lazy(TokenStream* tokens, Interner* names, Prog **result);
+
+/* parses the vars and body of a lazy procedure into the Prog arena */
+ParseStatus parse_proc_body(Prog* prog, Proc* proc);
 
 void free_prog(Prog *prog);
 
+/* streaming */
+
+typedef enum StreamStatus {
+	STREAM_OK,
+	STREAM_NO_MEM,
+	STREAM_SYNTAX_ERROR,
+	STREAM_NAME_ERROR,
+	STREAM_TYPE_ERROR,
+	STREAM_CODE_ERROR
+} StreamStatus;
+
+/*
+ * Parses, binds, type checks and compiles one procedure at a time, and
+ * drops each body once its InterpCode is built; procedures using names
+ * declared further down wait for them. The resulting Prog only keeps
+ * procedure headers (procs is NULL) next to its InterpProg.
+ */
+StreamStatus compile_stream(GetChar input_fun, void* user_data, Interner* names, Prog **result);
+
+StreamStatus compile_stream_buffer(const char* data, size_t size, Interner* names, Prog **result);
+
 /* name resolution */
 int resolve_binds(Prog* prog);
 
+/* per procedure steps of resolve_binds, for drivers that run them as procedures arrive */
+
+/* binds proc in the global context */
+int declare_proc(Prog* prog, Proc* proc);
+
+/* binds the return type, params and vars */
+int resolve_proc_header(Proc* proc);
+
+int resolve_proc_vars(Proc* proc);
+
+/*
+ * Binds the names used in the body, starting at *position. On failure
+ * *missing is the name not found and *position where to resume.
+ */
+int resolve_proc_body(Proc* proc, unsigned* position, Symbol* missing);
+
+/* single nodes, 0 when a name is not declared */
+int resolve_expr(Proc* proc, Expr* expr);
+
+int resolve_stmt(Proc* proc, Stmt* stmt);
+
 /* type checker */
-Type INTEGER;
+extern Type INTEGER;
+
+void init_type_table(TypeTable* types, Arena* arena);
+
+/* the one type with this signature, fparams may be a temporary array */
+Type* proc_type(TypeTable* types, Type* return_type, int fparams_count, Type** fparams);
 
 int type_check(Prog* prog);
 
-void destroy_type(Type* type);
+/* attaches param, var and return types; the procedure type comes from types */
+int type_check_header(TypeTable* types, Proc* proc);
+
+int type_check_vars(Proc* proc);
+
+int type_check_proc(Proc* proc);
+
+/* single nodes; the operands of expr must be checked already */
+int type_check_expr(Proc* proc, Expr* expr);
+
+int type_check_stmt(Proc* proc, Stmt* stmt);
+
+/*
+ * Constant folding, applied by the code generator as it walks a body in
+ * execution order: folded nodes are rewritten to EXPR_NUM, and values
+ * of vars and params are tracked in a Constants for straight-line code.
+ */
+typedef enum FoldResult {
+	FOLD_NONE,
+	FOLD_CONSTANT,       /* expr is now EXPR_NUM */
+	FOLD_REASSOCIATED,   /* (x op a) op b is now x op (a op b) */
+	FOLD_IDENTITY        /* x + 0 and x * 1 are now a copy of x */
+} FoldResult;
+
+typedef struct Constants {
+	int    var_count;
+	int*   values;
+	char*  known;
+} Constants;
+
+int init_constants(Constants* constants, Proc* proc, Arena* arena);
+
+/* the operands of expr must be folded already */
+FoldResult fold_bin_expr(Proc* proc, Expr* expr);
+
+/* 1 when a bound identifier is rewritten to its known value */
+int fold_id_expr(Constants* constants, Expr* expr);
+
+void assign_constant(Constants* constants, Bind* bind, Expr* value);
+
+void forget_constant(Constants* constants, Bind* bind);
+
+/* forgets everything assigned in stmts, loop variables included */
+void forget_assigned(Constants* constants, Proc* proc, NodeRange stmts);
 
 /* code generator */
 
 int compile(Prog* prog);
 
+/* scratch is reset when done */
+int compile_proc_code(Proc* proc, Arena* scratch, InterpCode* code);
+
+/*
+ * Binds, type checks and compiles in one walk over each procedure body,
+ * after a pass over the headers. Same code as resolve_binds, type_check
+ * and compile, but a failure does not tell which of them failed.
+ */
+int compile_fused(Prog* prog);
+
+/* compile_fused with the procedure bodies spread over threads */
+int compile_parallel(Prog* prog, int threads);
+
 
 #endif
\ No newline at end of file
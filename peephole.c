@@ -0,0 +1,181 @@
+#include "interp.h"
+
+#include <stdlib.h>
+
+/* the fused instruction for first followed by second, INTERP_INVALID when there is none */
+static inline InterpOp fused_op(InterpOp first, InterpOp second) {
+	switch (first) {
+	case INTERP_VAR:
+		if (second == INTERP_LOAD)
+			return INTERP_LOADVAR;
+		if (second == INTERP_STORE)
+			return INTERP_STOREVAR;
+		if (second == INTERP_INC)
+			return INTERP_INCVAR;
+		break;
+	case INTERP_PARAM:
+		if (second == INTERP_LOAD)
+			return INTERP_LOADPARAM;
+		if (second == INTERP_STORE)
+			return INTERP_STOREPARAM;
+		break;
+	case INTERP_PUSH:
+		if (second == INTERP_ADD)
+			return INTERP_ADDI;
+		if (second == INTERP_MUL)
+			return INTERP_MULI;
+		break;
+	case INTERP_PROC:
+		if (second == INTERP_CALL)
+			return INTERP_CALLPROC;
+		if (second == INTERP_CALLV)
+			return INTERP_CALLVPROC;
+		break;
+	default:
+		break;
+	}
+	return INTERP_INVALID;
+}
+
+static inline int is_jump(InterpOp op) {
+	return (op == INTERP_JMP) || (op == INTERP_JLT);
+}
+
+/* PUSH k; VAR n; LOAD; op becomes VAR n; LOAD; PUSH k; op, which fuses to an immediate form */
+static void commute_constants(InterpCode* code, int* target) {
+	InterpInstr* data = code->data;
+	int i;
+
+	for (i=0; i+3<code->size; i++) {
+		InterpInstr constant = data[i];
+		if ((constant.op != INTERP_PUSH)
+			|| ((data[i + 1].op != INTERP_VAR) && (data[i + 1].op != INTERP_PARAM))
+			|| (data[i + 2].op != INTERP_LOAD)
+			|| ((data[i + 3].op != INTERP_ADD) && (data[i + 3].op != INTERP_MUL))
+			|| target[i + 1] || target[i + 2] || target[i + 3])
+			continue;
+		data[i] = data[i + 1];
+		data[i + 1] = data[i + 2];
+		data[i + 2] = constant;
+	}
+}
+
+/* multiplying by a power of two is a shift */
+static inline void select_shift(InterpInstr* instr) {
+	int shift = 0;
+	if ((instr->value <= 0) || (instr->value & (instr->value - 1)))
+		return;
+	while ((1 << shift) != instr->value)
+		shift++;
+	instr->op = INTERP_SHLI;
+	instr->value = shift;
+}
+
+/*
+ * Compacts code in place. map[i] first flags jump targets, which cannot
+ * be the second half of a pair, and then holds the new pc of old pc i.
+ */
+int peephole_code(InterpCode* code) {
+	int* map = (int*) calloc(code->size + 1, sizeof(int));
+	int i, out;
+
+	if (!map)
+		return 0;
+	for (i=0; i<code->size; i++)
+		if (is_jump(code->data[i].op))
+			map[code->data[i].value] = 1;
+	commute_constants(code, map);
+
+	out = 0;
+	for (i=0; i<code->size; out++) {
+		InterpInstr instr = code->data[i];
+		InterpOp op = (i + 1 < code->size) && !map[i + 1]
+			? fused_op(instr.op, code->data[i + 1].op) : INTERP_INVALID;
+
+		map[i++] = out;
+		if (op != INTERP_INVALID) {
+			instr.op = op;
+			map[i++] = out;
+			if (op == INTERP_MULI)
+				select_shift(&instr);
+		}
+		code->data[out] = instr;
+	}
+	map[code->size] = out;
+
+	for (i=0; i<out; i++)
+		if (is_jump(code->data[i].op))
+			code->data[i].value = map[code->data[i].value];
+	code->size = out;
+	free(map);
+	return 1;
+}
+
+typedef struct SuperInstr {
+	InterpOp  op;
+	int       length;
+	InterpOp  sequence[4];
+} SuperInstr;
+
+/*
+ * Picked from the pair and triple counts of eval_interp_profile on loop
+ * heavy programs: the test and the back edge of every for loop, and
+ * assignments of a binary operation on vars. A call in tail position is
+ * one too, so that it can reuse the caller's frame.
+ */
+static const SuperInstr SUPER_INSTRS[] = {
+	{ INTERP_LOOPTEST, 4, { INTERP_DUP, INTERP_LOADVAR, INTERP_CMP, INTERP_JLT } },
+	{ INTERP_INCJMP, 2, { INTERP_INCVAR, INTERP_JMP } },
+	{ INTERP_MULVARS, 4, { INTERP_LOADVAR, INTERP_LOADVAR, INTERP_MUL, INTERP_STOREVAR } },
+	{ INTERP_ADDVARS, 4, { INTERP_LOADVAR, INTERP_LOADVAR, INTERP_ADD, INTERP_STOREVAR } },
+	{ INTERP_ADDISTORE, 3, { INTERP_LOADVAR, INTERP_ADDI, INTERP_STOREVAR } },
+	{ INTERP_TAILCALL, 2, { INTERP_CALLPROC, INTERP_RET } },
+	{ INTERP_TAILCALLV, 2, { INTERP_CALLVPROC, INTERP_RETV } },
+};
+
+#define SUPER_INSTR_COUNT   (sizeof(SUPER_INSTRS) / sizeof(SUPER_INSTRS[0]))
+
+InterpOp base_op(InterpOp op) {
+	size_t i;
+	for (i=0; i<SUPER_INSTR_COUNT; i++)
+		if (SUPER_INSTRS[i].op == op)
+			return SUPER_INSTRS[i].sequence[0];
+	return op;
+}
+
+/* a jump may land on the first slot of a sequence only */
+static inline int matches(InterpCode* code, char* target, int pc, const SuperInstr* super) {
+	int i;
+	if (pc + super->length > code->size)
+		return 0;
+	for (i=0; i<super->length; i++)
+		if ((code->data[pc + i].op != super->sequence[i]) || (i && target[pc + i]))
+			return 0;
+	return 1;
+}
+
+int super_instr_code(InterpCode* code) {
+	char* target = (char*) calloc(code->size + 1, 1);
+	int pc;
+
+	if (!target)
+		return 0;
+	for (pc=0; pc<code->size; pc++)
+		if (is_jump(code->data[pc].op))
+			target[code->data[pc].value] = 1;
+
+	pc = 0;
+	while (pc < code->size) {
+		size_t i;
+		int length = 1;
+		for (i=0; i<SUPER_INSTR_COUNT; i++)
+			if (matches(code, target, pc, &SUPER_INSTRS[i])) {
+				code->data[pc].op = SUPER_INSTRS[i].op;
+				length = SUPER_INSTRS[i].length;
+				break;
+			}
+		pc += length;
+	}
+	free(target);
+	return 1;
+}
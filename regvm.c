@@ -0,0 +1,610 @@
+#include "regvm.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REG_STACK       64*1024
+#define INITIAL_INSTRS  64
+
+/* what a stack slot holds during translation, only ENTRY_REG is in a register */
+typedef enum EntryKind {
+	ENTRY_REG,
+	ENTRY_IMM,
+	ENTRY_REF,    /* the address VAR or PARAM pushes, as a register */
+	ENTRY_PROC
+} EntryKind;
+
+typedef struct Entry {
+	EntryKind  kind;
+	int        value;
+} Entry;
+
+/*
+ * Stack code is run abstractly: slots hold where their value is rather
+ * than copies of it, and are moved into their own registers only at
+ * jumps and jump targets, before calls and before a store would change
+ * what they read.
+ */
+typedef struct RegCtx {
+	RegProg*   prog;
+	int        params;
+	int        vars;
+	Entry*     stack;
+	int        depth;
+	int        max_depth;
+	RegInstr*  data;
+	int        size;
+	int        capacity;
+	int        produced;   /* register the last instruction wrote, -1 if none */
+} RegCtx;
+
+static inline int slot_reg(RegCtx* ctx, int position) {
+	return ctx->params + position;
+}
+
+static inline int produces(RegOp op) {
+	return ((op >= REG_MOV) && (op <= REG_SUB)) || (op == REG_CALL);
+}
+
+static int emit(RegCtx* ctx, RegOp op, int a, int b, int c) {
+	if (ctx->size == ctx->capacity) {
+		int capacity = ctx->capacity ? 2 * ctx->capacity : INITIAL_INSTRS;
+		RegInstr* data = (RegInstr*) realloc(ctx->data, capacity * sizeof(RegInstr));
+		if (!data)
+			return 0;
+		ctx->data = data;
+		ctx->capacity = capacity;
+	}
+	ctx->data[ctx->size].op = op;
+	ctx->data[ctx->size].a = a;
+	ctx->data[ctx->size].b = b;
+	ctx->data[ctx->size].c = c;
+	ctx->size++;
+	ctx->produced = produces(op) ? a : -1;
+	return 1;
+}
+
+/* moves the value of a slot into its own register */
+static int materialize(RegCtx* ctx, int position) {
+	Entry* entry = &ctx->stack[position];
+	int reg = slot_reg(ctx, position);
+	int ok;
+
+	if ((entry->kind == ENTRY_REG) && (entry->value == reg))
+		return 1;
+	if (entry->kind == ENTRY_REG)
+		ok = emit(ctx, REG_MOV, reg, entry->value, 0);
+	else if (entry->kind == ENTRY_IMM)
+		ok = emit(ctx, REG_MOVI, reg, 0, entry->value);
+	else
+		ok = 0;
+	entry->kind = ENTRY_REG;
+	entry->value = reg;
+	return ok;
+}
+
+static int flush(RegCtx* ctx) {
+	int i;
+	int ok = 1;
+	for (i=0; ok && (i<ctx->depth); i++)
+		ok = materialize(ctx, i);
+	return ok;
+}
+
+/* a register holding the value of a slot, immediates go to the slot's own */
+static int operand(RegCtx* ctx, int position, int* reg) {
+	Entry* entry = &ctx->stack[position];
+	if ((entry->kind != ENTRY_REG) && !materialize(ctx, position))
+		return 0;
+	*reg = entry->value;
+	return 1;
+}
+
+/* the slots of vars are their storage, so they are always in their registers */
+static int push(RegCtx* ctx, EntryKind kind, int value) {
+	int position = ctx->depth++;
+	ctx->stack[position].kind = kind;
+	ctx->stack[position].value = value;
+	if (ctx->depth > ctx->max_depth)
+		ctx->max_depth = ctx->depth;
+	return (position >= ctx->vars) || materialize(ctx, position);
+}
+
+static inline int pop_ref(RegCtx* ctx, int* reg) {
+	Entry* entry = &ctx->stack[--ctx->depth];
+	*reg = entry->value;
+	return entry->kind == ENTRY_REF;
+}
+
+/* slots that read reg get copies before reg changes */
+static int protect(RegCtx* ctx, int reg) {
+	int i;
+	int ok = 1;
+	for (i=0; ok && (i<ctx->depth); i++) {
+		Entry* entry = &ctx->stack[i];
+		if ((entry->kind == ENTRY_REG) && (entry->value == reg) && (reg != slot_reg(ctx, i)))
+			ok = materialize(ctx, i);
+	}
+	return ok;
+}
+
+/* a value just computed into its slot's register is computed into reg instead */
+static int store(RegCtx* ctx, int reg) {
+	int position = --ctx->depth;
+	Entry value = ctx->stack[position];
+
+	if (!protect(ctx, reg))
+		return 0;
+	if ((value.kind == ENTRY_REG) && (value.value == slot_reg(ctx, position))
+		&& (ctx->produced == value.value)) {
+		ctx->data[ctx->size - 1].a = reg;
+		ctx->produced = -1;
+		return 1;
+	}
+	if (value.kind == ENTRY_REG)
+		return emit(ctx, REG_MOV, reg, value.value, 0);
+	if (value.kind == ENTRY_IMM)
+		return emit(ctx, REG_MOVI, reg, 0, value.value);
+	return 0;
+}
+
+static int increment(RegCtx* ctx, int reg) {
+	return protect(ctx, reg) && emit(ctx, REG_INC, reg, 0, 0);
+}
+
+/* op and op_imm are commutative */
+static int binary(RegCtx* ctx, RegOp op, RegOp op_imm) {
+	int position = ctx->depth - 2;
+	Entry* left = &ctx->stack[position];
+	Entry* right = &ctx->stack[position + 1];
+	int dest = slot_reg(ctx, position);
+	int a, b, ok;
+
+	if ((left->kind == ENTRY_IMM) || (right->kind == ENTRY_IMM)) {
+		int imm = (right->kind == ENTRY_IMM) ? right->value : left->value;
+		int other = (right->kind == ENTRY_IMM) ? position : position + 1;
+		ok = operand(ctx, other, &a) && emit(ctx, op_imm, dest, a, imm);
+	} else
+		ok = operand(ctx, position, &a) && operand(ctx, position + 1, &b)
+			&& emit(ctx, op, dest, a, b);
+	ctx->depth = position;
+	return ok && push(ctx, ENTRY_REG, dest);
+}
+
+/* ADDI or MULI of the top of the stack */
+static int immediate(RegCtx* ctx, RegOp op, int imm) {
+	int position = --ctx->depth;
+	int dest = slot_reg(ctx, position);
+	int a;
+	return operand(ctx, position, &a) && emit(ctx, op, dest, a, imm)
+		&& push(ctx, ENTRY_REG, dest);
+}
+
+static int compare(RegCtx* ctx) {
+	int position = ctx->depth - 2;
+	int dest = slot_reg(ctx, position);
+	int a, b;
+	int ok = operand(ctx, position, &a) && operand(ctx, position + 1, &b)
+		&& emit(ctx, REG_SUB, dest, a, b);
+	ctx->depth = position;
+	return ok && push(ctx, ENTRY_REG, dest);
+}
+
+/* CMP; JLT */
+static int compare_jump(RegCtx* ctx, int target) {
+	int position = ctx->depth - 2;
+	int a, b;
+	int ok = operand(ctx, position, &a) && operand(ctx, position + 1, &b);
+	ctx->depth = position;
+	return ok && flush(ctx) && emit(ctx, REG_JLT, a, b, target);
+}
+
+static int jump_negative(RegCtx* ctx, int target) {
+	int position = ctx->depth - 1;
+	int a;
+	int ok = operand(ctx, position, &a);
+	ctx->depth = position;
+	return ok && flush(ctx) && emit(ctx, REG_JLTZ, a, 0, target);
+}
+
+/* moves the args of a call to proc into their slots' registers, and pops them */
+static int call_args(RegCtx* ctx, int proc, int* first) {
+	int i;
+
+	*first = ctx->depth - ctx->prog->procs[proc].params;
+	if (*first < 0)
+		return 0;
+	for (i=*first; i<ctx->depth; i++)
+		if (!materialize(ctx, i))
+			return 0;
+	ctx->depth = *first;
+	return 1;
+}
+
+/* args are in their slots' registers, the result goes to the first one */
+static int call(RegCtx* ctx, int proc, int has_result) {
+	int first;
+
+	if (!call_args(ctx, proc, &first))
+		return 0;
+	if (!has_result)
+		return emit(ctx, REG_CALLV, 0, slot_reg(ctx, first), proc);
+	return emit(ctx, REG_CALL, slot_reg(ctx, first), slot_reg(ctx, first), proc)
+		&& push(ctx, ENTRY_REG, slot_reg(ctx, first));
+}
+
+/* CALLPROC; RET or CALLVPROC; RETV, the callee taking over the frame */
+static int tail_call(RegCtx* ctx, int proc) {
+	int first;
+	return call_args(ctx, proc, &first) && emit(ctx, REG_TAILCALL, 0, slot_reg(ctx, first), proc);
+}
+
+static int ret(RegCtx* ctx) {
+	int position = --ctx->depth;
+	int a;
+	return operand(ctx, position, &a) && emit(ctx, REG_RET, a, 0, 0);
+}
+
+static inline int is_jump(InterpOp op) {
+	return (op == INTERP_JMP) || (op == INTERP_JLT);
+}
+
+/* a superinstruction's slots are translated one by one, from their base ops */
+static int translate_instr(RegCtx* ctx, InterpCode* code, int pc, char* target, int* next) {
+	InterpInstr* instr = &code->data[pc];
+	int reg;
+
+	*next = pc + 1;
+	switch (base_op(instr->op)) {
+	case INTERP_PUSH:
+		return push(ctx, ENTRY_IMM, instr->value);
+	case INTERP_POP:
+		ctx->depth--;
+		return 1;
+	case INTERP_LOAD:
+		return pop_ref(ctx, &reg) && push(ctx, ENTRY_REG, reg);
+	case INTERP_STORE:
+		return pop_ref(ctx, &reg) && store(ctx, reg);
+	case INTERP_VAR:
+		return push(ctx, ENTRY_REF, slot_reg(ctx, instr->value));
+	case INTERP_PARAM:
+		return push(ctx, ENTRY_REF, instr->value);
+	case INTERP_PROC:
+		return push(ctx, ENTRY_PROC, instr->value);
+	case INTERP_DUP:
+		return push(ctx, ctx->stack[ctx->depth - 1].kind, ctx->stack[ctx->depth - 1].value);
+	case INTERP_ADD:
+		return binary(ctx, REG_ADD, REG_ADDI);
+	case INTERP_MUL:
+		return binary(ctx, REG_MUL, REG_MULI);
+	case INTERP_INC:
+		return pop_ref(ctx, &reg) && increment(ctx, reg);
+	case INTERP_CMP:
+		if ((pc + 1 < code->size) && (code->data[pc + 1].op == INTERP_JLT) && !target[pc + 1]) {
+			*next = pc + 2;
+			return compare_jump(ctx, code->data[pc + 1].value);
+		}
+		return compare(ctx);
+	case INTERP_JMP:
+		return flush(ctx) && emit(ctx, REG_JMP, 0, 0, instr->value);
+	case INTERP_JLT:
+		return jump_negative(ctx, instr->value);
+	case INTERP_CALL:
+	case INTERP_CALLV:
+		if (ctx->stack[--ctx->depth].kind != ENTRY_PROC)
+			return 0;
+		return call(ctx, ctx->stack[ctx->depth].value, instr->op == INTERP_CALL);
+	case INTERP_RETV:
+		return emit(ctx, REG_RETV, 0, 0, 0);
+	case INTERP_RET:
+		return ret(ctx);
+	case INTERP_LOADVAR:
+		return push(ctx, ENTRY_REG, slot_reg(ctx, instr->value));
+	case INTERP_STOREVAR:
+		return store(ctx, slot_reg(ctx, instr->value));
+	case INTERP_INCVAR:
+		return increment(ctx, slot_reg(ctx, instr->value));
+	case INTERP_LOADPARAM:
+		return push(ctx, ENTRY_REG, instr->value);
+	case INTERP_STOREPARAM:
+		return store(ctx, instr->value);
+	case INTERP_ADDI:
+		return immediate(ctx, REG_ADDI, instr->value);
+	case INTERP_MULI:
+		return immediate(ctx, REG_MULI, instr->value);
+	case INTERP_SHLI:
+		return immediate(ctx, REG_MULI, 1 << instr->value);
+	case INTERP_CALLPROC:
+	case INTERP_CALLVPROC:
+		if ((instr->op == INTERP_TAILCALL) || (instr->op == INTERP_TAILCALLV)) {
+			*next = pc + 2;
+			return tail_call(ctx, instr->value);
+		}
+		return call(ctx, instr->value, instr->op == INTERP_CALLPROC);
+	default:
+		return 0;
+	}
+}
+
+static int translate_code(RegCtx* ctx, InterpCode* code, RegCode* reg_code) {
+	char* target = (char*) calloc(code->size + 1, 1);
+	int* map = (int*) malloc((code->size + 1) * sizeof(int));
+	int ok = target && map;
+	int pc, next, i;
+
+	ctx->stack = (Entry*) malloc((code->size + 1) * sizeof(Entry));
+	ok = ok && ctx->stack;
+	for (pc=0; ok && (pc<code->size); pc++)
+		if (is_jump(code->data[pc].op))
+			target[code->data[pc].value] = 1;
+
+	for (pc=0; ok && (pc<code->size); pc=next) {
+		if (target[pc]) {
+			ok = flush(ctx);
+			ctx->produced = -1;
+		}
+		map[pc] = ctx->size;
+		next = pc + 1;
+		ok = ok && translate_instr(ctx, code, pc, target, &next);
+		if (next > pc + 1)
+			map[pc + 1] = ctx->size;
+	}
+	map[code->size] = ctx->size;
+
+	for (i=0; ok && (i<ctx->size); i++) {
+		RegOp op = ctx->data[i].op;
+		if ((op == REG_JMP) || (op == REG_JLT) || (op == REG_JLTZ))
+			ctx->data[i].c = map[ctx->data[i].c];
+	}
+
+	if (ok) {
+		reg_code->frame = ctx->params + ctx->max_depth;
+		reg_code->size = ctx->size;
+		reg_code->data = ctx->data;
+	} else
+		free(ctx->data);
+	free(ctx->stack);
+	free(target);
+	free(map);
+	return ok;
+}
+
+/* every RET pops the params; a procedure without one never returns, its params are those it uses */
+static void count_slots(InterpCode* code, int* params, int* vars) {
+	int returns = 0;
+	int i;
+
+	*params = 0;
+	*vars = 0;
+	for (i=0; i<code->size; i++) {
+		InterpInstr* instr = &code->data[i];
+		switch (base_op(instr->op)) {
+		case INTERP_RET:
+		case INTERP_RETV:
+			*params = instr->value;
+			returns = 1;
+			break;
+		case INTERP_PARAM:
+		case INTERP_LOADPARAM:
+		case INTERP_STOREPARAM:
+			if (!returns && (instr->value + 1 > *params))
+				*params = instr->value + 1;
+			break;
+		case INTERP_VAR:
+		case INTERP_LOADVAR:
+		case INTERP_STOREVAR:
+		case INTERP_INCVAR:
+			if (instr->value + 1 > *vars)
+				*vars = instr->value + 1;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+int init_reg_prog(RegProg* reg_prog, InterpProg* interp_prog) {
+	int* vars = (int*) malloc(interp_prog->proc_count * sizeof(int));
+	int ok = vars != NULL;
+	int i;
+
+	reg_prog->proc_count = interp_prog->proc_count;
+	reg_prog->main = interp_prog->main;
+	reg_prog->procs = (RegCode*) calloc(interp_prog->proc_count, sizeof(RegCode));
+	ok = ok && reg_prog->procs;
+
+	for (i=0; ok && (i<interp_prog->proc_count); i++)
+		count_slots(&interp_prog->procs[i], &reg_prog->procs[i].params, &vars[i]);
+	for (i=0; ok && (i<interp_prog->proc_count); i++) {
+		RegCtx ctx = {
+			.prog = reg_prog,
+			.params = reg_prog->procs[i].params,
+			.vars = vars[i],
+			.produced = -1
+		};
+		ok = translate_code(&ctx, &interp_prog->procs[i], &reg_prog->procs[i]);
+	}
+	free(vars);
+	if (!ok)
+		destroy_reg_prog(reg_prog);
+	return ok;
+}
+
+static inline int dump_write(FILE* fp, const char* fmt, ...) {
+	int ok;
+	va_list ap;
+	va_start(ap, fmt);
+	ok = vfprintf(fp, fmt, ap) > 0;
+	va_end(ap);
+	return ok;
+}
+
+static inline int dump_instr(FILE* fp, RegInstr* instr) {
+	switch (instr->op) {
+	case REG_MOV:
+		return dump_write(fp, "MOV r%d, r%d", instr->a, instr->b);
+	case REG_MOVI:
+		return dump_write(fp, "MOVI r%d, %d", instr->a, instr->c);
+	case REG_ADD:
+		return dump_write(fp, "ADD r%d, r%d, r%d", instr->a, instr->b, instr->c);
+	case REG_ADDI:
+		return dump_write(fp, "ADDI r%d, r%d, %d", instr->a, instr->b, instr->c);
+	case REG_MUL:
+		return dump_write(fp, "MUL r%d, r%d, r%d", instr->a, instr->b, instr->c);
+	case REG_MULI:
+		return dump_write(fp, "MULI r%d, r%d, %d", instr->a, instr->b, instr->c);
+	case REG_SUB:
+		return dump_write(fp, "SUB r%d, r%d, r%d", instr->a, instr->b, instr->c);
+	case REG_INC:
+		return dump_write(fp, "INC r%d", instr->a);
+	case REG_JMP:
+		return dump_write(fp, "JMP %d", instr->c);
+	case REG_JLT:
+		return dump_write(fp, "JLT r%d, r%d, %d", instr->a, instr->b, instr->c);
+	case REG_JLTZ:
+		return dump_write(fp, "JLTZ r%d, %d", instr->a, instr->c);
+	case REG_CALL:
+		return dump_write(fp, "CALL r%d, %d, r%d", instr->a, instr->c, instr->b);
+	case REG_CALLV:
+		return dump_write(fp, "CALLV %d, r%d", instr->c, instr->b);
+	case REG_TAILCALL:
+		return dump_write(fp, "TAILCALL %d, r%d", instr->c, instr->b);
+	case REG_RET:
+		return dump_write(fp, "RET r%d", instr->a);
+	case REG_RETV:
+		return dump_write(fp, "RETV");
+	default:
+		assert(0);
+	}
+	return 0;
+}
+
+int dump_reg_prog(RegProg* prog, FILE* fp) {
+	int i, k;
+	int ok = 1;
+	for (i=0; ok && (i<prog->proc_count); i++) {
+		RegCode* code = &prog->procs[i];
+		ok = dump_write(fp, "Proc (%d) params %d, frame %d\n", i, code->params, code->frame);
+		for (k=0; ok && (k<code->size); k++)
+			ok = dump_write(fp, "%6d: ", k)
+				&& dump_instr(fp, &code->data[k])
+				&& dump_write(fp, "\n");
+	}
+	return ok;
+}
+
+/* regs is the frame of code, the callee's frame starts after it */
+static int eval_reg_code(RegProg* prog, RegCode* code, int* regs, int* limit, int* result) {
+	int pc = 0;
+
+	while (1) {
+		assert((pc >= 0) && (pc < code->size));
+
+		RegInstr* instr = &code->data[pc];
+		switch (instr->op) {
+		case REG_MOV:
+			regs[instr->a] = regs[instr->b];
+			break;
+		case REG_MOVI:
+			regs[instr->a] = instr->c;
+			break;
+		case REG_ADD:
+			regs[instr->a] = regs[instr->b] + regs[instr->c];
+			break;
+		case REG_ADDI:
+			regs[instr->a] = regs[instr->b] + instr->c;
+			break;
+		case REG_MUL:
+			regs[instr->a] = regs[instr->b] * regs[instr->c];
+			break;
+		case REG_MULI:
+			regs[instr->a] = regs[instr->b] * instr->c;
+			break;
+		case REG_SUB:
+			regs[instr->a] = regs[instr->b] - regs[instr->c];
+			break;
+		case REG_INC:
+			regs[instr->a]++;
+			break;
+		case REG_JMP:
+			pc = instr->c;
+			continue;
+		case REG_JLT:
+			if (regs[instr->a] - regs[instr->b] < 0) {
+				pc = instr->c;
+				continue;
+			}
+			break;
+		case REG_JLTZ:
+			if (regs[instr->a] < 0) {
+				pc = instr->c;
+				continue;
+			}
+			break;
+		case REG_CALL:
+		case REG_CALLV: {
+			RegCode* callee = &prog->procs[instr->c];
+			int* frame = regs + code->frame;
+			int value;
+			int i;
+
+			if (frame + callee->frame > limit)
+				return 0;
+			for (i=0; i<callee->params; i++)
+				frame[i] = regs[instr->b + callee->params - 1 - i];
+			if (!eval_reg_code(prog, callee, frame, limit,
+				(instr->op == REG_CALL) ? &value : NULL))
+				return 0;
+			if (instr->op == REG_CALL)
+				regs[instr->a] = value;
+			break;
+		}
+		case REG_TAILCALL: {
+			/* the args go past the frame first, as they may overlap the params */
+			RegCode* callee = &prog->procs[instr->c];
+			int* args = regs + code->frame;
+			int i;
+
+			if ((args + callee->params > limit) || (regs + callee->frame > limit))
+				return 0;
+			for (i=0; i<callee->params; i++)
+				args[i] = regs[instr->b + callee->params - 1 - i];
+			memcpy(regs, args, callee->params * sizeof(int));
+			code = callee;
+			pc = 0;
+			continue;
+		}
+		case REG_RET:
+			assert(result != NULL);
+			*result = regs[instr->a];
+			return 1;
+		case REG_RETV:
+			assert(result == NULL);
+			return 1;
+		default:
+			assert(0);
+			return 0;
+		}
+		pc++;
+	}
+	return 0;
+}
+
+int eval_reg_prog(RegProg* prog, int* result) {
+	int* regs = (int*) malloc(REG_STACK * sizeof(int));
+	RegCode* code = &prog->procs[prog->main];
+	int ok = regs && (code->frame <= REG_STACK)
+		&& eval_reg_code(prog, code, regs, regs + REG_STACK, result);
+	free(regs);
+	return ok;
+}
+
+void destroy_reg_prog(RegProg* prog) {
+	int i;
+	for (i=0; prog->procs && (i<prog->proc_count); i++)
+		free(prog->procs[i].data);
+	free(prog->procs);
+	prog->procs = NULL;
+}
@@ -0,0 +1,63 @@
+#ifndef REGVM_H
+#define REGVM_H
+
+#include <stdio.h>
+
+#include "interp.h"
+
+/*
+ * Register code, translated from stack code. A frame holds the params of
+ * a procedure in registers 0 to params-1, then one register per stack
+ * slot of its stack code, vars first. Operands a and b name registers,
+ * c is a register, an immediate, a pc or a procedure, as the op says.
+ */
+typedef enum RegOp {
+	REG_INVALID = 0,
+	REG_MOV,     /* a := b */
+	REG_MOVI,    /* a := c */
+	REG_ADD,     /* a := b + c */
+	REG_ADDI,    /* a := b + imm c */
+	REG_MUL,     /* a := b * c */
+	REG_MULI,    /* a := b * imm c */
+	REG_SUB,     /* a := b - c, a comparison used as a value */
+	REG_INC,     /* a := a + 1 */
+	REG_JMP,     /* goto c */
+	REG_JLT,     /* if a - b < 0 goto c */
+	REG_JLTZ,    /* if a < 0 goto c */
+	REG_CALL,    /* a := proc c, whose args are b onwards, last first */
+	REG_CALLV,   /* proc c, whose args are b onwards, last first */
+	REG_TAILCALL, /* proc c in this frame, its args from b onwards become the params */
+	REG_RET,     /* return a */
+	REG_RETV
+} RegOp;
+
+typedef struct RegInstr {
+	RegOp  op;
+	int    a;
+	int    b;
+	int    c;
+} RegInstr;
+
+typedef struct RegCode {
+	int        params;
+	int        frame;
+	int        size;
+	RegInstr*  data;
+} RegCode;
+
+typedef struct RegProg {
+	int       proc_count;
+	int       main;
+	RegCode*  procs;
+} RegProg;
+
+/* 0 when interp_prog has a shape the translation does not handle, or no memory */
+int init_reg_prog(RegProg* reg_prog, InterpProg* interp_prog);
+
+int dump_reg_prog(RegProg* prog, FILE* fp);
+
+int eval_reg_prog(RegProg* prog, int* result);
+
+void destroy_reg_prog(RegProg* prog);
+
+#endif
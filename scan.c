@@ -0,0 +1,228 @@
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+/* classes follow isspace, isalpha and isdigit in the "C" locale */
+
+static inline int is_space(unsigned char c) {
+	return (c == ' ') || ((unsigned char)(c - '\t') <= '\r' - '\t');
+}
+
+static inline int is_ident(unsigned char c) {
+	return ((unsigned char)((c | 0x20) - 'a') <= 'z' - 'a') || (c == '_');
+}
+
+static inline int is_digit(unsigned char c) {
+	return (unsigned char)(c - '0') <= 9;
+}
+
+static size_t scalar_space(const char* data, size_t i, size_t size,
+	int* lines, size_t* line_offset) {
+	while ((i < size) && is_space(data[i])) {
+		if (data[i] == '\n') {
+			(*lines)++;
+			*line_offset = i + 1;
+		}
+		i++;
+	}
+	return i;
+}
+
+static size_t scalar_ident(const char* data, size_t i, size_t size) {
+	while ((i < size) && is_ident(data[i]))
+		i++;
+	return i;
+}
+
+static size_t scalar_digits(const char* data, size_t i, size_t size) {
+	while ((i < size) && is_digit(data[i]))
+		i++;
+	return i;
+}
+
+static const Scanner SCALAR = {
+	.name = "scalar",
+	.space = scalar_space,
+	.ident = scalar_ident,
+	.digits = scalar_digits
+};
+
+#ifdef SCAN_X86
+
+/* newlines is the mask of '\n' among the skipped bytes at data[i] */
+static inline void count_newlines(size_t i, unsigned newlines, int* lines, size_t* line_offset) {
+	if (newlines) {
+		*lines += __builtin_popcount(newlines);
+		*line_offset = i + (31 - __builtin_clz(newlines)) + 1;
+	}
+}
+
+/* 0xFF where lo <= v <= lo + width (unsigned) */
+static inline __m128i sse2_in_range(__m128i v, char lo, char width) {
+	__m128i d = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+	return _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(width)), d);
+}
+
+static inline unsigned sse2_space_mask(__m128i v) {
+	__m128i blank = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	return _mm_movemask_epi8(_mm_or_si128(blank, sse2_in_range(v, '\t', '\r' - '\t')));
+}
+
+static inline unsigned sse2_ident_mask(__m128i v) {
+	__m128i alpha = sse2_in_range(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z' - 'a');
+	__m128i under = _mm_cmpeq_epi8(v, _mm_set1_epi8('_'));
+	return _mm_movemask_epi8(_mm_or_si128(alpha, under));
+}
+
+static inline unsigned sse2_digit_mask(__m128i v) {
+	return _mm_movemask_epi8(sse2_in_range(v, '0', 9));
+}
+
+static size_t sse2_space(const char* data, size_t i, size_t size,
+	int* lines, size_t* line_offset) {
+	while (i + 16 <= size) {
+		__m128i v = _mm_loadu_si128((const __m128i*) &data[i]);
+		unsigned stop = ~sse2_space_mask(v) & 0xFFFF;
+		unsigned newlines = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+		if (stop) {
+			int n = __builtin_ctz(stop);
+			count_newlines(i, newlines & ((1u << n) - 1), lines, line_offset);
+			return i + n;
+		}
+		count_newlines(i, newlines, lines, line_offset);
+		i += 16;
+	}
+	return scalar_space(data, i, size, lines, line_offset);
+}
+
+static size_t sse2_ident(const char* data, size_t i, size_t size) {
+	while (i + 16 <= size) {
+		unsigned stop = ~sse2_ident_mask(_mm_loadu_si128((const __m128i*) &data[i])) & 0xFFFF;
+		if (stop)
+			return i + __builtin_ctz(stop);
+		i += 16;
+	}
+	return scalar_ident(data, i, size);
+}
+
+static size_t sse2_digits(const char* data, size_t i, size_t size) {
+	while (i + 16 <= size) {
+		unsigned stop = ~sse2_digit_mask(_mm_loadu_si128((const __m128i*) &data[i])) & 0xFFFF;
+		if (stop)
+			return i + __builtin_ctz(stop);
+		i += 16;
+	}
+	return scalar_digits(data, i, size);
+}
+
+static const Scanner SSE2 = {
+	.name = "sse2",
+	.space = sse2_space,
+	.ident = sse2_ident,
+	.digits = sse2_digits
+};
+
+#define AVX2_TARGET __attribute__((target("avx2,popcnt")))
+
+AVX2_TARGET
+static inline __m256i avx2_in_range(__m256i v, char lo, char width) {
+	__m256i d = _mm256_sub_epi8(v, _mm256_set1_epi8(lo));
+	return _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(width)), d);
+}
+
+AVX2_TARGET
+static inline unsigned avx2_space_mask(__m256i v) {
+	__m256i blank = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+	return _mm256_movemask_epi8(_mm256_or_si256(blank, avx2_in_range(v, '\t', '\r' - '\t')));
+}
+
+AVX2_TARGET
+static inline unsigned avx2_ident_mask(__m256i v) {
+	__m256i alpha = avx2_in_range(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z' - 'a');
+	__m256i under = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'));
+	return _mm256_movemask_epi8(_mm256_or_si256(alpha, under));
+}
+
+AVX2_TARGET
+static inline unsigned avx2_digit_mask(__m256i v) {
+	return _mm256_movemask_epi8(avx2_in_range(v, '0', 9));
+}
+
+AVX2_TARGET
+static size_t avx2_space(const char* data, size_t i, size_t size,
+	int* lines, size_t* line_offset) {
+	while (i + 32 <= size) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) &data[i]);
+		unsigned stop = ~avx2_space_mask(v);
+		unsigned newlines = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+		if (stop) {
+			int n = __builtin_ctz(stop);
+			count_newlines(i, newlines & ((1ul << n) - 1), lines, line_offset);
+			return i + n;
+		}
+		count_newlines(i, newlines, lines, line_offset);
+		i += 32;
+	}
+	return sse2_space(data, i, size, lines, line_offset);
+}
+
+AVX2_TARGET
+static size_t avx2_ident(const char* data, size_t i, size_t size) {
+	while (i + 32 <= size) {
+		unsigned stop = ~avx2_ident_mask(_mm256_loadu_si256((const __m256i*) &data[i]));
+		if (stop)
+			return i + __builtin_ctz(stop);
+		i += 32;
+	}
+	return sse2_ident(data, i, size);
+}
+
+AVX2_TARGET
+static size_t avx2_digits(const char* data, size_t i, size_t size) {
+	while (i + 32 <= size) {
+		unsigned stop = ~avx2_digit_mask(_mm256_loadu_si256((const __m256i*) &data[i]));
+		if (stop)
+			return i + __builtin_ctz(stop);
+		i += 32;
+	}
+	return sse2_digits(data, i, size);
+}
+
+static const Scanner AVX2 = {
+	.name = "avx2",
+	.space = avx2_space,
+	.ident = avx2_ident,
+	.digits = avx2_digits
+};
+
+#endif
+
+const Scanner* get_scanner(ScanLevel level) {
+	switch (level) {
+	case SCAN_SCALAR:
+		return &SCALAR;
+#ifdef SCAN_X86
+	case SCAN_SSE2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("sse2") ? &SSE2 : NULL;
+	case SCAN_AVX2:
+		__builtin_cpu_init();
+		return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")
+			? &AVX2 : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+const Scanner* select_scanner(void) {
+	const Scanner* scanner = get_scanner(SCAN_AVX2);
+	if (!scanner)
+		scanner = get_scanner(SCAN_SSE2);
+	if (!scanner)
+		scanner = get_scanner(SCAN_SCALAR);
+	return scanner;
+}
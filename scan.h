@@ -0,0 +1,37 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+ * Character class scanners over a contiguous buffer. Each one starts at
+ * from and returns the offset of the first character outside its class
+ * (or size). scan_space also counts the newlines it skips and moves
+ * line_offset past the last one.
+ */
+
+typedef size_t (*ScanFun)(const char* data, size_t from, size_t size);
+
+typedef size_t (*ScanSpaceFun)(const char* data, size_t from, size_t size,
+	int* lines, size_t* line_offset);
+
+typedef enum ScanLevel {
+	SCAN_SCALAR,
+	SCAN_SSE2,
+	SCAN_AVX2
+} ScanLevel;
+
+typedef struct Scanner {
+	const char*   name;
+	ScanSpaceFun  space;
+	ScanFun       ident;
+	ScanFun       digits;
+} Scanner;
+
+/* NULL if the cpu does not support level */
+const Scanner* get_scanner(ScanLevel level);
+
+/* best scanner for the running cpu */
+const Scanner* select_scanner(void);
+
+#endif
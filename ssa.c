@@ -0,0 +1,1019 @@
+#include "ssa.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_INSTRS  64
+
+/* what a param or stack slot holds during the translation, only ENTRY_VALUE is a value */
+typedef enum EntryKind {
+	ENTRY_VALUE,
+	ENTRY_REF,    /* the address VAR or PARAM pushes, as a slot */
+	ENTRY_PROC
+} EntryKind;
+
+typedef struct Entry {
+	EntryKind  kind;
+	int        value;
+} Entry;
+
+/*
+ * Slots are the params, then the stack, whose first slots are the vars.
+ * Blocks are translated in code order; a block with one predecessor
+ * translated before it starts from its slots, any other gets a phi for
+ * every slot, filled once all blocks are done. Phis that turn out to be
+ * copies are removed by propagate_copies.
+ */
+typedef struct BuildCtx {
+	SsaProg*      prog;
+	SsaProc*      proc;
+	InterpCode*   code;
+	int*          block_of;   /* block starting at each pc, -1 inside blocks */
+	Entry*        slots;
+	int           depth;
+	Entry**       ends;       /* slots at the end of each block */
+	int*          end_depths;
+	char*         joins;      /* blocks starting with a phi per slot */
+} BuildCtx;
+
+static inline int is_jump(InterpOp op) {
+	return (op == INTERP_JMP) || (op == INTERP_JLT);
+}
+
+static inline int ends_block(InterpOp op) {
+	return is_jump(op) || (op == INTERP_RET) || (op == INTERP_RETV);
+}
+
+static int new_instr(SsaProc* proc, SsaOp op, int imm, int arg_count) {
+	SsaInstr* instr;
+
+	if (proc->instr_count == proc->instr_capacity) {
+		int capacity = proc->instr_capacity ? 2 * proc->instr_capacity : INITIAL_INSTRS;
+		SsaInstr* instrs = (SsaInstr*) realloc(proc->instrs, capacity * sizeof(SsaInstr));
+		if (!instrs)
+			return -1;
+		proc->instrs = instrs;
+		proc->instr_capacity = capacity;
+	}
+	if (proc->arg_count + arg_count > proc->arg_capacity) {
+		int capacity = proc->arg_capacity ? 2 * proc->arg_capacity : INITIAL_INSTRS;
+		int* args;
+		while (capacity < proc->arg_count + arg_count)
+			capacity *= 2;
+		args = (int*) realloc(proc->args, capacity * sizeof(int));
+		if (!args)
+			return -1;
+		proc->args = args;
+		proc->arg_capacity = capacity;
+	}
+	instr = &proc->instrs[proc->instr_count];
+	instr->op = op;
+	instr->imm = imm;
+	instr->arg_count = arg_count;
+	instr->args = proc->arg_count;
+	proc->arg_count += arg_count;
+	return proc->instr_count++;
+}
+
+static int new_value(SsaProc* proc, SsaOp op, int a, int b) {
+	int arg_count = (op == SSA_COPY) ? 1 : 2;
+	int value = new_instr(proc, op, 0, arg_count);
+	if (value < 0)
+		return -1;
+	proc->args[proc->instrs[value].args] = a;
+	if (arg_count > 1)
+		proc->args[proc->instrs[value].args + 1] = b;
+	return value;
+}
+
+/* every RET pops the params; a procedure without one never returns, its params are those it uses */
+static int count_params(InterpCode* code) {
+	int params = 0;
+	int i;
+	for (i=0; i<code->size; i++) {
+		InterpInstr* instr = &code->data[i];
+		switch (base_op(instr->op)) {
+		case INTERP_RET:
+		case INTERP_RETV:
+			return instr->value;
+		case INTERP_PARAM:
+		case INTERP_LOADPARAM:
+		case INTERP_STOREPARAM:
+			if (instr->value + 1 > params)
+				params = instr->value + 1;
+			break;
+		default:
+			break;
+		}
+	}
+	return params;
+}
+
+static int find_blocks(SsaProc* proc, InterpCode* code, int* block_of) {
+	int pc, b;
+
+	for (pc=0; pc<code->size; pc++)
+		block_of[pc] = -1;
+	block_of[0] = 0;
+	for (pc=0; pc<code->size; pc++) {
+		InterpOp op = base_op(code->data[pc].op);
+		if (is_jump(op)) {
+			if ((code->data[pc].value < 0) || (code->data[pc].value >= code->size))
+				return 0;
+			block_of[code->data[pc].value] = 0;
+		}
+		if (ends_block(op) && (pc + 1 < code->size))
+			block_of[pc + 1] = 0;
+	}
+
+	proc->block_count = 0;
+	for (pc=0; pc<code->size; pc++)
+		if (block_of[pc] == 0)
+			block_of[pc] = proc->block_count++;
+	proc->blocks = (SsaBlock*) calloc(proc->block_count, sizeof(SsaBlock));
+	if (!proc->blocks)
+		return 0;
+
+	for (pc=0; pc<code->size; pc++)
+		if (block_of[pc] >= 0)
+			proc->blocks[block_of[pc]].pc = pc;
+	for (b=0; b<proc->block_count; b++) {
+		SsaBlock* block = &proc->blocks[b];
+		int last = ((b + 1 < proc->block_count) ? proc->blocks[b + 1].pc : code->size) - 1;
+		InterpOp op = base_op(code->data[last].op);
+
+		block->next = ((op == INTERP_JMP) || (op == INTERP_RET) || (op == INTERP_RETV)
+			|| (b + 1 == proc->block_count)) ? -1 : b + 1;
+		block->target = is_jump(op) ? block_of[code->data[last].value] : -1;
+	}
+	return 1;
+}
+
+static int link_blocks(SsaProc* proc) {
+	int* work = (int*) malloc(proc->block_count * sizeof(int));
+	int edges = 0;
+	int top = 0;
+	int b;
+
+	if (!work)
+		return 0;
+	proc->blocks[0].reachable = 1;
+	work[top++] = 0;
+	while (top) {
+		SsaBlock* block = &proc->blocks[work[--top]];
+		int succs[2] = { block->next, block->target };
+		int i;
+		for (i=0; i<2; i++)
+			if ((succs[i] >= 0) && !proc->blocks[succs[i]].reachable) {
+				proc->blocks[succs[i]].reachable = 1;
+				work[top++] = succs[i];
+			}
+	}
+	free(work);
+
+	for (b=0; b<proc->block_count; b++) {
+		SsaBlock* block = &proc->blocks[b];
+		if (!block->reachable)
+			continue;
+		if (block->next >= 0)
+			proc->blocks[block->next].pred_count++;
+		if (block->target >= 0)
+			proc->blocks[block->target].pred_count++;
+	}
+	for (b=0; b<proc->block_count; b++) {
+		proc->blocks[b].preds = edges;
+		edges += proc->blocks[b].pred_count;
+		proc->blocks[b].pred_count = 0;
+	}
+	proc->preds = (int*) malloc((edges + 1) * sizeof(int));
+	if (!proc->preds)
+		return 0;
+	for (b=0; b<proc->block_count; b++) {
+		SsaBlock* block = &proc->blocks[b];
+		if (!block->reachable)
+			continue;
+		if (block->next >= 0) {
+			SsaBlock* next = &proc->blocks[block->next];
+			proc->preds[next->preds + next->pred_count++] = b;
+		}
+		if (block->target >= 0) {
+			SsaBlock* target = &proc->blocks[block->target];
+			proc->preds[target->preds + target->pred_count++] = b;
+		}
+	}
+	return 1;
+}
+
+static inline Entry* stack_slot(BuildCtx* ctx, int position) {
+	return &ctx->slots[ctx->proc->params + position];
+}
+
+static inline int push(BuildCtx* ctx, EntryKind kind, int value) {
+	Entry* entry = stack_slot(ctx, ctx->depth++);
+	entry->kind = kind;
+	entry->value = value;
+	return value >= 0;
+}
+
+static inline int pop(BuildCtx* ctx, EntryKind kind, int* value) {
+	Entry* entry;
+	if (ctx->depth == 0)
+		return 0;
+	entry = stack_slot(ctx, --ctx->depth);
+	*value = entry->value;
+	return entry->kind == kind;
+}
+
+/* params, and the stack below the top */
+static inline int is_slot(BuildCtx* ctx, int slot) {
+	return (slot >= 0) && (slot < ctx->proc->params + ctx->depth);
+}
+
+static inline int push_const(BuildCtx* ctx, int imm) {
+	return push(ctx, ENTRY_VALUE, new_instr(ctx->proc, SSA_CONST, imm, 0));
+}
+
+static int binary(BuildCtx* ctx, SsaOp op) {
+	int a, b;
+	return pop(ctx, ENTRY_VALUE, &b) && pop(ctx, ENTRY_VALUE, &a)
+		&& push(ctx, ENTRY_VALUE, new_value(ctx->proc, op, a, b));
+}
+
+/* the value on top goes to slot */
+static int store(BuildCtx* ctx, int slot) {
+	int value;
+	if (!pop(ctx, ENTRY_VALUE, &value))
+		return 0;
+	value = new_value(ctx->proc, SSA_COPY, value, 0);
+	ctx->slots[slot].kind = ENTRY_VALUE;
+	ctx->slots[slot].value = value;
+	return value >= 0;
+}
+
+static int add_to_slot(BuildCtx* ctx, int slot, int imm) {
+	int one = new_instr(ctx->proc, SSA_CONST, imm, 0);
+	if ((one < 0) || (ctx->slots[slot].kind != ENTRY_VALUE))
+		return 0;
+	ctx->slots[slot].value = new_value(ctx->proc, SSA_ADD, ctx->slots[slot].value, one);
+	return ctx->slots[slot].value >= 0;
+}
+
+static int terminate(BuildCtx* ctx, SsaOp op, int target, int arg_count) {
+	int branch = new_instr(ctx->proc, op, ctx->block_of[target], arg_count);
+	int i;
+
+	if (branch < 0)
+		return 0;
+	for (i=arg_count-1; i>=0; i--) {
+		int value;
+		if (!pop(ctx, ENTRY_VALUE, &value))
+			return 0;
+		ctx->proc->args[ctx->proc->instrs[branch].args + i] = value;
+	}
+	return 1;
+}
+
+/* args are on the stack last first */
+static int call(BuildCtx* ctx, int callee, int has_result) {
+	SsaProc* proc = ctx->proc;
+	int params = ctx->prog->procs[callee].params;
+	int first = ctx->depth - params;
+	int value = new_instr(proc, has_result ? SSA_CALL : SSA_CALLV, callee, params);
+	int i;
+
+	if ((first < 0) || (value < 0))
+		return 0;
+	for (i=0; i<params; i++) {
+		Entry* arg = stack_slot(ctx, first + params - 1 - i);
+		if (arg->kind != ENTRY_VALUE)
+			return 0;
+		proc->args[proc->instrs[value].args + i] = arg->value;
+	}
+	ctx->depth = first;
+	return !has_result || push(ctx, ENTRY_VALUE, value);
+}
+
+static int ret(BuildCtx* ctx) {
+	int value;
+	int instr = new_instr(ctx->proc, SSA_RET, 0, 1);
+	if ((instr < 0) || !pop(ctx, ENTRY_VALUE, &value))
+		return 0;
+	ctx->proc->args[ctx->proc->instrs[instr].args] = value;
+	return 1;
+}
+
+/* a superinstruction's slots are translated one by one, from their base ops */
+static int translate_instr(BuildCtx* ctx, int pc, int* next) {
+	InterpCode* code = ctx->code;
+	InterpInstr* instr = &code->data[pc];
+	int params = ctx->proc->params;
+	int slot, proc;
+
+	*next = pc + 1;
+	switch (base_op(instr->op)) {
+	case INTERP_PUSH:
+		return push_const(ctx, instr->value);
+	case INTERP_POP:
+		return pop(ctx, ENTRY_VALUE, &slot);
+	case INTERP_LOAD:
+		return pop(ctx, ENTRY_REF, &slot)
+			&& push(ctx, ctx->slots[slot].kind, ctx->slots[slot].value);
+	case INTERP_STORE:
+		return pop(ctx, ENTRY_REF, &slot) && store(ctx, slot);
+	case INTERP_VAR:
+		return (instr->value >= 0) && is_slot(ctx, params + instr->value)
+			&& push(ctx, ENTRY_REF, params + instr->value);
+	case INTERP_PARAM:
+		return (instr->value < params) && is_slot(ctx, instr->value)
+			&& push(ctx, ENTRY_REF, instr->value);
+	case INTERP_PROC:
+		return push(ctx, ENTRY_PROC, instr->value);
+	case INTERP_DUP:
+		return (ctx->depth > 0)
+			&& push(ctx, stack_slot(ctx, ctx->depth - 1)->kind, stack_slot(ctx, ctx->depth - 1)->value);
+	case INTERP_ADD:
+		return binary(ctx, SSA_ADD);
+	case INTERP_MUL:
+		return binary(ctx, SSA_MUL);
+	case INTERP_INC:
+		return pop(ctx, ENTRY_REF, &slot) && add_to_slot(ctx, slot, 1);
+	case INTERP_CMP:
+		if ((pc + 1 < code->size) && (code->data[pc + 1].op == INTERP_JLT) && (ctx->block_of[pc + 1] < 0)) {
+			*next = pc + 2;
+			return terminate(ctx, SSA_JLT, code->data[pc + 1].value, 2);
+		}
+		return binary(ctx, SSA_SUB);
+	case INTERP_JMP:
+		return terminate(ctx, SSA_JMP, instr->value, 0);
+	case INTERP_JLT:
+		return terminate(ctx, SSA_JLTZ, instr->value, 1);
+	case INTERP_CALL:
+	case INTERP_CALLV:
+		return pop(ctx, ENTRY_PROC, &proc) && (proc >= 0) && (proc < ctx->prog->proc_count)
+			&& call(ctx, proc, instr->op == INTERP_CALL);
+	case INTERP_RETV:
+		return new_instr(ctx->proc, SSA_RETV, 0, 0) >= 0;
+	case INTERP_RET:
+		return ret(ctx);
+	case INTERP_LOADVAR:
+		slot = params + instr->value;
+		return (instr->value >= 0) && is_slot(ctx, slot)
+			&& push(ctx, ctx->slots[slot].kind, ctx->slots[slot].value);
+	case INTERP_STOREVAR:
+		return (instr->value >= 0) && is_slot(ctx, params + instr->value)
+			&& store(ctx, params + instr->value);
+	case INTERP_INCVAR:
+		return (instr->value >= 0) && is_slot(ctx, params + instr->value)
+			&& add_to_slot(ctx, params + instr->value, 1);
+	case INTERP_LOADPARAM:
+		return (instr->value < params) && is_slot(ctx, instr->value)
+			&& push(ctx, ctx->slots[instr->value].kind, ctx->slots[instr->value].value);
+	case INTERP_STOREPARAM:
+		return (instr->value < params) && is_slot(ctx, instr->value)
+			&& store(ctx, instr->value);
+	case INTERP_ADDI:
+		return push_const(ctx, instr->value) && binary(ctx, SSA_ADD);
+	case INTERP_MULI:
+		return push_const(ctx, instr->value) && binary(ctx, SSA_MUL);
+	case INTERP_SHLI:
+		return (instr->value >= 0) && (instr->value < 31)
+			&& push_const(ctx, 1 << instr->value) && binary(ctx, SSA_MUL);
+	case INTERP_CALLPROC:
+		return (instr->value >= 0) && (instr->value < ctx->prog->proc_count)
+			&& call(ctx, instr->value, 1);
+	case INTERP_CALLVPROC:
+		return (instr->value >= 0) && (instr->value < ctx->prog->proc_count)
+			&& call(ctx, instr->value, 0);
+	default:
+		return 0;
+	}
+}
+
+static int start_block(BuildCtx* ctx, int b) {
+	SsaProc* proc = ctx->proc;
+	SsaBlock* block = &proc->blocks[b];
+	int slot_count, i, pred;
+
+	block->first = proc->instr_count;
+	if (b == 0) {
+		if (block->pred_count)
+			return 0;
+		for (i=0; i<proc->params; i++) {
+			ctx->slots[i].kind = ENTRY_VALUE;
+			ctx->slots[i].value = new_instr(proc, SSA_PARAM, i, 0);
+			if (ctx->slots[i].value < 0)
+				return 0;
+		}
+		ctx->depth = 0;
+		return 1;
+	}
+
+	pred = -1;
+	for (i=0; i<block->pred_count; i++)
+		if (proc->preds[block->preds + i] < b) {
+			pred = proc->preds[block->preds + i];
+			break;
+		}
+	if (pred < 0)
+		return 0;
+	ctx->depth = ctx->end_depths[pred];
+	slot_count = proc->params + ctx->depth;
+	if (block->pred_count == 1) {
+		memcpy(ctx->slots, ctx->ends[pred], slot_count * sizeof(Entry));
+		return 1;
+	}
+	ctx->joins[b] = 1;
+	for (i=0; i<slot_count; i++) {
+		ctx->slots[i].kind = ENTRY_VALUE;
+		ctx->slots[i].value = new_instr(proc, SSA_PHI, 0, block->pred_count);
+		if (ctx->slots[i].value < 0)
+			return 0;
+	}
+	return 1;
+}
+
+static int end_block(BuildCtx* ctx, int b) {
+	int slot_count = ctx->proc->params + ctx->depth;
+	SsaBlock* block = &ctx->proc->blocks[b];
+
+	block->count = ctx->proc->instr_count - block->first;
+	ctx->end_depths[b] = ctx->depth;
+	ctx->ends[b] = (Entry*) malloc((slot_count + 1) * sizeof(Entry));
+	if (!ctx->ends[b])
+		return 0;
+	memcpy(ctx->ends[b], ctx->slots, slot_count * sizeof(Entry));
+	return 1;
+}
+
+/* the phi of slot i is the i-th instruction of a join block */
+static int fill_phis(BuildCtx* ctx, int b) {
+	SsaProc* proc = ctx->proc;
+	SsaBlock* block = &proc->blocks[b];
+	int depth = ctx->end_depths[proc->preds[block->preds]];
+	int slot_count = proc->params + depth;
+	int i, k;
+
+	for (i=0; i<block->pred_count; i++) {
+		int pred = proc->preds[block->preds + i];
+		if (ctx->end_depths[pred] != depth)
+			return 0;
+		for (k=0; k<slot_count; k++) {
+			Entry* entry = &ctx->ends[pred][k];
+			if (entry->kind != ENTRY_VALUE)
+				return 0;
+			proc->args[proc->instrs[block->first + k].args + i] = entry->value;
+		}
+	}
+	return 1;
+}
+
+static int build_ssa(SsaProg* prog, SsaProc* proc, InterpCode* code) {
+	BuildCtx ctx = { .prog = prog, .proc = proc, .code = code };
+	int ok, b, i;
+
+	if (code->size == 0)
+		return 0;
+	ctx.block_of = (int*) malloc(code->size * sizeof(int));
+	ctx.slots = (Entry*) malloc((proc->params + code->size + 1) * sizeof(Entry));
+	ok = ctx.block_of && ctx.slots && find_blocks(proc, code, ctx.block_of) && link_blocks(proc);
+	if (ok) {
+		ctx.ends = (Entry**) calloc(proc->block_count, sizeof(Entry*));
+		ctx.end_depths = (int*) calloc(proc->block_count, sizeof(int));
+		ctx.joins = (char*) calloc(proc->block_count, 1);
+		ok = ctx.ends && ctx.end_depths && ctx.joins;
+	}
+
+	for (b=0; ok && (b<proc->block_count); b++) {
+		SsaBlock* block = &proc->blocks[b];
+		int end = (b + 1 < proc->block_count) ? proc->blocks[b + 1].pc : code->size;
+		int pc, next;
+
+		if (!block->reachable) {
+			block->first = proc->instr_count;
+			continue;
+		}
+		ok = start_block(&ctx, b);
+		for (pc=block->pc; ok && (pc<end); pc=next)
+			ok = translate_instr(&ctx, pc, &next);
+		ok = ok && end_block(&ctx, b);
+	}
+	for (b=0; ok && (b<proc->block_count); b++)
+		if (ctx.joins[b])
+			ok = fill_phis(&ctx, b);
+
+	if (ctx.ends)
+		for (i=0; i<proc->block_count; i++)
+			free(ctx.ends[i]);
+	free(ctx.ends);
+	free(ctx.end_depths);
+	free(ctx.joins);
+	free(ctx.block_of);
+	free(ctx.slots);
+	return ok;
+}
+
+static inline int resolve(SsaProc* proc, int value) {
+	while (proc->instrs[value].op == SSA_COPY)
+		value = ssa_arg(proc, &proc->instrs[value], 0);
+	return value;
+}
+
+/* uses of copies read their sources, and phis whose args are one value besides themselves become copies */
+static void propagate_copies(SsaProc* proc) {
+	int changed = 1;
+	int v, i;
+
+	while (changed) {
+		changed = 0;
+		for (v=0; v<proc->instr_count; v++) {
+			SsaInstr* instr = &proc->instrs[v];
+			int same = -1;
+			int trivial = 1;
+
+			for (i=0; i<instr->arg_count; i++)
+				proc->args[instr->args + i] = resolve(proc, proc->args[instr->args + i]);
+			if (instr->op != SSA_PHI)
+				continue;
+			for (i=0; trivial && (i<instr->arg_count); i++) {
+				int arg = proc->args[instr->args + i];
+				if ((arg == v) || (arg == same))
+					continue;
+				trivial = (same < 0);
+				same = arg;
+			}
+			if (trivial && (same >= 0)) {
+				instr->op = SSA_COPY;
+				instr->arg_count = 1;
+				proc->args[instr->args] = same;
+				changed = 1;
+			}
+		}
+	}
+}
+
+static inline int has_effect(SsaOp op) {
+	return (op >= SSA_CALL);
+}
+
+/* keeps what control flow, calls and returns depend on */
+static int eliminate_dead_code(SsaProc* proc) {
+	char* live = (char*) calloc(proc->instr_count + 1, 1);
+	int* work = (int*) malloc((proc->instr_count + 1) * sizeof(int));
+	int top = 0;
+	int v, i;
+
+	if (!live || !work) {
+		free(live);
+		free(work);
+		return 0;
+	}
+	for (v=0; v<proc->instr_count; v++)
+		if (has_effect(proc->instrs[v].op)) {
+			live[v] = 1;
+			work[top++] = v;
+		}
+	while (top) {
+		SsaInstr* instr = &proc->instrs[work[--top]];
+		for (i=0; i<instr->arg_count; i++) {
+			int arg = proc->args[instr->args + i];
+			if (!live[arg]) {
+				live[arg] = 1;
+				work[top++] = arg;
+			}
+		}
+	}
+	for (v=0; v<proc->instr_count; v++)
+		if (!live[v])
+			proc->instrs[v].op = SSA_INVALID;
+	free(live);
+	free(work);
+	return 1;
+}
+
+/* values that need a register or a frame slot */
+static inline int is_allocated(SsaOp op) {
+	return (op == SSA_PARAM) || (op == SSA_PHI) || (op == SSA_COPY)
+		|| (op == SSA_ADD) || (op == SSA_MUL) || (op == SSA_SUB) || (op == SSA_CALL);
+}
+
+/*
+ * Positions are 2 * instruction index; a block spans from 2 * first to
+ * 2 * (first + count), where the moves into the phis of its successors
+ * take place. Each value gets a single range, from its definition to
+ * its last use or the end of the last block it is live out of.
+ */
+typedef struct Liveness {
+	int        words;
+	unsigned*  live_in;
+	unsigned*  live_out;
+	int*       block_of;
+	int*       start;
+	int*       end;
+} Liveness;
+
+static inline void set_bit(unsigned* set, int v) {
+	set[v / 32] |= 1u << (v % 32);
+}
+
+static inline int has_bit(unsigned* set, int v) {
+	return (set[v / 32] >> (v % 32)) & 1;
+}
+
+static inline int block_start(SsaBlock* block) {
+	return 2 * block->first;
+}
+
+static inline int block_end(SsaBlock* block) {
+	return 2 * (block->first + block->count);
+}
+
+static int pred_index(SsaProc* proc, SsaBlock* block, int pred) {
+	int i;
+	for (i=0; i<block->pred_count; i++)
+		if (proc->preds[block->preds + i] == pred)
+			return i;
+	return -1;
+}
+
+static void live_out_of(SsaProc* proc, Liveness* live, int b, unsigned* out) {
+	SsaBlock* block = &proc->blocks[b];
+	int succs[2] = { block->next, block->target };
+	int i, w, v;
+
+	memset(out, 0, live->words * sizeof(unsigned));
+	for (i=0; i<2; i++) {
+		SsaBlock* succ;
+		int index;
+		if (succs[i] < 0)
+			continue;
+		succ = &proc->blocks[succs[i]];
+		for (w=0; w<live->words; w++)
+			out[w] |= live->live_in[succs[i] * live->words + w];
+		index = pred_index(proc, succ, b);
+		for (v=succ->first; v<succ->first+succ->count; v++) {
+			SsaInstr* instr = &proc->instrs[v];
+			if (instr->op == SSA_PHI) {
+				int arg = ssa_arg(proc, instr, index);
+				if (is_allocated(proc->instrs[arg].op))
+					set_bit(out, arg);
+			}
+		}
+	}
+}
+
+static int compute_liveness(SsaProc* proc, Liveness* live) {
+	int n = proc->instr_count;
+	int changed = 1;
+	unsigned* set;
+	int b, v, i, w;
+
+	live->words = (n + 31) / 32 + 1;
+	live->live_in = (unsigned*) calloc(proc->block_count * live->words, sizeof(unsigned));
+	live->live_out = (unsigned*) calloc(proc->block_count * live->words, sizeof(unsigned));
+	live->block_of = (int*) malloc((n + 1) * sizeof(int));
+	live->start = (int*) malloc((n + 1) * sizeof(int));
+	live->end = (int*) malloc((n + 1) * sizeof(int));
+	set = (unsigned*) malloc(live->words * sizeof(unsigned));
+	if (!live->live_in || !live->live_out || !live->block_of || !live->start || !live->end || !set) {
+		free(set);
+		return 0;
+	}
+	for (b=0; b<proc->block_count; b++)
+		for (v=proc->blocks[b].first; v<proc->blocks[b].first+proc->blocks[b].count; v++)
+			live->block_of[v] = b;
+
+	while (changed) {
+		changed = 0;
+		for (b=proc->block_count-1; b>=0; b--) {
+			SsaBlock* block = &proc->blocks[b];
+			unsigned* in = &live->live_in[b * live->words];
+			if (!block->reachable)
+				continue;
+			live_out_of(proc, live, b, set);
+			memcpy(&live->live_out[b * live->words], set, live->words * sizeof(unsigned));
+			for (v=block->first+block->count-1; v>=block->first; v--) {
+				SsaInstr* instr = &proc->instrs[v];
+				set[v / 32] &= ~(1u << (v % 32));
+				if ((instr->op == SSA_PHI) || (instr->op == SSA_INVALID))
+					continue;
+				for (i=0; i<instr->arg_count; i++) {
+					int arg = ssa_arg(proc, instr, i);
+					if (is_allocated(proc->instrs[arg].op))
+						set_bit(set, arg);
+				}
+			}
+			for (w=0; w<live->words; w++)
+				if (set[w] != in[w]) {
+					in[w] = set[w];
+					changed = 1;
+				}
+		}
+	}
+	free(set);
+
+	for (v=0; v<n; v++) {
+		SsaInstr* instr = &proc->instrs[v];
+		live->start[v] = (instr->op == SSA_PHI) ? block_start(&proc->blocks[live->block_of[v]]) : 2 * v;
+		live->end[v] = live->start[v];
+	}
+	for (v=0; v<n; v++) {
+		SsaInstr* instr = &proc->instrs[v];
+		for (i=0; i<instr->arg_count; i++) {
+			int arg = ssa_arg(proc, instr, i);
+			int use = 2 * v;
+			if (instr->op == SSA_PHI) {
+				SsaBlock* block = &proc->blocks[live->block_of[v]];
+				use = block_end(&proc->blocks[proc->preds[block->preds + i]]);
+			}
+			if (use > live->end[arg])
+				live->end[arg] = use;
+		}
+	}
+	for (b=0; b<proc->block_count; b++) {
+		SsaBlock* block = &proc->blocks[b];
+		if (!block->reachable)
+			continue;
+		for (v=0; v<n; v++) {
+			if (has_bit(&live->live_out[b * live->words], v) && (block_end(block) > live->end[v]))
+				live->end[v] = block_end(block);
+			if (has_bit(&live->live_in[b * live->words], v) && (block_start(block) < live->start[v]))
+				live->start[v] = block_start(block);
+		}
+	}
+	return 1;
+}
+
+static void free_liveness(Liveness* live) {
+	free(live->live_in);
+	free(live->live_out);
+	free(live->block_of);
+	free(live->start);
+	free(live->end);
+}
+
+static Liveness* sort_live;
+
+static int by_start(const void* a, const void* b) {
+	int x = *(const int*) a;
+	int y = *(const int*) b;
+	if (sort_live->start[x] != sort_live->start[y])
+		return sort_live->start[x] - sort_live->start[y];
+	return x - y;
+}
+
+/* a register a value would avoid a move with, SSA_NO_REG when there is none free */
+static int hinted_reg(SsaProc* proc, int* phi_of, unsigned free_regs, int v) {
+	SsaInstr* instr = &proc->instrs[v];
+	int candidates[3] = { SSA_NO_REG, SSA_NO_REG, SSA_NO_REG };
+	int i;
+
+	if (phi_of[v] >= 0)
+		candidates[0] = proc->locs[phi_of[v]].reg;
+	switch (instr->op) {
+	case SSA_ADD:
+	case SSA_MUL:
+		candidates[2] = proc->locs[ssa_arg(proc, instr, 1)].reg;
+		/* fall through */
+	case SSA_SUB:
+	case SSA_COPY:
+		candidates[1] = proc->locs[ssa_arg(proc, instr, 0)].reg;
+		break;
+	case SSA_PHI:
+		for (i=0; i<instr->arg_count; i++)
+			if ((proc->locs[ssa_arg(proc, instr, i)].reg != SSA_NO_REG)
+				&& ((free_regs >> proc->locs[ssa_arg(proc, instr, i)].reg) & 1))
+				return proc->locs[ssa_arg(proc, instr, i)].reg;
+		break;
+	default:
+		break;
+	}
+	for (i=0; i<3; i++)
+		if ((candidates[i] != SSA_NO_REG) && ((free_regs >> candidates[i]) & 1))
+			return candidates[i];
+	return SSA_NO_REG;
+}
+
+static int reg_users(SsaProc* proc, int* active, int active_count, int reg) {
+	int users = 0;
+	int k;
+	for (k=0; k<active_count; k++)
+		if (proc->locs[active[k]].reg == reg)
+			users++;
+	return users;
+}
+
+/*
+ * Single ranges overlap around loops: the phi of a loop variable lives
+ * to the exit test, so the value computed for the next iteration would
+ * get another register and a move on the back edge. They can share the
+ * register when that value lives in its block only, and the phi is not
+ * used after it there nor live out of it.
+ */
+static int coalesced_reg(SsaProc* proc, Liveness* live, int* phi_of, int* active, int active_count, int v) {
+	int phi = phi_of[v];
+	int b = live->block_of[v];
+	int reg, k, i;
+
+	if ((phi < 0) || (proc->instrs[v].op == SSA_PHI) || (proc->instrs[v].op == SSA_PARAM))
+		return SSA_NO_REG;
+	reg = proc->locs[phi].reg;
+	if ((reg == SSA_NO_REG) || (live->end[v] > block_end(&proc->blocks[b]))
+		|| has_bit(&live->live_out[b * live->words], phi))
+		return SSA_NO_REG;
+	for (k=0; k<active_count; k++)
+		if ((proc->locs[active[k]].reg == reg) && (active[k] != phi))
+			return SSA_NO_REG;
+	for (k=v+1; k<proc->blocks[b].first+proc->blocks[b].count; k++) {
+		SsaInstr* instr = &proc->instrs[k];
+		if (instr->op == SSA_INVALID)
+			continue;
+		for (i=0; i<instr->arg_count; i++)
+			if (ssa_arg(proc, instr, i) == phi)
+				return SSA_NO_REG;
+	}
+	return reg;
+}
+
+static inline void spill(SsaProc* proc, int v) {
+	SsaInstr* instr = &proc->instrs[v];
+	proc->locs[v].reg = SSA_NO_REG;
+	if (instr->op == SSA_PARAM)
+		proc->locs[v].disp = SSA_PARAM_DISP(instr->imm);
+	else
+		proc->locs[v].disp = SSA_SPILL_DISP(proc->spill_count++);
+}
+
+/* linear scan, spilling the value that lives longest when registers run out */
+static int allocate_registers(SsaProc* proc) {
+	Liveness live = { 0 };
+	int* order = (int*) malloc((proc->instr_count + 1) * sizeof(int));
+	int* active = (int*) malloc(2 * SSA_REGS * sizeof(int));
+	int* phi_of = (int*) malloc((proc->instr_count + 1) * sizeof(int));
+	unsigned free_regs = (1u << SSA_REGS) - 1;
+	int count = 0, active_count = 0;
+	int ok, v, i;
+
+	proc->locs = (SsaLoc*) malloc((proc->instr_count + 1) * sizeof(SsaLoc));
+	ok = order && active && phi_of && proc->locs && compute_liveness(proc, &live);
+	for (v=0; ok && (v<proc->instr_count); v++) {
+		SsaInstr* instr = &proc->instrs[v];
+		proc->locs[v].reg = SSA_NO_REG;
+		proc->locs[v].disp = 0;
+		phi_of[v] = -1;
+		if (is_allocated(instr->op))
+			order[count++] = v;
+	}
+	for (v=0; ok && (v<proc->instr_count); v++) {
+		SsaInstr* instr = &proc->instrs[v];
+		if (instr->op == SSA_PHI)
+			for (i=0; i<instr->arg_count; i++)
+				phi_of[ssa_arg(proc, instr, i)] = v;
+	}
+	if (ok) {
+		sort_live = &live;
+		qsort(order, count, sizeof(int), by_start);
+	}
+
+	for (i=0; ok && (i<count); i++) {
+		int reg, k;
+		v = order[i];
+		for (k=0; k<active_count; ) {
+			if (live.end[active[k]] <= live.start[v]) {
+				reg = proc->locs[active[k]].reg;
+				active[k] = active[--active_count];
+				if (!reg_users(proc, active, active_count, reg))
+					free_regs |= 1u << reg;
+			} else
+				k++;
+		}
+
+		reg = coalesced_reg(proc, &live, phi_of, active, active_count, v);
+		if (reg == SSA_NO_REG)
+			reg = hinted_reg(proc, phi_of, free_regs, v);
+		for (k=0; (reg == SSA_NO_REG) && (k<SSA_REGS); k++)
+			if ((free_regs >> k) & 1)
+				reg = k;
+		if (reg == SSA_NO_REG) {
+			int longest = -1;
+			for (k=0; k<active_count; k++)
+				if ((reg_users(proc, active, active_count, proc->locs[active[k]].reg) == 1)
+					&& ((longest < 0) || (live.end[active[k]] > live.end[active[longest]])))
+					longest = k;
+			if ((longest < 0) || (live.end[active[longest]] <= live.end[v])) {
+				spill(proc, v);
+				continue;
+			}
+			reg = proc->locs[active[longest]].reg;
+			spill(proc, active[longest]);
+			active[longest] = active[--active_count];
+		}
+		proc->locs[v].reg = reg;
+		free_regs &= ~(1u << reg);
+		proc->used_regs |= 1u << reg;
+		active[active_count++] = v;
+	}
+
+	free_liveness(&live);
+	free(order);
+	free(active);
+	free(phi_of);
+	return ok;
+}
+
+int init_ssa_prog(SsaProg* ssa_prog, InterpProg* interp_prog) {
+	int ok, i;
+
+	ssa_prog->proc_count = interp_prog->proc_count;
+	ssa_prog->main = interp_prog->main;
+	ssa_prog->procs = (SsaProc*) calloc(interp_prog->proc_count, sizeof(SsaProc));
+	ok = ssa_prog->procs != NULL;
+	for (i=0; ok && (i<interp_prog->proc_count); i++)
+		ssa_prog->procs[i].params = count_params(&interp_prog->procs[i]);
+	for (i=0; ok && (i<interp_prog->proc_count); i++) {
+		SsaProc* proc = &ssa_prog->procs[i];
+		/* -l leaves what main does not reach uncompiled, and nothing calls it */
+		if (interp_prog->procs[i].size == 0)
+			continue;
+		ok = build_ssa(ssa_prog, proc, &interp_prog->procs[i]);
+		if (ok)
+			propagate_copies(proc);
+		ok = ok && eliminate_dead_code(proc) && allocate_registers(proc);
+	}
+	if (!ok)
+		destroy_ssa_prog(ssa_prog);
+	return ok;
+}
+
+static inline int dump_write(FILE* fp, const char* fmt, ...) {
+	int ok;
+	va_list ap;
+	va_start(ap, fmt);
+	ok = vfprintf(fp, fmt, ap) > 0;
+	va_end(ap);
+	return ok;
+}
+
+static const char* OP_NAMES[] = {
+	"invalid", "const", "param", "phi", "copy", "add", "mul", "sub",
+	"call", "callv", "jmp", "jlt", "jltz", "ret", "retv"
+};
+
+static int dump_instr(SsaProc* proc, int v, FILE* fp) {
+	SsaInstr* instr = &proc->instrs[v];
+	int ok = dump_write(fp, "%6d: ", v);
+	int i;
+
+	if (ok && (is_allocated(instr->op) || (instr->op == SSA_CONST)))
+		ok = dump_write(fp, "v%d = ", v);
+	ok = ok && dump_write(fp, "%s", OP_NAMES[instr->op]);
+	if (ok && ((instr->op == SSA_CONST) || (instr->op == SSA_PARAM)
+		|| (instr->op == SSA_CALL) || (instr->op == SSA_CALLV)))
+		ok = dump_write(fp, " %d", instr->imm);
+	for (i=0; ok && (i<instr->arg_count); i++)
+		ok = dump_write(fp, "%s v%d", i ? "," : "", ssa_arg(proc, instr, i));
+	if (ok && ((instr->op == SSA_JMP) || (instr->op == SSA_JLT) || (instr->op == SSA_JLTZ)))
+		ok = dump_write(fp, "%s block %d", instr->arg_count ? "," : "", instr->imm);
+	if (ok && is_allocated(instr->op)) {
+		if (proc->locs[v].reg != SSA_NO_REG)
+			ok = dump_write(fp, "  ; r%d", proc->locs[v].reg);
+		else
+			ok = dump_write(fp, "  ; [%+d]", proc->locs[v].disp);
+	}
+	return ok && dump_write(fp, "\n");
+}
+
+int dump_ssa_prog(SsaProg* prog, FILE* fp) {
+	int ok = 1;
+	int i, b, v;
+
+	for (i=0; ok && (i<prog->proc_count); i++) {
+		SsaProc* proc = &prog->procs[i];
+		ok = dump_write(fp, "Proc (%d) params %d, spills %d\n", i, proc->params, proc->spill_count);
+		for (b=0; ok && (b<proc->block_count); b++) {
+			SsaBlock* block = &proc->blocks[b];
+			if (!block->reachable)
+				continue;
+			ok = dump_write(fp, "  block %d (pc %d)\n", b, block->pc);
+			for (v=block->first; ok && (v<block->first+block->count); v++)
+				if (proc->instrs[v].op != SSA_INVALID)
+					ok = dump_instr(proc, v, fp);
+		}
+	}
+	return ok;
+}
+
+void destroy_ssa_prog(SsaProg* prog) {
+	int i;
+	for (i=0; prog->procs && (i<prog->proc_count); i++) {
+		SsaProc* proc = &prog->procs[i];
+		free(proc->blocks);
+		free(proc->instrs);
+		free(proc->args);
+		free(proc->preds);
+		free(proc->locs);
+	}
+	free(prog->procs);
+	prog->procs = NULL;
+}
@@ -0,0 +1,106 @@
+#ifndef SSA_H
+#define SSA_H
+
+#include <stdio.h>
+
+#include "interp.h"
+
+/*
+ * SSA form of stack code, the input of the optimizing JIT tier. A value
+ * is the index of the instruction defining it; args of instructions are
+ * ranges of SsaProc.args. Phis have one arg per predecessor of their
+ * block, in the order of its preds.
+ */
+typedef enum SsaOp {
+	SSA_INVALID = 0,   /* removed */
+	SSA_CONST,         /* imm */
+	SSA_PARAM,         /* param imm */
+	SSA_PHI,
+	SSA_COPY,
+	SSA_ADD,
+	SSA_MUL,
+	SSA_SUB,
+	SSA_CALL,          /* proc imm, args in param order */
+	SSA_CALLV,
+	SSA_JMP,           /* to the target block */
+	SSA_JLT,           /* to the target block if arg 0 - arg 1 < 0 */
+	SSA_JLTZ,          /* to the target block if arg 0 < 0 */
+	SSA_RET,
+	SSA_RETV
+} SsaOp;
+
+typedef struct SsaInstr {
+	SsaOp  op;
+	int    imm;
+	int    arg_count;
+	int    args;
+} SsaInstr;
+
+/* next is the fall through successor, target the one jumped to, -1 when absent */
+typedef struct SsaBlock {
+	int  pc;
+	int  reachable;
+	int  first;
+	int  count;
+	int  pred_count;
+	int  preds;
+	int  next;
+	int  target;
+} SsaBlock;
+
+/* registers are numbered from 0 to SSA_REGS - 1, the JIT maps them to machine ones */
+#define SSA_REGS      12
+#define SSA_NO_REG    -1
+
+/*
+ * Where the allocator put each value: reg, or the frame slot at disp
+ * from the frame pointer when reg is SSA_NO_REG. Spilled params stay in
+ * the slot the caller pushed them to, above the return address; spill
+ * slots are below the frame pointer. Constants are immediates.
+ */
+#define SSA_PARAM_DISP(param)  (16 + 8 * (param))
+#define SSA_SPILL_DISP(slot)   (-8 - 8 * (slot))
+
+typedef struct SsaLoc {
+	int  reg;
+	int  disp;
+} SsaLoc;
+
+typedef struct SsaProc {
+	int        params;
+	int        block_count;
+	SsaBlock*  blocks;
+	int        instr_count;
+	int        instr_capacity;
+	SsaInstr*  instrs;
+	int        arg_count;
+	int        arg_capacity;
+	int*       args;
+	int*       preds;
+	SsaLoc*    locs;
+	int        spill_count;
+	unsigned   used_regs;
+} SsaProc;
+
+typedef struct SsaProg {
+	int       proc_count;
+	int       main;
+	SsaProc*  procs;
+} SsaProg;
+
+static inline int ssa_arg(SsaProc* proc, SsaInstr* instr, int i) {
+	return proc->args[instr->args + i];
+}
+
+/*
+ * Builds the SSA form of every procedure, propagates copies, drops dead
+ * code and allocates registers. 0 when the stack code has a shape the
+ * translation does not handle, or no memory.
+ */
+int init_ssa_prog(SsaProg* ssa_prog, InterpProg* interp_prog);
+
+int dump_ssa_prog(SsaProg* prog, FILE* fp);
+
+void destroy_ssa_prog(SsaProg* prog);
+
+#endif
@@ -1,35 +1,44 @@
 #include "parser.h"
 
-#include <stdlib.h>
-#include <string.h>
+#define LINEAR_BINDS   8
 
-static void free_bind(Bind* bind) {
-	if (bind->next)
-		free_bind(bind->next);
-	free(bind);
-}
-
-void init_context(Context* context, Context* upper_context) {
+void init_context(Context* context, Context* upper_context, Arena* arena) {
 	context->upper_context = upper_context;
+	context->arena = arena;
 	context->first_bind = NULL;
+	context->bind_count = 0;
+	context->mask = 0;
+	context->table = NULL;
 }
 
-void free_context(Context* context) {
-	if (context->first_bind)
-		free_bind(context->first_bind);
+/* symbols are dense, a multiplicative hash spreads runs of them */
+static inline unsigned hash_symbol(Symbol id) {
+	return id * 2654435761u;
 }
 
-Bind* local_lookup(Context* context, const char* id) {
-	Bind* b = context->first_bind;
+Bind* local_lookup(Context* context, Symbol id) {
+	Bind* b;
+
+	if (context->table) {
+		unsigned slot = hash_symbol(id) & context->mask;
+		while ((b = context->table[slot])) {
+			if (b->id == id)
+				return b;
+			slot = (slot + 1) & context->mask;
+		}
+		return NULL;
+	}
+
+	b = context->first_bind;
 	while (b) {
-		if (strcmp(id, b->id) == 0)
+		if (b->id == id)
 			return b;
 		b = b->next;
 	}
 	return NULL;
 }
 
-Bind* lookup(Context* context, const char* id) {
+Bind* lookup(Context* context, Symbol id) {
 	Context* ctx = context;
 	while (ctx) {
 		Bind* b = local_lookup(ctx, id);
@@ -40,48 +49,79 @@ Bind* lookup(Context* context, const char* id) {
 	return NULL;
 }
 
-Type* lookup_type(Context* context, const char* id) {
+Type* lookup_type(Context* context, Symbol id) {
 	Bind *bind = lookup(context, id);
 	if (!bind || (bind->type != BIND_TYPE))
 		return NULL;
 	return bind->content.as_type;
 }
 
-static inline Bind* bind_alloc(Context* context, const char* id, BindType type) {
-	Bind* b = (Bind*) calloc(1, sizeof(Bind));
+static inline void table_insert(Bind** table, unsigned mask, Bind* b) {
+	unsigned slot = hash_symbol(b->id) & mask;
+	while (table[slot])
+		slot = (slot + 1) & mask;
+	table[slot] = b;
+}
+
+/* kept at most half full; the old table stays in the arena */
+static int grow_table(Context* context) {
+	unsigned size = context->table ? 2 * (context->mask + 1) : 4 * LINEAR_BINDS;
+	Bind** table;
+	Bind* b;
+
+	while (size < 2 * context->bind_count)
+		size *= 2;
+	table = (Bind**) arena_alloc(context->arena, size * sizeof(Bind*));
+	if (!table)
+		return 0;
+	for (b=context->first_bind; b; b=b->next)
+		table_insert(table, size - 1, b);
+	context->table = table;
+	context->mask = size - 1;
+	return 1;
+}
+
+static inline Bind* bind_alloc(Context* context, Symbol id, BindType type) {
+	Bind* b = (Bind*) arena_alloc(context->arena, sizeof(Bind));
 	if (!b)
 		return NULL;
 	b->id = id;
 	b->type = type;
 	b->next = context->first_bind;
 	context->first_bind = b;
+	context->bind_count++;
+
+	if (context->table && (2 * context->bind_count <= context->mask + 1))
+		table_insert(context->table, context->mask, b);
+	else if ((context->table || (context->bind_count > LINEAR_BINDS)) && !grow_table(context))
+		return NULL;
 	return b;	
 }
 
-Bind* bind_fparam(Context* context, const char* id, FParam* fparam) {
+Bind* bind_fparam(Context* context, Symbol id, FParam* fparam) {
 	Bind* b = bind_alloc(context, id, BIND_FPARAM);
 	if (b)
 		b->content.as_fparam = fparam;
 	return b;
 }
 
-Bind* bind_var(Context* context, const char* id, Var* var) {
+Bind* bind_var(Context* context, Symbol id, Var* var) {
 	Bind* b = bind_alloc(context, id, BIND_VAR);
 	if (b)
 		b->content.as_var = var;
 	return b;
 }
 
-Bind* bind_proc(Context* context, const char* id, Proc* proc) {
+Bind* bind_proc(Context* context, Symbol id, Proc* proc) {
 	Bind* b = bind_alloc(context, id, BIND_PROC);
 	if (b)
 		b->content.as_proc = proc;
 	return b;
 }
 
-Bind* bind_type(Context* context, const char* id, Type* type) {
+Bind* bind_type(Context* context, Symbol id, Type* type) {
 	Bind* b = bind_alloc(context, id, BIND_TYPE);
 	if (b)
 		b->content.as_type = type;
 	return b;
-}
\ No newline at end of file
+}
@@ -0,0 +1,222 @@
+#include "tokens.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_CHUNK_SIZE   (256 * 1024)
+
+typedef struct Chunk {
+	TokenStream  tokens;
+	size_t       from;
+	size_t       until;
+	int          last;
+	int          lines;
+	int          ok;
+	int          started;
+	pthread_t    thread;
+} Chunk;
+
+static int resize_tokens(TokenStream* tokens, int capacity) {
+	unsigned char* kind;
+	unsigned* offset;
+	unsigned* size;
+	Symbol* symbol;
+	int* line;
+	int* column;
+
+	kind = (unsigned char*) realloc(tokens->kind, capacity * sizeof(unsigned char));
+	if (kind)
+		tokens->kind = kind;
+	offset = (unsigned*) realloc(tokens->offset, capacity * sizeof(unsigned));
+	if (offset)
+		tokens->offset = offset;
+	size = (unsigned*) realloc(tokens->size, capacity * sizeof(unsigned));
+	if (size)
+		tokens->size = size;
+	symbol = (Symbol*) realloc(tokens->symbol, capacity * sizeof(Symbol));
+	if (symbol)
+		tokens->symbol = symbol;
+	line = (int*) realloc(tokens->line, capacity * sizeof(int));
+	if (line)
+		tokens->line = line;
+	column = (int*) realloc(tokens->column, capacity * sizeof(int));
+	if (column)
+		tokens->column = column;
+
+	if (!kind || !offset || !size || !symbol || !line || !column)
+		return 0;
+	tokens->capacity = capacity;
+	return 1;
+}
+
+static inline void init_tokens(TokenStream* tokens, const char* data) {
+	memset(tokens, 0, sizeof(TokenStream));
+	tokens->buffer = data;
+}
+
+void destroy_tokens(TokenStream* tokens) {
+	free(tokens->kind);
+	free(tokens->offset);
+	free(tokens->size);
+	free(tokens->symbol);
+	free(tokens->line);
+	free(tokens->column);
+	init_tokens(tokens, NULL);
+}
+
+/* lexes [from, until), which must start a line; EOF is kept only if last */
+static int lex_range(TokenStream* tokens, const char* data, size_t from, size_t until,
+	int last, Interner* interner, int* lines) {
+	Lexer l;
+
+	init_lexer_buffer(&l, data, until, interner);
+	l.offset = from;
+	l.line_offset = from;
+
+	if (!resize_tokens(tokens, (until - from) / 4 + 16))
+		return 0;
+
+	while (1) {
+		int i;
+
+		lex(&l);
+		if ((l.token == TK_EOF) && !last)
+			break;
+		if ((tokens->count == tokens->capacity)
+			&& !resize_tokens(tokens, 2 * tokens->capacity))
+			return 0;
+
+		i = tokens->count++;
+		tokens->kind[i] = l.token;
+		tokens->offset[i] = l.lexeme_offset;
+		tokens->size[i] = l.lexeme_size;
+		tokens->symbol[i] = l.symbol;
+		tokens->line[i] = l.location.from.line;
+		tokens->column[i] = l.location.from.column;
+
+		if (l.token == TK_EOF)
+			break;
+		if ((l.token == TK_ID) && interner && !l.symbol)
+			return 0;
+	}
+
+	*lines = l.location.until.line - 1;
+	return 1;
+}
+
+static void* lex_chunk(void* arg) {
+	Chunk* chunk = (Chunk*) arg;
+	chunk->ok = lex_range(&chunk->tokens, chunk->tokens.buffer, chunk->from, chunk->until,
+		chunk->last, NULL, &chunk->lines);
+	return NULL;
+}
+
+static inline int split(Chunk* chunks, int count, const char* data, size_t size) {
+	int i, n;
+	size_t from = 0;
+
+	n = 0;
+	for (i=0; (i<count) && (from < size); i++) {
+		size_t until = size;
+		if (i < count - 1) {
+			const char* nl;
+			until = (size / count) * (i + 1);
+			if (until < from)
+				until = from;
+			nl = (const char*) memchr(&data[until], '\n', size - until);
+			until = nl ? (size_t)(nl - data) + 1 : size;
+		}
+		init_tokens(&chunks[n].tokens, data);
+		chunks[n].from = from;
+		chunks[n].until = until;
+		chunks[n].last = 0;
+		n++;
+		from = until;
+	}
+	chunks[n-1].last = 1;
+	return n;
+}
+
+static inline int stitch(TokenStream* tokens, Chunk* chunks, int count, Interner* interner) {
+	int i;
+	int total = 0;
+	int lines = 0;
+
+	for (i=0; i<count; i++)
+		total += chunks[i].tokens.count;
+	if (!resize_tokens(tokens, total))
+		return 0;
+
+	for (i=0; i<count; i++) {
+		TokenStream* part = &chunks[i].tokens;
+		int base = tokens->count;
+		int k;
+
+		memcpy(&tokens->kind[base], part->kind, part->count * sizeof(unsigned char));
+		memcpy(&tokens->offset[base], part->offset, part->count * sizeof(unsigned));
+		memcpy(&tokens->size[base], part->size, part->count * sizeof(unsigned));
+		memcpy(&tokens->column[base], part->column, part->count * sizeof(int));
+		for (k=0; k<part->count; k++) {
+			int t = base + k;
+			tokens->line[t] = part->line[k] + lines;
+			tokens->symbol[t] = NO_SYMBOL;
+			if ((tokens->kind[t] == TK_ID) && interner) {
+				tokens->symbol[t] = intern(interner, &tokens->buffer[tokens->offset[t]],
+					tokens->size[t]);
+				if (!tokens->symbol[t])
+					return 0;
+			}
+		}
+
+		tokens->count += part->count;
+		lines += chunks[i].lines;
+	}
+	return 1;
+}
+
+int tokenize(TokenStream* tokens, const char* data, size_t size, int threads,
+	Interner* interner) {
+	Chunk* chunks;
+	int i, count, ok;
+
+	init_tokens(tokens, data);
+
+	if (threads > (int)(size / MIN_CHUNK_SIZE))
+		threads = size / MIN_CHUNK_SIZE;
+	if (threads <= 1) {
+		int lines;
+		ok = lex_range(tokens, data, 0, size, 1, interner, &lines);
+		if (!ok)
+			destroy_tokens(tokens);
+		return ok;
+	}
+
+	chunks = (Chunk*) calloc(threads, sizeof(Chunk));
+	if (!chunks)
+		return 0;
+	count = split(chunks, threads, data, size);
+
+	for (i=1; i<count; i++) {
+		chunks[i].started = pthread_create(&chunks[i].thread, NULL, lex_chunk, &chunks[i]) == 0;
+		if (!chunks[i].started)
+			lex_chunk(&chunks[i]);
+	}
+	lex_chunk(&chunks[0]);
+	for (i=1; i<count; i++)
+		if (chunks[i].started)
+			pthread_join(chunks[i].thread, NULL);
+
+	ok = 1;
+	for (i=0; i<count; i++)
+		ok = ok && chunks[i].ok;
+	if (ok)
+		ok = stitch(tokens, chunks, count, interner);
+
+	for (i=0; i<count; i++)
+		destroy_tokens(&chunks[i].tokens);
+	free(chunks);
+	if (!ok)
+		destroy_tokens(tokens);
+	return ok;
+}
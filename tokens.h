@@ -0,0 +1,34 @@
+#ifndef TOKENS_H
+#define TOKENS_H
+
+#include "lexer.h"
+
+/*
+ * A whole source lexed up front, stored as parallel arrays. Token i is
+ * kind[i] at [offset[i], offset[i] + size[i]) of buffer, symbol[i] is its
+ * interned name if it is a TK_ID; the last token is always TK_EOF.
+ */
+typedef struct TokenStream {
+	const char*     buffer;
+	int             count;
+	int             capacity;
+	unsigned char*  kind;
+	unsigned*       offset;
+	unsigned*       size;
+	Symbol*         symbol;
+	int*            line;
+	int*            column;
+} TokenStream;
+
+/*
+ * Lexes data with up to threads threads. Large sources are split after a
+ * newline, which is always between tokens, lexed chunk by chunk and the
+ * chunks are stitched back in order; identifiers are then interned in
+ * source order.
+ */
+int tokenize(TokenStream* tokens, const char* data, size_t size, int threads,
+	Interner* interner);
+
+void destroy_tokens(TokenStream* tokens);
+
+#endif
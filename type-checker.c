@@ -4,48 +4,113 @@
 #include <stdlib.h>
 #include <string.h>
 
-
-static inline void free_proc_type(ProcType* proc_type) {
-	free(proc_type->fparams);
-	free(proc_type);
+#define INITIAL_TYPES   64
+#define LOCAL_FPARAMS   16
+
+void init_type_table(TypeTable* types, Arena* arena) {
+	types->arena = arena;
+	types->count = 0;
+	types->mask = 0;
+	types->table = NULL;
 }
 
-static inline int init_proc_type_fps(ProcType* proc_type, Proc* proc) {
+/* component types are interned already, so their addresses identify them */
+static inline unsigned hash_signature(Type* return_type, int fparams_count, Type** fparams) {
+	size_t hash = (size_t) return_type ^ fparams_count;
 	int i;
-	int n = proc->fparam_count;
-	FParam* fparam = proc->first_fparam;
+	for (i=0; i<fparams_count; i++)
+		hash = hash * 31 + (size_t) fparams[i];
+	return (unsigned) (hash ^ (hash >> 32)) * 2654435761u;
+}
 
-	proc_type->fparams_count = n;
-	proc_type->fparams = (Type**) calloc(n, sizeof(Type*));
-	if (!proc_type->fparams)
-		return 0;
+static inline int same_signature(ProcType* proc_type, Type* return_type, int fparams_count,
+	Type** fparams) {
+	return (proc_type->return_type == return_type)
+		&& (proc_type->fparams_count == fparams_count)
+		&& (memcmp(proc_type->fparams, fparams, fparams_count * sizeof(Type*)) == 0);
+}
 
-	for (i=0; i<n; i++) {
-		assert(fparam);
-		proc_type->fparams[i] = fparam->actual_type.type;
-		fparam = fparam->next;
-	}
+/* kept at most half full; the old table stays in the arena */
+static int grow_types(TypeTable* types) {
+	unsigned size = types->table ? 2 * (types->mask + 1) : INITIAL_TYPES;
+	Type** table = (Type**) arena_alloc(types->arena, size * sizeof(Type*));
+	unsigned i;
 
+	if (!table)
+		return 0;
+	for (i=0; types->table && (i<=types->mask); i++) {
+		Type* type = types->table[i];
+		if (type) {
+			ProcType* p = type->content.as_proc;
+			unsigned slot = hash_signature(p->return_type, p->fparams_count, p->fparams) & (size - 1);
+			while (table[slot])
+				slot = (slot + 1) & (size - 1);
+			table[slot] = type;
+		}
+	}
+	types->table = table;
+	types->mask = size - 1;
 	return 1;
 }
 
-static inline int init_proc_type(Proc* proc) {
-	ProcType *proc_type = (ProcType*) calloc(1, sizeof(ProcType));
-	if (!proc_type)
-		return 0;
+static Type* new_proc_type(Arena* arena, Type* return_type, int fparams_count, Type** fparams) {
+	Type* type = (Type*) arena_alloc(arena, sizeof(Type));
+	ProcType* proc_type = (ProcType*) arena_alloc(arena, sizeof(ProcType));
+	Type** copy = (Type**) arena_alloc(arena, fparams_count * sizeof(Type*));
+
+	if (!type || !proc_type || !copy)
+		return NULL;
+	memcpy(copy, fparams, fparams_count * sizeof(Type*));
+	proc_type->fparams_count = fparams_count;
+	proc_type->fparams = copy;
+	proc_type->return_type = return_type;
+	type->kind = TYPE_PROC;
+	type->content.as_proc = proc_type;
+	return type;
+}
+
+Type* proc_type(TypeTable* types, Type* return_type, int fparams_count, Type** fparams) {
+	unsigned hash = hash_signature(return_type, fparams_count, fparams);
+	unsigned slot;
+	Type* type;
+
+	if ((2 * (types->count + 1) > types->mask + 1) && !grow_types(types))
+		return NULL;
+
+	slot = hash & types->mask;
+	while ((type = types->table[slot])) {
+		if (same_signature(type->content.as_proc, return_type, fparams_count, fparams))
+			return type;
+		slot = (slot + 1) & types->mask;
+	}
 
-	if (!init_proc_type_fps(proc_type, proc)) {
-		free_proc_type(proc_type);
-		return 0;		
+	type = new_proc_type(types->arena, return_type, fparams_count, fparams);
+	if (type) {
+		types->table[slot] = type;
+		types->count++;
 	}
+	return type;
+}
 
-	if (proc->is_function)
-		proc_type->return_type = proc->actual_return_type.type;
+static inline int init_proc_type(TypeTable* types, Proc* proc) {
+	Type* local[LOCAL_FPARAMS];
+	Type** fparams = local;
+	int i;
 
-	proc->type.kind = TYPE_PROC;
-	proc->type.content.as_proc = proc_type;
+	if ((proc->fparam_count > LOCAL_FPARAMS)
+		&& !(fparams = (Type**) malloc(proc->fparam_count * sizeof(Type*))))
+		return 0;
+	for (i=0; i<proc->fparam_count; i++)
+		fparams[i] = proc->fparams[i].actual_type.type;
+
+	proc->type = proc_type(types, proc->is_function ? proc->actual_return_type.type : NULL,
+		proc->fparam_count, fparams);
+	if (fparams != local)
+		free(fparams);
+	if (!proc->type)
+		return 0;
 
-	proc->actual_type.type = &proc->type;
+	proc->actual_type.type = proc->type;
 	proc->actual_type.lvalue = 1;
 	proc->actual_type.constant = 1;
 
@@ -53,31 +118,29 @@ static inline int init_proc_type(Proc* proc) {
 }
 
 static inline int attach_types_fps(Proc* proc) {
-	FParam* fparam = proc->first_fparam;
-	while (fparam) {
+	int i;
+	for (i=0; i<proc->fparam_count; i++) {
+		FParam* fparam = &proc->fparams[i];
 		if (fparam->type_bind->type != BIND_TYPE)
 			return 0;
 
 		fparam->actual_type.type = fparam->type_bind->content.as_type;
 		fparam->actual_type.lvalue = 1;
 		fparam->actual_type.constant = 0;
-
-		fparam = fparam->next;
 	}
 	return 1;
 }
 
-static inline int attach_types_vars(Proc* proc) {
-	Var* var = proc->first_var;
-	while (var) {
+int type_check_vars(Proc* proc) {
+	int i;
+	for (i=0; i<proc->var_count; i++) {
+		Var* var = &proc->vars[i];
 		if (var->type_bind->type != BIND_TYPE)
 			return 0;
 
 		var->actual_type.type = var->type_bind->content.as_type;
 		var->actual_type.lvalue = 1;
 		var->actual_type.constant = 0;
-
-		var = var->next;
 	}
 	return 1;
 }
@@ -91,49 +154,42 @@ static inline int attach_return_type(Proc* proc) {
 	return 1;
 }
 
-static inline int attach_types(Prog* prog) {
-	int ok = 1;
-	Proc* proc = prog->first_proc;
-	while (ok && proc) {
-		if (attach_types_fps(proc) 
-			&& attach_types_vars(proc) 
-			&& attach_return_type(proc) 
-			&& init_proc_type(proc))
-			proc = proc->next;
-		else
-			ok = 0;
-	}
-	return ok;
+int type_check_header(TypeTable* types, Proc* proc) {
+	return attach_types_fps(proc)
+		&& type_check_vars(proc)
+		&& attach_return_type(proc)
+		&& init_proc_type(types, proc);
 }
 
-static int type_check_expr(Expr* expr);
+static inline int same_type(Type* a, Type* b) {
+	return a && (a == b);
+}
 
 static inline
-int type_check_bin_expr(Expr* expr) {
-	BinaryExpr* bin = expr->content.as_binary;
-	if (!type_check_expr(bin->left) || !type_check_expr(bin->right))
-		return 0;
+int type_check_bin_expr(Proc* proc, Expr* expr) {
+	BinaryExpr* bin = &expr->content.as_binary;
 
-	if (bin->left->actual_type.type != &INTEGER)
+	if (proc->exprs[bin->left].actual_type.type != &INTEGER)
 		return 0;
-	if (bin->right->actual_type.type != &INTEGER)
+	if (proc->exprs[bin->right].actual_type.type != &INTEGER)
 		return 0;
 
 	expr->actual_type.type = &INTEGER;
 	expr->actual_type.lvalue = 0;
-	expr->actual_type.constant = 0;
+	expr->actual_type.constant = proc->exprs[bin->left].actual_type.constant
+		&& proc->exprs[bin->right].actual_type.constant;
 
 	return 1;
 }
 
 static inline int type_check_id_expr(Expr* expr) {
-	IdExpr* id = expr->content.as_id;
+	IdExpr* id = &expr->content.as_id;
 	ActualType *actual_type;
 
 	switch (id->bind->type) {
 	case BIND_FPARAM:
 		actual_type = &id->bind->content.as_fparam->actual_type;
-		break; 
+		break;
 	case BIND_VAR:
 		actual_type = &id->bind->content.as_var->actual_type;
 		break;
@@ -154,41 +210,28 @@ static inline int type_check_id_expr(Expr* expr) {
 static inline int type_check_num_expr(Expr* expr) {
 	expr->actual_type.type = &INTEGER;
 	expr->actual_type.lvalue = 0;
-	expr->actual_type.constant = 0;
+	expr->actual_type.constant = 1;
 	return 1;
 }
 
 static inline
-int type_check_call_expr(Expr* expr) {
-	int i;
+int type_check_call_expr(Proc* proc, Expr* expr) {
+	unsigned i;
 	ProcType* proc_type;
-	Param* param;
-	CallExpr* call = expr->content.as_call;
+	CallExpr* call = &expr->content.as_call;
+	Type* type = proc->exprs[call->lvalue].actual_type.type;
 
-	if (!type_check_expr(call->lvalue))
+	if (!type || (type->kind != TYPE_PROC))
 		return 0;
+	proc_type = type->content.as_proc;
 
-	if (call->lvalue->actual_type.type->kind != TYPE_PROC)
+	if (call->args.count != (unsigned) proc_type->fparams_count)
 		return 0;
-	proc_type = call->lvalue->actual_type.type->content.as_proc;
-
-	param = call->first_param;
-	for (i=0; i<proc_type->fparams_count; i++) {
-		Type* fp_type;
-		Type* value_type;
-
-		fp_type = proc_type->fparams[i];
-		if (!param || !type_check_expr(param->value))
-			return 0;
-		value_type = param->value->actual_type.type;
-
-		if (memcmp(fp_type, value_type, sizeof(Type)) != 0)
+	for (i=0; i<call->args.count; i++) {
+		Expr* arg = &proc->exprs[proc->args[call->args.first + i]];
+		if (!same_type(proc_type->fparams[i], arg->actual_type.type))
 			return 0;
-
-		param = param->next;
 	}
-	if (param)
-		return 0;
 
 	expr->actual_type.type = proc_type->return_type;
 	expr->actual_type.lvalue = 0;
@@ -197,99 +240,85 @@ int type_check_call_expr(Expr* expr) {
 	return 1;
 }
 
-int type_check_expr(Expr* expr) {
+int type_check_expr(Proc* proc, Expr* expr) {
 	switch (expr->type) {
 	case EXPR_BINARY:
-		return type_check_bin_expr(expr);
+		return type_check_bin_expr(proc, expr);
 	case EXPR_ID:
 		return type_check_id_expr(expr);
 	case EXPR_NUM:
 		return type_check_num_expr(expr);
 	case EXPR_CALL:
-		return type_check_call_expr(expr);
+		return type_check_call_expr(proc, expr);
 	default:
 		assert(0);
 	}
 	return 0;
 }
 
-static int type_check_stmt(Stmt* stmt);
+/* post-order: operands are always checked before the expression using them */
+static inline int type_check_exprs(Proc* proc) {
+	unsigned i;
+	int ok = 1;
+	for (i=0; ok && (i<proc->expr_count); i++)
+		ok = type_check_expr(proc, &proc->exprs[i]);
+	return ok;
+}
 
-static inline int type_check_assign(AssignStmt* assign) {
-	if (!type_check_expr(assign->lvalue) 
-		|| !assign->lvalue->actual_type.lvalue
-		|| assign->lvalue->actual_type.constant
-		|| !type_check_expr(assign->rvalue))
-		return 0;
+static inline int type_check_assign(Proc* proc, AssignStmt* assign) {
+	ActualType* lvalue = &proc->exprs[assign->lvalue].actual_type;
+	ActualType* rvalue = &proc->exprs[assign->rvalue].actual_type;
 
-	return (memcmp(assign->lvalue->actual_type.type, 
-		assign->rvalue->actual_type.type, sizeof(Type)) == 0);
+	return lvalue->lvalue
+		&& !lvalue->constant
+		&& same_type(lvalue->type, rvalue->type);
 }
 
-static inline int type_check_for(ForStmt* forstmt) {
-	return (type_check_expr(forstmt->from) 
-		&& type_check_expr(forstmt->to)
+static inline int type_check_for(Proc* proc, ForStmt* forstmt) {
+	return (proc->exprs[forstmt->from].actual_type.type == &INTEGER)
+		&& (proc->exprs[forstmt->to].actual_type.type == &INTEGER)
 		&& (forstmt->bind->type == BIND_VAR)
-		&& (forstmt->bind->content.as_var->actual_type.type == &INTEGER));
+		&& (forstmt->bind->content.as_var->actual_type.type == &INTEGER);
 }
 
-static inline int type_check_return(ReturnStmt* ret) {
-	return (ret->expr && !type_check_expr(ret->expr)) ? 0 : 1;
+static inline int type_check_call(Proc* proc, CallStmt* call) {
+	return proc->exprs[call->expr].type == EXPR_CALL;
 }
 
-static inline int type_check_call(CallStmt* call) {
-	return type_check_expr(call->expr);
-}
-
-int type_check_stmt(Stmt* stmt) {
+int type_check_stmt(Proc* proc, Stmt* stmt) {
 	switch (stmt->type) {
 	case STMT_ASSIGN:
-		return type_check_assign(stmt->content.as_assign);
+		return type_check_assign(proc, &stmt->content.as_assign);
 	case STMT_FOR:
-		return type_check_for(stmt->content.as_for);
+		return type_check_for(proc, &stmt->content.as_for);
 	case STMT_RETURN:
-		return type_check_return(stmt->content.as_return);
+		return 1;
 	case STMT_CALL:
-		return type_check_call(stmt->content.as_call);
+		return type_check_call(proc, &stmt->content.as_call);
 	default:
 		assert(0);
-		return 0;
 	}
+	return 0;
 }
 
-static inline int type_check_stmts(Stmt* stmt) {
+static inline int type_check_stmts(Proc* proc) {
+	unsigned i;
 	int ok = 1;
-	while (ok && stmt) {
-		if (type_check_stmt(stmt))
-			stmt = stmt->next;
-		else
-			ok = 0;
-	}
+	for (i=0; ok && (i<proc->stmt_count); i++)
+		ok = type_check_stmt(proc, &proc->stmts[i]);
 	return ok;
 }
 
+int type_check_proc(Proc* proc) {
+	return type_check_exprs(proc) && type_check_stmts(proc);
+}
+
 int type_check(Prog* prog) {
-	int ok = attach_types(prog);
-	if (ok) {
-		Proc* proc = prog->first_proc;
-		while (ok && proc) {
-			if (type_check_stmts(proc->first_stmt))
-				proc = proc->next;
-			else
-				ok = 0;
-		}
-	}
+	int ok = 1;
+	int i;
+	for (i=0; ok && (i<prog->proc_count); i++)
+		ok = type_check_header(&prog->types, &prog->procs[i]);
+	for (i=0; ok && (i<prog->proc_count); i++)
+		ok = type_check_proc(&prog->procs[i]);
 	return ok;
 }
-
-void destroy_type(Type* type) {
-	assert(type);
-
-	switch (type->kind) {
-	case TYPE_UNINITIALIZED:
-	case TYPE_INTEGER:
-		return;
-	case TYPE_PROC:
-		return free_proc_type(type->content.as_proc);
-	}
-}
\ No newline at end of file